@@ -11,18 +11,31 @@ namespace tea::args {
 
 	static void help(const char* exeName) {
 		printf(
-			"usage: \"%s\" [options] <files...>\n\n"
+			"usage: \"%s\" [options] <files...>\n"
+			"       \"%s\" run [options] <files...> [-- <program arguments...>]\n\n"
 			"options:\n"
 			"  -o <file>               write output to <file>\n"
 			//"  -c                      compile only (no linking)\n" // TODO: finish bond and implement me
 			"  -t, --triple <triple>   set target triple\n"
+			"  -march=<cpu>            target <cpu> and its features, 'native' for this machine\n"
+			"  -mcpu=<cpu>             target <cpu>, 'native' for the CPU of this machine\n"
+			"  -mattr=<features>       enable or disable target features, like '+avx2,-fma'\n"
 			"  -O[0-3]                 optimization level\n"
+			"  -Os, -Oz                optimize for size, -Oz more aggressively\n"
+			"  --passes=<pipeline>     run an LLVM pass pipeline instead of the default one\n"
+			"  --vectorize-loops       always run the loop vectorizer\n"
+			"  --vectorize-slp         always run the SLP vectorizer\n"
+			"  --time-passes           report the time and instruction counts of each pass\n"
+			"  --codegen-threads <n>   emit machine code on <n> threads, into up to <n> objects\n"
+			"  -g                      emit debug info\n"
 			"  -I <dir>                add import search path\n"
+			"  --whole-program         compile all inputs into one module and output\n"
+			"  -j <n>                  compile <n> inputs at the same time\n"
 			//"  -l <name>               link with library\n"
 			"  -v, --verbose           verbose output\n"
 			"  -h, --help              show this message\n"
 			"  -f, --flag <name>       enable compiler flag\n\n"
-			"flags:\n", exeName
+			"flags:\n", exeName, exeName
 		);
 		for (const auto& [name, _] : name2flag)
 			printf("  %s\n", name.data());
@@ -36,9 +49,21 @@ namespace tea::args {
 
 		Args args;
 
-		for (int i = 1; i < argc; i++) {
+		int first = 1;
+		if (!strcmp(argv[1], "run")) {
+			args.run = true;
+			first = 2;
+		}
+
+		for (int i = first; i < argc; i++) {
 			const char* arg = argv[i];
 
+			if (args.run && !strcmp(arg, "--")) {
+				while (++i < argc)
+					args.programArgs.emplace(argv[i]);
+				break;
+			}
+
 			if (!strcmp(arg, "-h") || !strcmp(arg, "--help")) {
 				help(argv[0]);
 				exit(0);
@@ -58,11 +83,74 @@ namespace tea::args {
 						ctx.diag.fatal(TEA_NO_SOURCELOC, 0, "missing triple after '%s'", arg);
 					args.triple = argv[i];
 				}
-				else if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose"))
+				else if (!strncmp(arg, "-march=", 7) || !strncmp(arg, "-mcpu=", 6)) {
+					const char* cpu = strchr(arg, '=') + 1;
+					if (!*cpu)
+						ctx.diag.fatal(TEA_NO_SOURCELOC, 0, "missing CPU after '%s'", arg);
+					args.pipeline.cpu = cpu;
+					args.pipeline.hostFeatures = arg[2] == 'a' && !strcmp(cpu, "native");
+				}
+				else if (!strncmp(arg, "-mattr=", 7)) {
+					if (!arg[7])
+						ctx.diag.fatal(TEA_NO_SOURCELOC, 0, "missing features after '-mattr='");
+					args.pipeline.features = arg + 7;
+				}
+				else if (!strcmp(arg, "-v") || !strcmp(arg, "--verbose")) {
 					args.verbose = true;
+					args.flags.set(CompilerFlags::Verbose);
+				}
 
-				else if (arg[1] == 'O' && arg[2] >= '0' && arg[2] <= '3' && arg[3] == '\0')
+				else if (arg[1] == 'O' && arg[2] >= '0' && arg[2] <= '3' && arg[3] == '\0') {
 					args.optLevel = (uint8_t)(arg[2] - '0');
+					args.pipeline.sizeLevel = 0;
+				}
+				else if (arg[1] == 'O' && (arg[2] == 's' || arg[2] == 'z') && arg[3] == '\0') {
+					args.optLevel = 2;
+					args.pipeline.sizeLevel = arg[2] == 's' ? 1 : 2;
+				}
+
+				else if (!strncmp(arg, "--passes=", 9)) {
+					if (!arg[9])
+						ctx.diag.fatal(TEA_NO_SOURCELOC, 0, "missing pipeline after '--passes='");
+					args.pipeline.passes = arg + 9;
+				}
+				else if (!strcmp(arg, "--vectorize-loops"))
+					args.pipeline.vectorizeLoops = true;
+				else if (!strcmp(arg, "--vectorize-slp"))
+					args.pipeline.vectorizeSLP = true;
+				else if (!strcmp(arg, "--codegen-threads")) {
+					if (++i >= argc)
+						ctx.diag.fatal(TEA_NO_SOURCELOC, 0, "missing thread count after '%s'", arg);
+
+					char* end = nullptr;
+					unsigned long threads = strtoul(argv[i], &end, 10);
+					if (*end || threads == 0 || threads > 256)
+						ctx.diag.fatal(TEA_NO_SOURCELOC, 0, "invalid thread count: '%s'", argv[i]);
+					args.pipeline.codegenThreads = (uint32_t)threads;
+				}
+				else if (!strcmp(arg, "--cache-dir")) {
+					if (++i >= argc)
+						ctx.diag.fatal(TEA_NO_SOURCELOC, 0, "missing directory after '%s'", arg);
+					args.pipeline.cacheDir = argv[i];
+				}
+				else if (!strcmp(arg, "--time-passes"))
+					args.flags.set(CompilerFlags::TimePasses);
+
+				else if (!strcmp(arg, "-g"))
+					args.flags.set(CompilerFlags::DebugInfo);
+
+				else if (!strcmp(arg, "--whole-program"))
+					args.wholeProgram = true;
+				else if (!strcmp(arg, "-j")) {
+					if (++i >= argc)
+						ctx.diag.fatal(TEA_NO_SOURCELOC, 0, "missing job count after '%s'", arg);
+
+					char* end = nullptr;
+					unsigned long jobs = strtoul(argv[i], &end, 10);
+					if (*end || jobs == 0 || jobs > 256)
+						ctx.diag.fatal(TEA_NO_SOURCELOC, 0, "invalid job count: '%s'", argv[i]);
+					args.jobs = (uint32_t)jobs;
+				}
 
 				else if (!strcmp(arg, "-I")) {
 					if (++i >= argc)
@@ -87,6 +175,8 @@ namespace tea::args {
 
 		if (args.inputs.empty())
 			ctx.diag.fatal(TEA_NO_SOURCELOC, 0, "no input files");
+		if (args.run && args.triple)
+			ctx.diag.fatal(TEA_NO_SOURCELOC, 0, "'run' always targets the host, a triple can't be given");
 
 		return args;
 	}
@@ -13,12 +13,20 @@ namespace tea::args {
 		uint8_t optLevel = 2;
 		bool verbose = false;
 		bool compileOnly = true;
+		bool wholeProgram = false;
+		// inputs compiled at the same time, each on a thread of its own
+		uint32_t jobs = 1;
+		// `tea run`, JIT-compile the inputs and call `main` instead of writing an object file
+		bool run = false;
+		PipelineOptions pipeline;
 		CompilerFlags flags = CompilerFlags::None;
 
 		const char* triple = nullptr;
 
 		tea::vector<const char*> inputs;
 		tea::vector<const char*> importLookup;
+		// what follows `--`, handed to the program by `tea run`
+		tea::vector<const char*> programArgs;
 	};
 
 	Args parse(Context& ctx, int argc, char** argv);
@@ -12,6 +12,19 @@ namespace tea::backend {
 			const char* outfile = nullptr;
 			bool dumpModule : 1 = true;
 			uint8_t optLevel : 2 = 0;
+			bool debugInfo : 1 = false;
+			uint8_t sizeLevel : 2 = 0;
+			bool vectorizeLoops : 1 = false;
+			bool vectorizeSLP : 1 = false;
+			bool timePasses : 1 = false;
+			// LLVM pass pipeline to run instead of the default one of `optLevel`
+			const char* passes = nullptr;
+			// threads machine code is emitted on, more than one splits the module
+			uint32_t codegenThreads = 1;
+			// target CPU and features, "native" for the host as in `PipelineOptions`
+			const char* cpu = nullptr;
+			const char* features = nullptr;
+			bool hostFeatures : 1 = false;
 		};
 
 		Options options;
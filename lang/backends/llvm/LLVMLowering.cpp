@@ -1,11 +1,20 @@
 #include "LLVMLowering.h"
 
+#include <mutex>
+#include <cstring>
+#include <chrono>
+#include <format>
+#include <filesystem>
+
 #include "core/tea.h"
 
 #include "llvm-c/Core.h"
+#include "llvm-c/Support.h"
 #include "llvm-c/Analysis.h"
+#include "llvm-c/DebugInfo.h"
 #include "llvm-c/TargetMachine.h"
-#include "llvm-c/Transforms/PassManagerBuilder.h"
+#include "llvm-c/ExecutionEngine.h"
+#include "llvm-c/Transforms/PassBuilder.h"
 
 #define lowerBasicBlock(x) blockMap[(const mir::BasicBlock*)(x)]
 
@@ -57,21 +66,91 @@ namespace tea::backend {
 		}
 	}
 
-	void LLVMLowering::lower(const mir::Module* module, Options options) {
-		LLVMInitializeAllTargets();
-		LLVMInitializeAllTargetMCs();
-		LLVMInitializeAllTargetInfos();
-		LLVMInitializeAllAsmPrinters();
-		LLVMContextSetOpaquePointers(LLVMGetGlobalContext(), false);
+	// a call may only be marked as a tail call if the callee can't reach the caller's stack
+	static bool hasEscapingAllocas(const mir::Function* f) {
+		tea::map<const mir::Value*, bool> allocas;
+		for (const auto& block : f->blocks)
+			for (const auto& insn : block->body)
+				if (insn.op == mir::OpCode::Alloca)
+					allocas[insn.result.get()] = true;
 
-		M = LLVMModuleCreateWithName(module->source.data());
-		this->options = options;
+		if (allocas.empty())
+			return false;
+
+		for (const auto& block : f->blocks) {
+			for (const auto& insn : block->body) {
+				if (insn.op == mir::OpCode::Br || insn.op == mir::OpCode::CondBr || insn.op == mir::OpCode::Switch)
+					continue;
+
+				// being the address of a load or store doesn't leak the pointer
+				uint32_t first = insn.op == mir::OpCode::Load || insn.op == mir::OpCode::Store ? 1 : 0;
+				for (uint32_t i = first; i < insn.operands.size; i++)
+					if (allocas.contains(insn.operands[i]))
+						return true;
+			}
+		}
+		return false;
+	}
+
+	static bool isTailCall(const mir::BasicBlock* block, const mir::Instruction* call) {
+		const mir::Instruction* term = block->getTerminator();
+		if (!term || term->op != mir::OpCode::Ret)
+			return false;
+
+		for (const mir::Instruction* insn = call + 1; insn < term; insn++)
+			if (insn->op != mir::OpCode::Nop)
+				return false;
+
+		if (call->result)
+			return term->operands.size == 1 && term->operands[0] == call->result.get();
+		return term->operands.size == 0;
+	}
+
+	static uint64_t countInstructions(LLVMModuleRef M) {
+		uint64_t size = 0;
+		for (LLVMValueRef func = LLVMGetFirstFunction(M); func; func = LLVMGetNextFunction(func))
+			for (LLVMBasicBlockRef block = LLVMGetFirstBasicBlock(func); block; block = LLVMGetNextBasicBlock(block))
+				for (LLVMValueRef insn = LLVMGetFirstInstruction(block); insn; insn = LLVMGetNextInstruction(insn))
+					size++;
+		return size;
+	}
+
+	static double elapsedMs(std::chrono::steady_clock::time_point start) {
+		return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+	}
+
+	void LLVMLowering::recordTarget(const char* triple) {
+		std::string target = "target-cpu=" + (targetCPU.empty() ? "generic" : targetCPU) + " target-features=" + targetFeatures;
+
+		LLVMValueRef str = LLVMConstStringInContext(C, target.c_str(), (uint32_t)target.size(), false);
+		LLVMValueRef global = LLVMAddGlobal(M, LLVMTypeOf(str), "tea.target");
+		LLVMSetInitializer(global, str);
+		LLVMSetGlobalConstant(global, true);
+		LLVMSetLinkage(global, LLVMPrivateLinkage);
+		// Mach-O names sections by segment
+		LLVMSetSection(global, strstr(triple, "apple") || strstr(triple, "darwin") ? "__DATA,__tea_target" : ".tea.target");
+
+		// kept through optimization and code generation although nothing refers to it
+		LLVMTypeRef i8p = LLVMPointerType(LLVMInt8TypeInContext(C), 0);
+		LLVMValueRef used[] = { LLVMConstBitCast(global, i8p) };
+		LLVMValueRef list = LLVMConstArray(i8p, used, 1);
+		LLVMValueRef usedGlobal = LLVMAddGlobal(M, LLVMTypeOf(list), "llvm.used");
+		LLVMSetInitializer(usedGlobal, list);
+		LLVMSetLinkage(usedGlobal, LLVMAppendingLinkage);
+		LLVMSetSection(usedGlobal, "llvm.metadata");
+	}
+
+	LLVMTargetMachineRef LLVMLowering::lowerModule(const mir::Module* module) {
+		// a context of its own, other threads may be lowering modules at the same time
+		C = LLVMContextCreate();
+		LLVMContextSetOpaquePointers(C, false);
+		M = LLVMModuleCreateWithNameInContext(module->source.data(), C);
 
 		char* err = nullptr;
 
 		tea::string triple = module->triple;
 		if (module->triple.empty())
-			triple = LLVMGetDefaultTargetTriple();
+			triple = session.getDefaultTriple().c_str();
 
 		std::string dl; {
 			LLVMSetTarget(M, triple.data());
@@ -89,17 +168,38 @@ namespace tea::backend {
 			LLVMSetDataLayout(M, dl.c_str());
 		}
 
-		LLVMTargetRef T = nullptr;
-		if (LLVMGetTargetFromTriple(triple.data(), &T, &err))
-			ctx.diag.fatal(TEA_NO_SOURCELOC, 5000, "%s", err);
-		LLVMTargetMachineRef TM = LLVMCreateTargetMachine(
-			T, triple.data(),
-			"", "",
-			LLVMCodeGenLevelDefault, LLVMRelocDefault, LLVMCodeModelDefault
-		);
+		// the host's CPU says nothing about another target
+		bool native = options.hostFeatures || (options.cpu && !strcmp(options.cpu, "native"));
+		if (native && triple.data() != session.getDefaultTriple())
+			ctx.diag.fatal(TEA_NO_SOURCELOC, 5000, "'native' can only be used when targeting the host, not '%s'", triple.data());
+
+		session.resolveTarget(options.cpu, options.features, options.hostFeatures, targetCPU, targetFeatures);
+
+		switch (options.optLevel) {
+		case 0: codegenLevel = LLVMCodeGenLevelNone; break;
+		case 1: codegenLevel = LLVMCodeGenLevelLess; break;
+		case 2: codegenLevel = LLVMCodeGenLevelDefault; break;
+		default: codegenLevel = LLVMCodeGenLevelAggressive; break;
+		}
+
+		std::string error;
+		machine = LLVMSession::Reservation(session, session.acquire(triple.data(), targetCPU.c_str(), targetFeatures.c_str(), codegenLevel, error));
+		LLVMTargetMachineRef TM = machine.get();
 		if (!TM)
-			ctx.diag.fatal(TEA_NO_SOURCELOC, 5000, "failed to create target machine");
+			ctx.diag.fatal(TEA_NO_SOURCELOC, 5000, "%s", error.c_str());
+
+		if (!targetCPU.empty() || !targetFeatures.empty())
+			recordTarget(triple.data());
+
+		if (options.debugInfo) {
+			DIB = LLVMCreateDIBuilder(M);
 
+			LLVMTypeRef i32 = LLVMInt32TypeInContext(C);
+			LLVMAddModuleFlag(M, LLVMModuleFlagBehaviorWarning, "Debug Info Version", 18, LLVMValueAsMetadata(LLVMConstInt(i32, LLVMDebugMetadataVersion(), false)));
+			LLVMAddModuleFlag(M, LLVMModuleFlagBehaviorWarning, "Dwarf Version", 13, LLVMValueAsMetadata(LLVMConstInt(i32, 4, false)));
+		}
+
+		// every function is declared before any body is lowered, so calls don't depend on the order of the module
 		for (const auto& g : module->body) {
 			switch (g->kind) {
 			case mir::ValueKind::Global:
@@ -109,47 +209,157 @@ namespace tea::backend {
 			case mir::ValueKind::Function: {
 				const mir::Function* f = (const mir::Function*)g.get();
 				if (!f->hasAttribute(mir::FunctionAttribute::Inline))
-					removeDeadBlocks(lowerFunction(f));
+					declareFunction(f);
 			} break;
 
 			default:
 				TEA_UNREACHABLE();
 			}
 		}
+
+		for (const auto& g : module->body) {
+			if (g->kind != mir::ValueKind::Function)
+				continue;
+
+			const mir::Function* f = (const mir::Function*)g.get();
+			if (!f->hasAttribute(mir::FunctionAttribute::Inline))
+				removeDeadBlocks(lowerFunction(f));
+		}
+
+		if (DIB) {
+			LLVMDIBuilderFinalize(DIB);
+			LLVMDisposeDIBuilder(DIB);
+			DIB = nullptr;
+			compileUnit = nullptr;
+			fileMap.clear();
+		}
 		
 		if (LLVMVerifyModule(M, LLVMReturnStatusAction, &err)) {
 			if (options.dumpModule) LLVMDumpModule(M);
 			ctx.diag.fatal(TEA_NO_SOURCELOC, 5000, "lowering failed: %s", err);
 		}
 
-		if (options.optLevel > 0) {
-			LLVMPassManagerRef pm = LLVMCreatePassManager();
-			LLVMPassManagerBuilderRef pmb = LLVMPassManagerBuilderCreate();
-			LLVMPassManagerBuilderSetOptLevel(pmb, options.optLevel);
-			LLVMPassManagerBuilderPopulateModulePassManager(pmb, pm);
-			LLVMRunPassManager(pm, M);
-			LLVMDisposePassManager(pm);
+		if (options.timePasses) {
+			// LLVM reports its own passes when they finish, the option is global and can only be parsed once
+			static std::once_flag timersEnabled;
+			std::call_once(timersEnabled, [] {
+				const char* argv[] = { "tea", "-time-passes" };
+				LLVMParseCommandLineOptions(2, argv, nullptr);
+			});
+		}
+
+		if (options.optLevel > 0 || options.passes) {
+			std::string pipeline;
+			if (options.passes)
+				pipeline = options.passes;
+			else if (options.sizeLevel)
+				pipeline = options.sizeLevel == 1 ? "default<Os>" : "default<Oz>";
+			else
+				pipeline = std::format("default<O{}>", (int)options.optLevel);
+
+			// the vectorizers are on by default where clang has them on, -O2 and up unless optimizing hard for size
+			bool vectorize = options.optLevel > 1 && options.sizeLevel < 2;
+			LLVMPassBuilderOptionsRef pbo = LLVMCreatePassBuilderOptions();
+			LLVMPassBuilderOptionsSetLoopVectorization(pbo, vectorize || options.vectorizeLoops);
+			LLVMPassBuilderOptionsSetSLPVectorization(pbo, vectorize || options.vectorizeSLP);
+
+			uint64_t before = countInstructions(M);
+			auto start = std::chrono::steady_clock::now();
+			LLVMErrorRef error = LLVMRunPasses(M, pipeline.c_str(), TM, pbo);
+			double ms = elapsedMs(start);
+			LLVMDisposePassBuilderOptions(pbo);
+
+			if (error) {
+				char* message = LLVMGetErrorMessage(error);
+				std::string copy = message;
+				LLVMDisposeErrorMessage(message);
+				ctx.diag.fatal(TEA_NO_SOURCELOC, 5000, "invalid pass pipeline '%s': %s", pipeline.c_str(), copy.c_str());
+			}
+
+			if (options.timePasses)
+				printf("LLVM: '%s' took %.3fms, %llu -> %llu instruction(s)\n", pipeline.c_str(), ms, (unsigned long long)before, (unsigned long long)countInstructions(M));
 		}
 		if (options.dumpModule) LLVMDumpModule(M);
+		return TM;
+	}
 
-		if (LLVMTargetMachineEmitToFile(TM, M, options.outfile, LLVMObjectFile, &err))
-			ctx.diag.fatal(TEA_NO_SOURCELOC, 5000, "lowering failed: %s", err);
+	void LLVMLowering::lower(const mir::Module* module, Options options) {
+		this->options = options;
+		LLVMTargetMachineRef TM = lowerModule(module);
+
+		char* err = nullptr;
+		auto start = std::chrono::steady_clock::now();
+		if (options.codegenThreads > 1)
+			emitPartitioned(TM, options.codegenThreads);
+		else {
+			if (LLVMTargetMachineEmitToFile(TM, M, options.outfile, LLVMObjectFile, &err))
+				ctx.diag.fatal(TEA_NO_SOURCELOC, 5000, "lowering failed: %s", err);
+			removeStalePartitions(1);
+		}
+		if (options.timePasses)
+			printf("LLVM: code generation took %.3fms\n", elapsedMs(start));
 
 		LLVMDisposeModule(M);
-		LLVMDisposeTargetMachine(TM);
+		LLVMContextDispose(C);
+		machine.reset();
+	}
+
+	int LLVMLowering::run(const mir::Module* module, Options options, int argc, const char* const* argv) {
+		this->options = options;
+		lowerModule(module);
+		machine.reset();
+
+		LLVMValueRef entry = LLVMGetNamedFunction(M, "main");
+		if (!entry || LLVMIsDeclaration(entry))
+			ctx.diag.fatal(TEA_NO_SOURCELOC, 5000, "no 'main' function to run");
+
+		// imports are resolved against the symbols of this process, like the runtime linked into it
+		LLVMLoadLibraryPermanently(nullptr);
+		for (LLVMValueRef func = LLVMGetFirstFunction(M); func; func = LLVMGetNextFunction(func)) {
+			// imports nothing calls don't need to exist
+			if (!LLVMIsDeclaration(func) || LLVMGetIntrinsicID(func) || !LLVMGetFirstUse(func))
+				continue;
+
+			const char* name = LLVMGetValueName(func);
+			if (!LLVMSearchForAddressOfSymbol(name))
+				ctx.diag.error(TEA_NO_SOURCELOC, 5001, "unresolved symbol '%s'", name);
+		}
+		if (ctx.diag.hasError)
+			return 1;
+
+		LLVMLinkInMCJIT();
+
+		LLVMMCJITCompilerOptions jitOptions;
+		LLVMInitializeMCJITCompilerOptions(&jitOptions, sizeof(jitOptions));
+		jitOptions.OptLevel = options.optLevel;
+
+		char* err = nullptr;
+		LLVMExecutionEngineRef EE = nullptr;
+		if (LLVMCreateMCJITCompilerForModule(&EE, M, &jitOptions, sizeof(jitOptions), &err))
+			ctx.diag.fatal(TEA_NO_SOURCELOC, 5000, "failed to create JIT: %s", err);
+		// the engine owns the module now
+		M = nullptr;
+
+		const char* envp[] = { nullptr };
+		int result = LLVMRunFunctionAsMain(EE, entry, argc, argv, envp);
+		fflush(stdout);
+
+		LLVMDisposeExecutionEngine(EE);
+		LLVMContextDispose(C);
+		return result;
 	}
 
 	LLVMTypeRef LLVMLowering::lowerType(const Type* ty) {
 		switch (ty->kind) {
-		case TypeKind::Void: return LLVMVoidType();
-		case TypeKind::Bool: return LLVMInt1Type();
-		case TypeKind::Char: return LLVMInt8Type();
-		case TypeKind::Short: return LLVMInt16Type();
-		case TypeKind::Float: return LLVMFloatType();
-		case TypeKind::Int: return LLVMInt32Type();
-		case TypeKind::Double: return LLVMDoubleType();
-		case TypeKind::Long: return LLVMInt64Type();
-		case TypeKind::String: return LLVMPointerType(LLVMInt8Type(), 0);
+		case TypeKind::Void: return LLVMVoidTypeInContext(C);
+		case TypeKind::Bool: return LLVMInt1TypeInContext(C);
+		case TypeKind::Char: return LLVMInt8TypeInContext(C);
+		case TypeKind::Short: return LLVMInt16TypeInContext(C);
+		case TypeKind::Float: return LLVMFloatTypeInContext(C);
+		case TypeKind::Int: return LLVMInt32TypeInContext(C);
+		case TypeKind::Double: return LLVMDoubleTypeInContext(C);
+		case TypeKind::Long: return LLVMInt64TypeInContext(C);
+		case TypeKind::String: return LLVMPointerType(LLVMInt8TypeInContext(C), 0);
 		case TypeKind::Pointer: return LLVMPointerType(lowerType(((PointerType*)ty)->pointee), 0);
 		case TypeKind::Function: {
 			FunctionType* ftype = (FunctionType*)ty;
@@ -166,13 +376,13 @@ namespace tea::backend {
 		case TypeKind::Struct: {
 			StructType* st = (StructType*)ty;
 
-			LLVMTypeRef ty = LLVMGetTypeByName2(LLVMGetGlobalContext(), st->name);
+			LLVMTypeRef ty = LLVMGetTypeByName2(C, st->name);
 			if (!ty) {
 				tea::vector<LLVMTypeRef> body;
 				for (const auto& el : st->body)
 					body.emplace(lowerType(el));
 
-				ty = LLVMStructCreateNamed(LLVMGetGlobalContext(), st->name);
+				ty = LLVMStructCreateNamed(C, st->name);
 				LLVMStructSetBody(ty, body.data, body.size, st->extra);
 			}
 			return ty;
@@ -211,7 +421,47 @@ namespace tea::backend {
 		globalMap[g->name] = global;
 	}
 
-	LLVMValueRef LLVMLowering::lowerFunction(const mir::Function* f) {
+	static void addAttribute(LLVMContextRef C, LLVMValueRef func, LLVMAttributeIndex index, const char* name, uint64_t value = 0) {
+		// kinds missing from this version of LLVM are left out
+		if (uint32_t kind = LLVMGetEnumAttributeKindForName(name, strlen(name)))
+			LLVMAddAttributeAtIndex(func, index, LLVMCreateEnumAttribute(C, kind, value));
+	}
+
+	static void addInferredAttributes(LLVMContextRef C, LLVMValueRef func, const mir::Function* f) {
+		using mir::InferredAttribute;
+
+		bool readNone = f->hasInferred(InferredAttribute::ReadNone);
+		bool readOnly = f->hasInferred(InferredAttribute::ReadOnly);
+		bool argMemOnly = f->hasInferred(InferredAttribute::ArgMemOnly);
+		if (LLVMGetEnumAttributeKindForName("memory", 6)) {
+			// LLVM 16 replaced readnone and friends with `memory`, two bits (ref, mod) for argument,
+			// inaccessible and other memory each
+			if (readNone || readOnly || argMemOnly) {
+				uint64_t access = readOnly ? 1 : 3;
+				addAttribute(C, func, LLVMAttributeFunctionIndex, "memory", readNone ? 0 : argMemOnly ? access : access * 0b010101);
+			}
+		} else {
+			if (readNone)
+				addAttribute(C, func, LLVMAttributeFunctionIndex, "readnone");
+			if (readOnly)
+				addAttribute(C, func, LLVMAttributeFunctionIndex, "readonly");
+			if (argMemOnly)
+				addAttribute(C, func, LLVMAttributeFunctionIndex, "argmemonly");
+		}
+
+		if (f->hasInferred(InferredAttribute::NoUnwind))
+			addAttribute(C, func, LLVMAttributeFunctionIndex, "nounwind");
+		if (f->hasInferred(InferredAttribute::WillReturn))
+			addAttribute(C, func, LLVMAttributeFunctionIndex, "willreturn");
+		if (f->hasInferred(InferredAttribute::NoAliasReturn))
+			addAttribute(C, func, LLVMAttributeReturnIndex, "noalias");
+
+		for (uint32_t i = 0; i < f->params.size; i++)
+			if (f->isNonNull(i))
+				addAttribute(C, func, i + 1, "nonnull");
+	}
+
+	LLVMValueRef LLVMLowering::declareFunction(const mir::Function* f) {
 		LLVMValueRef func;
 		if (f->linkName)
 			func = LLVMAddFunction(M, f->linkName, lowerType(f->type));
@@ -222,8 +472,9 @@ namespace tea::backend {
 			func = LLVMAddFunction(M, linkName.c_str(), lowerType(f->type));
 		}
 
+		// internal rather than private linkage keeps the symbol name around for debuggers and profilers
 		if (f->storage == mir::StorageClass::Private)
-			LLVMSetLinkage(func, LLVMPrivateLinkage);
+			LLVMSetLinkage(func, LLVMInternalLinkage);
 
 		if (f->cc != mir::CallingConvention::Auto)
 			switch (f->cc) {
@@ -234,10 +485,22 @@ namespace tea::backend {
 			}
 
 		if (f->hasAttribute(mir::FunctionAttribute::NoReturn))
-			LLVMAddAttributeAtIndex(func, LLVMAttributeFunctionIndex, LLVMCreateEnumAttribute(LLVMGetGlobalContext(), LLVMNoReturnAttributeKind, 0));
+			LLVMAddAttributeAtIndex(func, LLVMAttributeFunctionIndex, LLVMCreateEnumAttribute(C, LLVMNoReturnAttributeKind, 0));
+		addInferredAttributes(C, func, f);
+
+		// on the function as well, the JIT and inliner only see the target through these
+		if (!targetCPU.empty())
+			LLVMAddTargetDependentFunctionAttr(func, "target-cpu", targetCPU.c_str());
+		if (!targetFeatures.empty())
+			LLVMAddTargetDependentFunctionAttr(func, "target-features", targetFeatures.c_str());
 
 		globalMap[f->name] = func;
-		
+		return func;
+	}
+
+	LLVMValueRef LLVMLowering::lowerFunction(const mir::Function* f) {
+		LLVMValueRef func = *globalMap.find(f->name);
+
 		if (f->params.size) {
 			for (uint32_t i = 0; i < f->params.size; i++) {
 				LLVMValueRef param = LLVMGetParam(func, i);
@@ -248,10 +511,15 @@ namespace tea::backend {
 			}
 		}
 
-		LLVMBuilderRef builder = LLVMCreateBuilder();
+		tailCallsAllowed = !hasEscapingAllocas(f);
+		LLVMBuilderRef builder = LLVMCreateBuilderInContext(C);
+
+		subprogram = DIB && f->fsrc != badid ? lowerSubprogram(f, func) : nullptr;
+		if (subprogram)
+			LLVMSetCurrentDebugLocation2(builder, LLVMDIBuilderCreateDebugLocation(C, f->line, 0, subprogram, nullptr));
 
 		for (const auto& block : f->blocks)
-			lowerBasicBlock(block.get()) = LLVMAppendBasicBlock(func, block->name);
+			lowerBasicBlock(block.get()) = LLVMAppendBasicBlockInContext(C, func, block->name);
 		
 		for (const auto& block : f->blocks) {
 			LLVMPositionBuilderAtEnd(builder, lowerBasicBlock(block.get()));
@@ -261,13 +529,62 @@ namespace tea::backend {
 		LLVMDisposeBuilder(builder);
 		blockMap.clear();
 		valueMap.clear();
+		subprogram = nullptr;
 		return func;
 	}
 
+	LLVMMetadataRef LLVMLowering::lowerFile(uint32_t fsrc) {
+		if (auto* it = fileMap.find(fsrc))
+			return *it;
+
+		std::filesystem::path path = std::filesystem::absolute(ctx.sources.pathof(fsrc).data());
+		std::string name = path.filename().string();
+		std::string dir = path.parent_path().string();
+
+		LLVMMetadataRef file = LLVMDIBuilderCreateFile(DIB, name.c_str(), name.size(), dir.c_str(), dir.size());
+		if (!compileUnit)
+			compileUnit = LLVMDIBuilderCreateCompileUnit(
+				DIB, LLVMDWARFSourceLanguageC, file,
+				"tea", 3,
+				options.optLevel > 0, "", 0,
+				0, "", 0,
+				LLVMDWARFEmissionFull, 0, false,
+				false, "", 0,
+				"", 0
+			);
+
+		fileMap.insert(fsrc, file);
+		return file;
+	}
+
+	LLVMMetadataRef LLVMLowering::lowerSubprogram(const mir::Function* f, LLVMValueRef func) {
+		LLVMMetadataRef file = lowerFile(f->fsrc);
+
+		// line tables don't need the signature, the parameter types are left out
+		LLVMMetadataRef type = LLVMDIBuilderCreateSubroutineType(DIB, file, nullptr, 0, LLVMDIFlagZero);
+
+		size_t linkNameLen = 0;
+		const char* linkName = LLVMGetValueName2(func, &linkNameLen);
+
+		LLVMMetadataRef sp = LLVMDIBuilderCreateFunction(
+			DIB, file, f->name, strlen(f->name),
+			linkName, linkNameLen,
+			file, f->line, type,
+			f->storage == mir::StorageClass::Private, true,
+			f->line, LLVMDIFlagPrototyped, options.optLevel > 0
+		);
+		LLVMSetSubprogram(func, sp);
+		return sp;
+	}
+
 	void LLVMLowering::lowerBlock(const mir::BasicBlock* block, LLVMBuilderRef builder) {
 		for (const auto& insn : block->body) {
 			LLVMValueRef result = nullptr;
 
+			// instructions without a location of their own keep the one before them
+			if (subprogram && insn.line)
+				LLVMSetCurrentDebugLocation2(builder, LLVMDIBuilderCreateDebugLocation(C, insn.line, insn.column, subprogram, nullptr));
+
 			switch (insn.op) {
 			case mir::OpCode::Add: {
 				LLVMValueRef lhs = lowerValue(insn.operands[0]);
@@ -363,6 +680,15 @@ namespace tea::backend {
 				);
 				break;
 
+			case mir::OpCode::Select:
+				result = LLVMBuildSelect(
+					builder, lowerValue(insn.operands[0]),
+					lowerValue(insn.operands[1]),
+					lowerValue(insn.operands[2]),
+					insn.result->name
+				);
+				break;
+
 			case mir::OpCode::Load: {
 				LLVMValueRef ptr = lowerValue(insn.operands[0]);
 				result = LLVMBuildLoad(builder, ptr, insn.result->name);
@@ -402,6 +728,17 @@ namespace tea::backend {
 				);
 				break;
 
+			case mir::OpCode::Switch: {
+				// LLVM picks between jump tables, bit tests and compare trees depending on how dense the cases are
+				LLVMValueRef sw = LLVMBuildSwitch(
+					builder, lowerValue(insn.operands[0]),
+					lowerBasicBlock(insn.operands[1]),
+					(insn.operands.size - 2) / 2
+				);
+				for (uint32_t i = 2; i + 1 < insn.operands.size; i += 2)
+					LLVMAddCase(sw, lowerValue(insn.operands[i]), lowerBasicBlock(insn.operands[i + 1]));
+			} break;
+
 			case mir::OpCode::Ret: {
 				if (!insn.operands.size)
 					LLVMBuildRetVoid(builder);
@@ -413,9 +750,9 @@ namespace tea::backend {
 				tea::vector<LLVMValueRef> incomingValues;
 				tea::vector<LLVMBasicBlockRef> incomingBlocks;
 
-				for (uint32_t i = 0; i < insn.operands.size;) {
-					incomingValues.emplace(lowerValue(insn.operands[++i]));
-					incomingBlocks.emplace(lowerBasicBlock(insn.operands[++i]));
+				for (uint32_t i = 1; i + 1 < insn.operands.size; i += 2) {
+					incomingValues.emplace(lowerValue(insn.operands[i]));
+					incomingBlocks.emplace(lowerBasicBlock(insn.operands[i + 1]));
 				}
 
 				result = LLVMBuildPhi(builder, lowerType((const Type*)insn.operands[0]), insn.result->name);
@@ -434,10 +771,21 @@ namespace tea::backend {
 					args.emplace(lowerValue(insn.operands[i]));
 				
 				FunctionType* ftype = (FunctionType*)insn.operands[0]->type;
+				LLVMValueRef call = LLVMBuildCall(builder, callee, args.data, args.size, insn.result ? insn.result->name : "");
 				if (insn.result)
-					result = LLVMBuildCall(builder, callee, args.data, args.size, insn.result->name);
-				else
-					LLVMBuildCall(builder, callee, args.data, args.size, "");
+					result = call;
+
+				// a call has to agree with its callee, calls of a mismatched convention are undefined
+				if (LLVMIsAFunction(callee))
+					LLVMSetInstructionCallConv(call, LLVMGetFunctionCallConv(callee));
+
+				// compare the conventions LLVM actually uses. `tail` is only a hint, so a public function may also
+				// tail call a private one switched to fastcc, the backend decides whether the frames are compatible
+				LLVMValueRef caller = LLVMGetBasicBlockParent(LLVMGetInsertBlock(builder));
+				unsigned callCC = LLVMGetInstructionCallConv(call);
+				bool compatibleCC = callCC == LLVMGetFunctionCallConv(caller) || callCC == LLVMFastCallConv;
+				if (tailCallsAllowed && compatibleCC && isTailCall(block, &insn))
+					LLVMSetTailCall(call, true);
 			} break;
 
 			case mir::OpCode::Nop:
@@ -518,7 +866,7 @@ namespace tea::backend {
 
 			case mir::ConstantKind::String: {
 				mir::ConstantString* str = (mir::ConstantString*)val;
-				return LLVMConstString(str->value.data(), (uint32_t)str->value.length(), false);
+				return LLVMConstStringInContext(C, str->value.data(), (uint32_t)str->value.length(), false);
 			} break;
 
 			case mir::ConstantKind::Array: {
@@ -544,7 +892,7 @@ namespace tea::backend {
 		} break;
 
 		default:
-			return LLVMConstNull(LLVMPointerType(LLVMVoidType(), 0));
+			return LLVMConstNull(LLVMPointerType(LLVMVoidTypeInContext(C), 0));
 		}
 	}
 
@@ -1,29 +1,79 @@
 #pragma once
 
+#include <string>
+
 #include "mir/mir.h"
 #include "backends/Lowering.h"
+#include "backends/llvm/LLVMSession.h"
 #include "backends/llvm/llvm-c/Types.h"
+#include "backends/llvm/llvm-c/TargetMachine.h"
 
 namespace tea::backend {
 
 	class LLVMLowering : Lowering {
+		LLVMSession& session;
+		// the target machine of the module being lowered, given back when done or when lowering fails
+		LLVMSession::Reservation machine;
+		LLVMContextRef C = nullptr;
 		LLVMModuleRef M = nullptr;
+		bool tailCallsAllowed = false;
+
+		// what `options` resolve to, empty for the baseline of the triple
+		std::string targetCPU;
+		std::string targetFeatures;
+		// the -O level in the terms of the code generator, for every target machine of the module
+		LLVMCodeGenOptLevel codegenLevel = LLVMCodeGenLevelDefault;
+
+		// debug info, only set up under `-g`
+		LLVMDIBuilderRef DIB = nullptr;
+		LLVMMetadataRef compileUnit = nullptr;
+		LLVMMetadataRef subprogram = nullptr;
+		tea::umap<uint32_t, LLVMMetadataRef> fileMap;
 
 		tea::map<tea::string, LLVMValueRef> globalMap;
 		tea::umap<const mir::Value*, LLVMValueRef> valueMap;
 		tea::umap<const mir::BasicBlock*, LLVMBasicBlockRef> blockMap;
 
 	public:
-		LLVMLowering(tea::Context& ctx) : Lowering(ctx) {};
+		LLVMLowering(tea::Context& ctx, LLVMSession& session) : Lowering(ctx), session(session) {};
 
 		void lower(const mir::Module* module, Options options) override;
 
+		/// <summary>
+		/// JIT-compile `module` in this process and call its `main` with `argv`, imports are resolved against
+		/// the process' own symbols
+		/// </summary>
+		/// <returns>What `main` returned</returns>
+		int run(const mir::Module* module, Options options, int argc, const char* const* argv);
+
 	private:
+		// lower, verify and optimize `module` into `M`, the returned target machine is held in `machine`
+		LLVMTargetMachineRef lowerModule(const mir::Module* module);
+
+		// write the target CPU and features into a section of their own, so objects built for another CPU can
+		// be told apart
+		void recordTarget(const char* triple);
+
+		/// <summary>
+		/// Split `M` by function into up to `threads` parts and emit each on its own thread, the first into the
+		/// output and the others next to it
+		/// </summary>
+		void emitPartitioned(LLVMTargetMachineRef TM, uint32_t threads);
+
+		// delete the `<output>.partN.o` left behind by an earlier run split into more parts, from part `first` on
+		void removeStalePartitions(uint32_t first);
 		LLVMTypeRef lowerType(const Type* ty);
 		void lowerGlobal(const mir::Global* g);
 		LLVMValueRef lowerValue(const mir::Value* val);
+		LLVMValueRef declareFunction(const mir::Function* f);
 		LLVMValueRef lowerFunction(const mir::Function* f);
 		void lowerBlock(const mir::BasicBlock* block, LLVMBuilderRef builder);
+
+		/// <summary>
+		/// Get the debug info file for source `fsrc`, the first one asked for becomes the compile unit's
+		/// </summary>
+		LLVMMetadataRef lowerFile(uint32_t fsrc);
+		LLVMMetadataRef lowerSubprogram(const mir::Function* f, LLVMValueRef func);
 	};
 
 } // namespace tea::backend
@@ -0,0 +1,88 @@
+#include "LLVMSession.h"
+
+#include <cstring>
+
+#include "llvm-c/Core.h"
+#include "llvm-c/Target.h"
+
+namespace tea::backend {
+
+	LLVMSession::LLVMSession() {
+		LLVMInitializeAllTargets();
+		LLVMInitializeAllTargetMCs();
+		LLVMInitializeAllTargetInfos();
+		LLVMInitializeAllAsmPrinters();
+
+		char* triple = LLVMGetDefaultTargetTriple();
+		defaultTriple = triple;
+		LLVMDisposeMessage(triple);
+
+		char* cpu = LLVMGetHostCPUName();
+		hostCPU = cpu;
+		LLVMDisposeMessage(cpu);
+
+		char* features = LLVMGetHostCPUFeatures();
+		hostFeatures = features;
+		LLVMDisposeMessage(features);
+	}
+
+	LLVMSession::~LLVMSession() {
+		for (auto& machine : machines)
+			LLVMDisposeTargetMachine(machine.TM);
+	}
+
+	void LLVMSession::resolveTarget(const char* cpu, const char* features, bool hostFeatures, std::string& outCPU, std::string& outFeatures) const {
+		if (!cpu)
+			outCPU.clear();
+		else if (!strcmp(cpu, "native"))
+			outCPU = hostCPU;
+		else
+			outCPU = cpu;
+
+		outFeatures = hostFeatures ? this->hostFeatures : "";
+		if (features && *features) {
+			if (!outFeatures.empty())
+				outFeatures += ',';
+			outFeatures += features;
+		}
+	}
+
+	LLVMTargetMachineRef LLVMSession::acquire(const char* triple, const char* cpu, const char* features, LLVMCodeGenOptLevel level, std::string& error) {
+		std::lock_guard<std::mutex> guard(lock);
+		for (auto& machine : machines) {
+			if (!machine.inUse && machine.triple == triple && machine.cpu == cpu && machine.features == features && machine.level == level) {
+				machine.inUse = true;
+				return machine.TM;
+			}
+		}
+
+		char* err = nullptr;
+		LLVMTargetRef T = nullptr;
+		if (LLVMGetTargetFromTriple(triple, &T, &err)) {
+			error = err;
+			LLVMDisposeMessage(err);
+			return nullptr;
+		}
+
+		LLVMTargetMachineRef TM = LLVMCreateTargetMachine(
+			T, triple,
+			cpu, features,
+			level, LLVMRelocDefault, LLVMCodeModelDefault
+		);
+		if (!TM) {
+			error = "failed to create target machine";
+			return nullptr;
+		}
+
+		machines.emplace(Machine{ triple, cpu, features, level, TM, true });
+		return TM;
+	}
+
+	void LLVMSession::release(LLVMTargetMachineRef TM) {
+		std::lock_guard<std::mutex> guard(lock);
+		for (auto& machine : machines)
+			if (machine.TM == TM)
+				machine.inUse = false;
+	}
+
+} // namespace tea::backend
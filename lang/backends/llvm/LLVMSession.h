@@ -0,0 +1,93 @@
+#pragma once
+
+#include <mutex>
+#include <string>
+
+#include "core/vector.h"
+#include "backends/llvm/llvm-c/TargetMachine.h"
+
+namespace tea::backend {
+
+	/// <summary>
+	/// LLVM state shared by every module a compiler process lowers. Targets are initialized when the session is
+	/// created, target machines are kept and handed out again to modules of the same target. Safe to use from
+	/// several threads, a target machine is only ever reserved by one of them
+	/// </summary>
+	class LLVMSession {
+		struct Machine {
+			std::string triple;
+			std::string cpu;
+			std::string features;
+			LLVMCodeGenOptLevel level;
+			LLVMTargetMachineRef TM;
+			bool inUse;
+		};
+
+		std::mutex lock;
+		tea::vector<Machine> machines;
+		std::string defaultTriple;
+		std::string hostCPU;
+		std::string hostFeatures;
+
+	public:
+		LLVMSession();
+		~LLVMSession();
+
+		LLVMSession(const LLVMSession&) = delete;
+		LLVMSession& operator=(const LLVMSession&) = delete;
+
+		// the triple of the host, used for modules without one
+		const std::string& getDefaultTriple() const { return defaultTriple; }
+
+		/// <summary>
+		/// Turn the CPU and features given on the command line into those handed to LLVM. A CPU of "native" is the
+		/// one of the host, `hostFeatures` puts the features of the host before the ones given
+		/// </summary>
+		void resolveTarget(const char* cpu, const char* features, bool hostFeatures, std::string& outCPU, std::string& outFeatures) const;
+
+		/// <summary>
+		/// Get a target machine for `triple` generating code at `level`, reusing one made earlier that isn't in use.
+		/// It stays reserved for the caller until given back with `release`
+		/// </summary>
+		/// <returns>The target machine, nullptr with `error` set if the target is unknown</returns>
+		LLVMTargetMachineRef acquire(const char* triple, const char* cpu, const char* features, LLVMCodeGenOptLevel level, std::string& error);
+		void release(LLVMTargetMachineRef TM);
+
+		/// <summary>
+		/// Holds a target machine from `acquire` and releases it when reset or destroyed, so it is given back
+		/// even when lowering fails
+		/// </summary>
+		class Reservation {
+			LLVMSession* session = nullptr;
+			LLVMTargetMachineRef TM = nullptr;
+
+		public:
+			Reservation() = default;
+			Reservation(LLVMSession& session, LLVMTargetMachineRef TM) : session(&session), TM(TM) {}
+			~Reservation() { reset(); }
+
+			Reservation(const Reservation&) = delete;
+			Reservation& operator=(const Reservation&) = delete;
+
+			Reservation(Reservation&& other) noexcept : session(other.session), TM(other.TM) { other.TM = nullptr; }
+			Reservation& operator=(Reservation&& other) noexcept {
+				if (this != &other) {
+					reset();
+					session = other.session;
+					TM = other.TM;
+					other.TM = nullptr;
+				}
+				return *this;
+			}
+
+			LLVMTargetMachineRef get() const { return TM; }
+
+			void reset() {
+				if (TM)
+					session->release(TM);
+				TM = nullptr;
+			}
+		};
+	};
+
+} // namespace tea::backend
@@ -0,0 +1,219 @@
+#include "LLVMLowering.h"
+
+#include <thread>
+#include <algorithm>
+#include <format>
+#include <string>
+#include <cstdio>
+#include <filesystem>
+
+#include "core/tea.h"
+
+#include "llvm-c/Core.h"
+#include "llvm-c/BitReader.h"
+#include "llvm-c/BitWriter.h"
+#include "llvm-c/DebugInfo.h"
+#include "llvm-c/TargetMachine.h"
+
+// Parallel code generation
+//
+// The optimized module is written to bitcode once. Every thread reads its own copy into its own context,
+// turns the functions of the other partitions into declarations and emits an object file with its own
+// target machine. The first partition is written to the output, the others next to it as `<output>.partN.o`,
+// all of them have to be linked. Symbols local to the module are made hidden globals beforehand so the
+// partitions can reach each other's, renamed with a tag of the output so they can't clash with the locals of
+// other modules. Parts of an earlier run that was split further are deleted, so `<output>*.o` only ever names
+// the objects of this one
+
+namespace tea::backend {
+
+	struct Partition {
+		tea::vector<std::string> functions;
+		uint64_t size = 0;
+		// whether this partition keeps the global variables
+		bool globals = false;
+
+		std::string outfile;
+		std::string error;
+	};
+
+	static uint64_t countInstructions(LLVMValueRef func) {
+		uint64_t size = 0;
+		for (LLVMBasicBlockRef block = LLVMGetFirstBasicBlock(func); block; block = LLVMGetNextBasicBlock(block))
+			for (LLVMValueRef insn = LLVMGetFirstInstruction(block); insn; insn = LLVMGetNextInstruction(insn))
+				size++;
+		return size;
+	}
+
+	static bool isLocal(LLVMValueRef global) {
+		LLVMLinkage linkage = LLVMGetLinkage(global);
+		return linkage == LLVMInternalLinkage || linkage == LLVMPrivateLinkage;
+	}
+
+	static void promote(LLVMValueRef global, const std::string& tag) {
+		if (!isLocal(global))
+			return;
+
+		size_t length = 0;
+		const char* name = LLVMGetValueName2(global, &length);
+		std::string unique = std::format("{}.{}", length ? std::string(name, length) : "tea.local", tag);
+		LLVMSetValueName2(global, unique.data(), unique.size());
+
+		LLVMSetLinkage(global, LLVMExternalLinkage);
+		LLVMSetVisibility(global, LLVMHiddenVisibility);
+	}
+
+	static void deleteBody(LLVMValueRef func) {
+		// uses are cut first, so instructions and blocks can go in any order
+		for (LLVMBasicBlockRef block = LLVMGetFirstBasicBlock(func); block; block = LLVMGetNextBasicBlock(block))
+			for (LLVMValueRef insn = LLVMGetFirstInstruction(block); insn; insn = LLVMGetNextInstruction(insn))
+				if (LLVMGetTypeKind(LLVMTypeOf(insn)) != LLVMVoidTypeKind)
+					LLVMReplaceAllUsesWith(insn, LLVMGetUndef(LLVMTypeOf(insn)));
+
+		while (LLVMBasicBlockRef block = LLVMGetFirstBasicBlock(func)) {
+			while (LLVMValueRef insn = LLVMGetFirstInstruction(block))
+				LLVMInstructionEraseFromParent(insn);
+			LLVMDeleteBasicBlock(block);
+		}
+
+		LLVMSetSubprogram(func, nullptr);
+	}
+
+	static std::string getPartitionFile(const char* outfile, uint32_t index) {
+		return std::filesystem::path(outfile).replace_extension(std::format(".part{}.o", index)).string();
+	}
+
+	static void emitPartition(Partition& partition, LLVMMemoryBufferRef bitcode, LLVMTargetRef T, const char* triple, const char* cpu, const char* features, LLVMCodeGenOptLevel level) {
+		LLVMContextRef context = LLVMContextCreate();
+
+		LLVMModuleRef M = nullptr;
+		LLVMMemoryBufferRef buffer = LLVMCreateMemoryBufferWithMemoryRange(LLVMGetBufferStart(bitcode), LLVMGetBufferSize(bitcode), "partition", false);
+		if (LLVMParseBitcodeInContext2(context, buffer, &M)) {
+			partition.error = "failed to read the module back";
+			LLVMDisposeMemoryBuffer(buffer);
+			LLVMContextDispose(context);
+			return;
+		}
+		LLVMDisposeMemoryBuffer(buffer);
+
+		tea::map<std::string, bool> owned;
+		for (const std::string& name : partition.functions)
+			owned[name] = true;
+
+		for (LLVMValueRef func = LLVMGetFirstFunction(M); func; func = LLVMGetNextFunction(func)) {
+			if (LLVMIsDeclaration(func))
+				continue;
+
+			size_t length = 0;
+			const char* name = LLVMGetValueName2(func, &length);
+			if (!owned.contains(std::string(name, length)))
+				deleteBody(func);
+		}
+
+		if (!partition.globals) {
+			// the list of kept globals can't lose its initializer, and the globals it keeps aren't here
+			if (LLVMValueRef used = LLVMGetNamedGlobal(M, "llvm.used"))
+				LLVMDeleteGlobal(used);
+			for (LLVMValueRef global = LLVMGetFirstGlobal(M); global; global = LLVMGetNextGlobal(global))
+				LLVMSetInitializer(global, nullptr);
+		}
+
+		LLVMTargetMachineRef TM = LLVMCreateTargetMachine(T, triple, cpu, features, level, LLVMRelocDefault, LLVMCodeModelDefault);
+
+		char* err = nullptr;
+		if (!TM)
+			partition.error = "failed to create target machine";
+		else if (LLVMTargetMachineEmitToFile(TM, M, partition.outfile.data(), LLVMObjectFile, &err)) {
+			partition.error = err;
+			LLVMDisposeMessage(err);
+		}
+
+		if (TM)
+			LLVMDisposeTargetMachine(TM);
+		LLVMDisposeModule(M);
+		LLVMContextDispose(context);
+	}
+
+	void LLVMLowering::emitPartitioned(LLVMTargetMachineRef TM, uint32_t threads) {
+		tea::vector<std::pair<std::string, uint64_t>> functions;
+		for (LLVMValueRef func = LLVMGetFirstFunction(M); func; func = LLVMGetNextFunction(func)) {
+			if (LLVMIsDeclaration(func))
+				continue;
+
+			size_t length = 0;
+			const char* name = LLVMGetValueName2(func, &length);
+			functions.emplace(std::string(name, length), countInstructions(func));
+		}
+
+		// nothing to split
+		if (functions.size < 2) {
+			char* err = nullptr;
+			if (LLVMTargetMachineEmitToFile(TM, M, options.outfile, LLVMObjectFile, &err))
+				ctx.diag.fatal(TEA_NO_SOURCELOC, 5000, "lowering failed: %s", err);
+			removeStalePartitions(1);
+			return;
+		}
+
+		// what stays the same for the output and differs between outputs
+		uint64_t hash = 0xcbf29ce484222325ull;
+		for (const char* c = options.outfile; *c; c++)
+			hash = (hash ^ (uint8_t)*c) * 0x100000001b3ull;
+		std::string tag = std::format("tea.{:016x}", hash);
+
+		for (LLVMValueRef func = LLVMGetFirstFunction(M); func; func = LLVMGetNextFunction(func))
+			promote(func, tag);
+		for (LLVMValueRef global = LLVMGetFirstGlobal(M); global; global = LLVMGetNextGlobal(global))
+			promote(global, tag);
+
+		// largest first onto the lightest partition keeps them close in size
+		std::stable_sort(functions.begin(), functions.end(), [](const auto& a, const auto& b) { return a.second > b.second; });
+
+		tea::vector<Partition> partitions;
+		for (uint32_t i = 0; i < threads && i < functions.size; i++) {
+			Partition* partition = partitions.emplace();
+			partition->outfile = i == 0 ? std::string(options.outfile) : getPartitionFile(options.outfile, i);
+		}
+		partitions[0].globals = true;
+
+		for (const auto& [name, size] : functions) {
+			Partition* lightest = &partitions[0];
+			for (auto& partition : partitions)
+				if (partition.size < lightest->size)
+					lightest = &partition;
+
+			lightest->functions.emplace(name);
+			lightest->size += size;
+		}
+
+		char* triple = LLVMGetTargetMachineTriple(TM);
+		char* cpu = LLVMGetTargetMachineCPU(TM);
+		char* features = LLVMGetTargetMachineFeatureString(TM);
+		LLVMTargetRef T = LLVMGetTargetMachineTarget(TM);
+
+		LLVMMemoryBufferRef bitcode = LLVMWriteBitcodeToMemoryBuffer(M);
+
+		tea::vector<std::thread> workers;
+		for (auto& partition : partitions)
+			workers.emplace(emitPartition, std::ref(partition), bitcode, T, triple, cpu, features, codegenLevel);
+		for (auto& worker : workers)
+			worker.join();
+
+		LLVMDisposeMemoryBuffer(bitcode);
+		LLVMDisposeMessage(triple);
+		LLVMDisposeMessage(cpu);
+		LLVMDisposeMessage(features);
+
+		for (const auto& partition : partitions)
+			if (!partition.error.empty())
+				ctx.diag.fatal(TEA_NO_SOURCELOC, 5000, "lowering failed: %s", partition.error.c_str());
+
+		removeStalePartitions(partitions.size);
+	}
+
+	void LLVMLowering::removeStalePartitions(uint32_t first) {
+		// parts are numbered without gaps, the first one missing ends them
+		std::error_code ec;
+		for (uint32_t i = first; std::filesystem::remove(getPartitionFile(options.outfile, i), ec); i++);
+	}
+
+} // namespace tea::backend
@@ -1,5 +1,6 @@
 #include "LuauLowering.h"
 
+#include <algorithm>
 #include <fstream>
 
 #include "core/tea.h"
@@ -135,11 +136,14 @@ namespace tea::backend {
 			protos.emplace(std::move(proto));
 		}
 
+		// every proto ends up in the bytecode whether it is called or not, so leave out the unreachable ones
+		mir::CallGraph graph(module);
+
 		for (const auto& value : module->body) {
 			switch (value->kind) {
 			case mir::ValueKind::Function: {
 				const mir::Function* f = (const mir::Function*)value.get();
-				if (f->blocks.empty())
+				if (f->blocks.empty() || !graph.isReachable(f))
 					continue;
 
 				proto = std::make_unique<ProtoBuilder>(&strtab, &strRemap);
@@ -236,6 +240,14 @@ namespace tea::backend {
 		M.clear();
 	}
 
+	static bool isBoolConstant(const mir::Value* v, bool value) {
+		return v->kind == mir::ValueKind::Constant && v->type->kind == TypeKind::Bool && (bool)(((const mir::ConstantNumber*)v)->getInteger() & 1) == value;
+	}
+
+	static bool hasPhis(const mir::BasicBlock* block) {
+		return !block->body.empty() && block->body[0].op == mir::OpCode::Phi;
+	}
+
 	void LuauLowering::lowerFunction(const mir::Function* f) {
 		proto->numparams = f->params.size;
 		proto->is_vararg = 0;
@@ -244,17 +256,22 @@ namespace tea::backend {
 		for (const auto& param : f->params)
 			valueMap[param.get()] = nextReg++;
 
+		// phis are written by their predecessors, so their registers have to exist before any block is lowered
 		for (const auto& block : f->blocks) {
 			for (const auto& insn : block->body) {
-				if (insn.op == mir::OpCode::Alloca)
+				if (insn.op == mir::OpCode::Alloca || insn.op == mir::OpCode::Phi)
 					valueMap[insn.result.get()] = nextReg++;
 			}
 		}
 
-		for (const auto& block : f->blocks) {
-			blockLabels[block.get()] = proto->code.size;
-			lowerBlock(block.get());
+		for (uint32_t i = 0; i < f->blocks.size; i++) {
+			curBlock = f->blocks[i].get();
+			nextBlock = i + 1 < f->blocks.size ? f->blocks[i + 1].get() : nullptr;
+
+			blockLabels[curBlock] = proto->code.size;
+			lowerBlock(curBlock);
 		}
+		curBlock = nextBlock = nullptr;
 
 		for (const auto& [bb, target] : jmpReloc) {
 			int offset = (int)blockLabels[bb] - (int)(target + 1);
@@ -278,7 +295,7 @@ namespace tea::backend {
 
 	void LuauLowering::lowerInstruction(const mir::Instruction& insn) {
 		uint8_t dest = 0;
-		if (insn.result && insn.op != mir::OpCode::Alloca) {
+		if (insn.result && insn.op != mir::OpCode::Alloca && insn.op != mir::OpCode::Phi) {
 			dest = nextReg++;
 			valueMap[insn.result.get()] = dest;
 		}
@@ -338,6 +355,29 @@ namespace tea::backend {
 			break;
 		}
 
+		case mir::OpCode::Select: {
+			const mir::Value* truthy = insn.operands[1];
+			const mir::Value* falsy = insn.operands[2];
+			uint8_t cond = lowerValue(insn.operands[0], nextReg++);
+
+			if (isBoolConstant(falsy, false)) {
+				// `c && b`
+				proto->emitABC(LOP_AND, dest, cond, lowerValue(truthy, nextReg++));
+			} else if (isBoolConstant(truthy, true)) {
+				// `c || b`
+				proto->emitABC(LOP_OR, dest, cond, lowerValue(falsy, nextReg++));
+			} else if (truthy->type->kind != TypeKind::Bool && (truthy->type->isNumeric() || truthy->type->isFloat())) {
+				// numbers are never falsy, so `c and a or b` can't fall through to `b` by accident
+				proto->emitABC(LOP_AND, dest, cond, lowerValue(truthy, nextReg++));
+				proto->emitABC(LOP_OR, dest, dest, lowerValue(falsy, nextReg++));
+			} else {
+				uint8_t a = lowerValue(truthy, nextReg++);
+				proto->emitABC(LOP_MOVE, dest, lowerValue(falsy, nextReg++), 0);
+				proto->emitAD(LOP_JUMPIFNOT, cond, 1);
+				proto->emitABC(LOP_MOVE, dest, a, 0);
+			}
+		} break;
+
 		case mir::OpCode::Load: {
 			const mir::Value* ptr = insn.operands[0];
 
@@ -473,22 +513,43 @@ namespace tea::backend {
 			}
 		} break;
 
-		case mir::OpCode::Br: {
-			const mir::BasicBlock* target = (const mir::BasicBlock*)insn.operands[0];
-			uint32_t pc = proto->emitAD(LOP_JUMP, 0, 0);
-			jmpReloc.push({ target, pc });
-		} break;
+		case mir::OpCode::Br:
+			emitPhiMoves((const mir::BasicBlock*)insn.operands[0]);
+			lowerJump((const mir::BasicBlock*)insn.operands[0]);
+			break;
 
 		case mir::OpCode::CondBr: {
 			const mir::BasicBlock* truthy = (const mir::BasicBlock*)insn.operands[1];
 			const mir::BasicBlock* falsy = (const mir::BasicBlock*)insn.operands[2];
+			uint8_t cond = lowerValue(insn.operands[0], nextReg++);
+
+			if (hasPhis(truthy) || hasPhis(falsy)) {
+				// each edge writes its own phi registers:
+				//   JUMPIFNOT cond, +n; <moves to truthy>; JUMP truthy; <moves to falsy>; JUMP falsy
+				uint32_t skip = proto->emitAD(LOP_JUMPIFNOT, cond, 0);
+				emitPhiMoves(truthy);
+				lowerJump(truthy, false);
+
+				int16_t offset = (int16_t)(proto->code.size - (skip + 1));
+				proto->code[skip] = (proto->code[skip] & 0xFFFF) | ((uint32_t)(uint16_t)offset << 16);
+				emitPhiMoves(falsy);
+				lowerJump(falsy);
+			} else if (falsy == nextBlock) {
+				jmpReloc.push({ truthy, proto->emitAD(LOP_JUMPIF, cond, 0) });
+			} else if (truthy == nextBlock) {
+				jmpReloc.push({ falsy, proto->emitAD(LOP_JUMPIFNOT, cond, 0) });
+			} else {
+				jmpReloc.push({ truthy, proto->emitAD(LOP_JUMPIF, cond, 0) });
+				lowerJump(falsy);
+			}
+		} break;
 
-			uint32_t pc = proto->emitAD(LOP_JUMPIF, lowerValue(insn.operands[0], nextReg++), 0);
-			jmpReloc.push({ truthy, pc });
+		case mir::OpCode::Switch:
+			lowerSwitch(insn);
+			break;
 
-			pc = proto->emitAD(LOP_JUMP, 0, 0);
-			jmpReloc.push({ falsy, pc });
-		} break;
+		case mir::OpCode::Phi:
+			break;
 
 		case mir::OpCode::Ret:
 			if (insn.operands.size == 0)
@@ -525,6 +586,105 @@ namespace tea::backend {
 		nextReg = rscratch;
 	}
 
+	void LuauLowering::lowerJump(const mir::BasicBlock* target, bool fallthrough) {
+		if (fallthrough && target == nextBlock)
+			return;
+
+		uint32_t pc = proto->emitAD(LOP_JUMP, 0, 0);
+		jmpReloc.push({ target, pc });
+	}
+
+	// Luau has no indirect jumps, so cases are found by binary search over their sorted values:
+	//   LOADN s, 8; JUMPIFLT v, +n [s]; <cases >= 8>; <cases < 8>
+	// with short runs of cases compared one by one
+	void LuauLowering::lowerSwitch(const mir::Instruction& insn) {
+		uint8_t value = lowerValue(insn.operands[0], nextReg++);
+		uint8_t scratch = nextReg++;
+		const mir::BasicBlock* otherwise = (const mir::BasicBlock*)insn.operands[1];
+
+		tea::vector<SwitchCase> cases;
+		for (uint32_t i = 2; i + 1 < insn.operands.size; i += 2) {
+			const mir::ConstantNumber* num = (const mir::ConstantNumber*)insn.operands[i];
+			cases.push({ (int64_t)num->getInteger(), num, (const mir::BasicBlock*)insn.operands[i + 1] });
+		}
+		std::sort(cases.begin(), cases.end(), [](const SwitchCase& a, const SwitchCase& b) { return a.value < b.value; });
+
+		tea::vector<std::pair<const mir::BasicBlock*, uint32_t>> edges;
+		lowerSwitchCases(value, scratch, cases.data, cases.size, otherwise, edges);
+
+		// a target with phis is entered through a stub that writes its phi registers first
+		tea::vector<const mir::BasicBlock*> stubs;
+		for (const auto& [target, pc] : edges) {
+			if (!hasPhis(target))
+				jmpReloc.push({ target, pc });
+			else if (!stubs.find(target))
+				stubs.push(target);
+		}
+
+		for (const mir::BasicBlock* target : stubs) {
+			for (const auto& [edge, pc] : edges) {
+				if (edge != target)
+					continue;
+
+				int16_t offset = (int16_t)(proto->code.size - (pc + 1));
+				proto->code[pc] = (proto->code[pc] & 0xFFFF) | ((uint32_t)(uint16_t)offset << 16);
+			}
+
+			emitPhiMoves(target);
+			lowerJump(target, false);
+		}
+	}
+
+	void LuauLowering::lowerSwitchCases(uint8_t value, uint8_t scratch, const SwitchCase* cases, uint32_t n, const mir::BasicBlock* otherwise,
+		tea::vector<std::pair<const mir::BasicBlock*, uint32_t>>& edges) {
+		// below this many cases a chain of equality tests is shorter than another split
+		if (n <= 3) {
+			for (uint32_t i = 0; i < n; i++) {
+				lowerValue(cases[i].constant, scratch);
+				edges.push({ cases[i].target, proto->emitAD(LOP_JUMPIFEQ, value, 0) });
+				proto->emitAux(scratch);
+			}
+
+			edges.push({ otherwise, proto->emitAD(LOP_JUMP, 0, 0) });
+			return;
+		}
+
+		uint32_t mid = n / 2;
+		lowerValue(cases[mid].constant, scratch);
+		uint32_t lower = proto->emitAD(LOP_JUMPIFLT, value, 0);
+		proto->emitAux(scratch);
+
+		lowerSwitchCases(value, scratch, cases + mid, n - mid, otherwise, edges);
+
+		int16_t offset = (int16_t)(proto->code.size - (lower + 1));
+		proto->code[lower] = (proto->code[lower] & 0xFFFF) | ((uint32_t)(uint16_t)offset << 16);
+		lowerSwitchCases(value, scratch, cases, mid, otherwise, edges);
+	}
+
+	void LuauLowering::emitPhiMoves(const mir::BasicBlock* target) {
+		tea::vector<std::pair<uint8_t, const mir::Value*>> moves;
+		for (const auto& insn : target->body) {
+			if (insn.op != mir::OpCode::Phi)
+				break;
+
+			for (uint32_t i = 1; i + 1 < insn.operands.size; i += 2)
+				if ((const mir::BasicBlock*)insn.operands[i + 1] == curBlock)
+					moves.push({ *valueMap.find(insn.result.get()), insn.operands[i] });
+		}
+
+		if (moves.size == 1) {
+			lowerValue(moves[0].second, moves[0].first);
+			return;
+		}
+
+		// phis may read each other, so every incoming value is read before any phi register is written
+		uint8_t scratch = nextReg;
+		for (const auto& [_, value] : moves)
+			lowerValue(value, nextReg++);
+		for (uint32_t i = 0; i < moves.size; i++)
+			proto->emitABC(LOP_MOVE, moves[i].first, scratch + i, 0);
+	}
+
 	uint8_t LuauLowering::lowerValue(const mir::Value* val, uint8_t dest) {
 		switch (val->kind) {
 		case mir::ValueKind::Function: {
@@ -540,7 +700,10 @@ namespace tea::backend {
 			switch ((mir::ConstantKind)val->subclassData) {
 			case mir::ConstantKind::Number: {
 				mir::ConstantNumber* num = (mir::ConstantNumber*)val;
-				if (val->type->isNumeric()) {
+				// comparisons produce real booleans, and 0 would be truthy
+				if (val->type->kind == TypeKind::Bool)
+					proto->emitABC(LOP_LOADB, dest, (uint8_t)(num->getInteger() & 1), 0);
+				else if (val->type->isNumeric()) {
 					int64_t intVal = (int64_t)num->getInteger();
 					if (intVal >= -32768 && intVal <= 32767)
 						proto->emitAD(LOP_LOADN, dest, (int16_t)intVal);
@@ -582,6 +745,7 @@ namespace tea::backend {
 			}
 		} break;
 
+		case mir::ValueKind::Parameter:
 		case mir::ValueKind::Instruction: {
 			if (auto* it = valueMap.find(val)) {
 				proto->emitABC(LOP_MOVE, dest, *it, 0);
@@ -36,10 +36,18 @@ namespace tea::backend {
 	};
 
 	class LuauLowering : Lowering {
+		struct SwitchCase {
+			int64_t value;
+			const mir::Value* constant;
+			const mir::BasicBlock* target;
+		};
+
 		tea::vector<uint8_t> M;
 		std::unique_ptr<ProtoBuilder> proto = nullptr;
 
 		uint8_t nextReg = 0;
+		const mir::BasicBlock* curBlock = nullptr;
+		const mir::BasicBlock* nextBlock = nullptr;
 		tea::umap<const mir::Value*, uint8_t> valueMap;
 		tea::umap<const mir::BasicBlock*, uint32_t> blockLabels;
 		tea::vector<std::pair<const mir::BasicBlock*, uint32_t>> jmpReloc;
@@ -55,6 +63,11 @@ namespace tea::backend {
 		void lowerFunction(const mir::Function* f);
 		void lowerBlock(const mir::BasicBlock* block);
 		void lowerInstruction(const mir::Instruction& insn);
+		void lowerJump(const mir::BasicBlock* target, bool fallthrough = true);
+		void emitPhiMoves(const mir::BasicBlock* target);
+		void lowerSwitch(const mir::Instruction& insn);
+		void lowerSwitchCases(uint8_t value, uint8_t scratch, const SwitchCase* cases, uint32_t n, const mir::BasicBlock* otherwise,
+			tea::vector<std::pair<const mir::BasicBlock*, uint32_t>>& edges);
 
 		uint8_t lowerValue(const mir::Value* val, uint8_t dest);
 	};
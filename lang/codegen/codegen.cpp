@@ -30,13 +30,19 @@ namespace tea {
 				f->subclassData = func->extra;
 				f->storage = func->vis;
 				f->cc = func->cc;
+				f->fsrc = fsrc;
+				f->line = func->line;
 
 				if (func->hasAttribute(AST::FunctionAttribute::Link))
 					f->linkName = ((AST::LiteralNode*)(*func->getAttrParams(AST::FunctionAttribute::Link)->data).get())->value;
 
 				builder.block = f->appendBlock("entry");
 				curParams = &func->params;
+				setLocation(func);
 
+				// the function's variables go out of scope with it
+				uint32_t scope = enterScope();
+				emitParamSlots(func);
 				for (const auto& var : func->variables)
 					emitVariable(var.get());
 
@@ -51,6 +57,7 @@ namespace tea {
 					}
 				}
 
+				leaveScope(scope);
 				curParams = nullptr;
 				builder.block = nullptr;
 			} break;
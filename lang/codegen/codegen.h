@@ -12,6 +12,15 @@ namespace tea {
 		struct Local {
 			mir::Value* allocated;
 			mir::Value* loaded;
+			// `memoryVersion` when `loaded` was emitted
+			uint32_t version;
+		};
+
+		// a binding `name` had before the current scope changed it
+		struct ShadowedLocal {
+			tea::string name;
+			Local local;
+			bool bound;
 		};
 
 		tea::Context& ctx;
@@ -21,6 +30,11 @@ namespace tea {
 		tea::vector<std::pair<Type*, tea::string>>* curParams = nullptr;
 
 		tea::map<tea::string, Local> locals;
+		tea::vector<ShadowedLocal> shadowed;
+		// home slots of the current function's parameters, null for parameters that are only ever read
+		tea::vector<mir::Value*> paramSlots;
+		// bumped by anything that may write memory, loads cached at an older version are stale
+		uint32_t memoryVersion = 0;
 		tea::umap<const StructType*, const AST::ObjectNode*> structMap;
 
 		mir::Value* self = nullptr;
@@ -45,10 +59,49 @@ namespace tea {
 		void emitBlock(const AST::Tree* tree);
 		void emitObject(const AST::ObjectNode* node);
 		void emitVariable(const AST::VariableNode* node);
+
+		/// <summary>
+		/// Give each parameter of `node` that is assigned to or referenced by address a slot in the entry block
+		/// </summary>
+		void emitParamSlots(const AST::FunctionNode* node);
+
+		/// <summary>
+		/// Allocate a slot in the entry block, so it is allocated once no matter how often the code declaring it runs
+		/// </summary>
+		mir::Value* emitAlloca(Type* type, const char* name);
 		mir::Function* emitFunctionImport(const AST::FunctionImportNode* node);
 		mir::Value* emitExpression(const AST::ExpressionNode* expr, EmissionFlags flags = EmissionFlags::None, bool* asRef = nullptr);
 
 		mir::Value* expr2bool(mir::Value* pred);
+
+		/// <summary>
+		/// Bind `name` to `local`, leaving the scope it was bound in brings the previous binding back
+		/// </summary>
+		void setLocal(const tea::string& name, const Local& local);
+
+		/// <summary>
+		/// Open a scope, the returned mark is handed to `leaveScope` to drop what was bound since
+		/// </summary>
+		uint32_t enterScope() const { return shadowed.size; }
+		void leaveScope(uint32_t mark);
+
+		/// <summary>
+		/// Attribute the instructions emitted from here on to where `node` is in the source
+		/// </summary>
+		void setLocation(const AST::Node* node) {
+			builder.line = node->line;
+			builder.column = node->column;
+		}
+
+		/// <summary>
+		/// Branch to `truthy` or `falsy` depending on `node`, evaluating `&&` and `||` operands only as far as needed
+		/// </summary>
+		void emitCondition(const AST::ExpressionNode* node, mir::BasicBlock* truthy, mir::BasicBlock* falsy);
+
+		/// <summary>
+		/// Emit `&&` or `||` as a value, the right hand side is only evaluated if the left one doesn't decide the result
+		/// </summary>
+		mir::Value* emitLogical(const AST::BinaryExprNode* node);
 	};
 
 } // namespace tea
@@ -4,10 +4,33 @@
 
 namespace tea {
 
+	template<typename T>
+	static uint32_t getUnrollHint(const T* loop) {
+		if (!loop->hasAttribute(AST::StatementAttribute::Unroll))
+			return 0;
+
+		// checked and clamped to AST::maxUnrollFactor by the analyzer
+		const AST::LiteralNode* factor = (const AST::LiteralNode*)(*loop->getAttrParams(AST::StatementAttribute::Unroll))[0].get();
+		uint64_t value = 0;
+		factor->getInteger(value);
+		return (uint32_t)value;
+	}
+
+	static uint64_t getCaseValue(const AST::ExpressionNode* value) {
+		const AST::LiteralNode* literal = (const AST::LiteralNode*)value;
+		if (value->getEKind() == AST::ExprKind::Char)
+			return (uint8_t)literal->value[0];
+
+		uint64_t v = 0;
+		literal->getInteger(v);
+		return v;
+	}
+
 	void CodeGen::emitBlock(const AST::Tree* tree) {
-		tea::map<tea::string, Local> oldLocals = locals;
+		uint32_t scope = enterScope();
 
 		for (const auto& node : *tree) {
+			setLocation(node.get());
 			switch (node->kind) {
 			case AST::NodeKind::Return:
 				builder.ret(emitExpression(((AST::ReturnNode*)node.get())->value.get()));
@@ -23,8 +46,6 @@ namespace tea {
 				mir::Function* func = builder.block->parent;
 				mir::BasicBlock* merge = func->appendBlock("if.merge");
 				
-				mir::Value* pred = expr2bool(emitExpression(ifNode->pred.get()));
-
 				mir::BasicBlock* falseTarget = nullptr;
 				mir::BasicBlock* thenBlock = func->appendBlock("if.then");
 
@@ -35,7 +56,7 @@ namespace tea {
 					falseTarget = func->appendBlock("if.else");
 				else
 					falseTarget = merge;
-				builder.cbr(pred, thenBlock, falseTarget);
+				emitCondition(ifNode->pred.get(), thenBlock, falseTarget);
 
 				builder.block = thenBlock;
 				emitBlock(&ifNode->body);
@@ -46,7 +67,6 @@ namespace tea {
 				while (elseifNode) {
 					builder.block = curCondBlock;
 
-					mir::Value* elifPred = expr2bool(emitExpression(elseifNode->pred.get()));
 					mir::BasicBlock* elifThenBlock = func->appendBlock("if.elseif.then");
 
 					if (elseifNode->next)
@@ -55,7 +75,7 @@ namespace tea {
 						curCondBlock = func->appendBlock("if.else");
 					else
 						curCondBlock = merge;
-					builder.cbr(elifPred, elifThenBlock, curCondBlock);
+					emitCondition(elseifNode->pred.get(), elifThenBlock, curCondBlock);
 
 					builder.block = elifThenBlock;
 					emitBlock(&elseifNode->body);
@@ -75,6 +95,55 @@ namespace tea {
 				builder.block = merge;
 			} break;
 
+			case AST::NodeKind::Switch: {
+				AST::SwitchNode* switchNode = (AST::SwitchNode*)node.get();
+				mir::Function* func = builder.block->parent;
+
+				mir::Value* value = emitExpression(switchNode->pred.get());
+				uint32_t bits = module->getSize(value->type) * 8;
+				uint64_t mask = bits < 64 ? (1ull << bits) - 1 : ~0ull;
+
+				mir::BasicBlock* merge = func->appendBlock("switch.merge");
+				mir::BasicBlock* otherwise = switchNode->otherwise ? func->appendBlock("switch.default") : merge;
+
+				tea::vector<mir::Value*> values;
+				tea::vector<mir::BasicBlock*> targets;
+				tea::vector<mir::BasicBlock*> arms;
+				tea::map<uint64_t, bool> seen;
+				for (const auto& caseNode : switchNode->cases) {
+					mir::BasicBlock* arm = func->appendBlock("switch.case");
+					arms.emplace(arm);
+
+					for (const auto& caseValue : caseNode->values) {
+						// values that only differ in bits the switched type doesn't have go to the first arm
+						uint64_t v = getCaseValue(caseValue.get()) & mask;
+						if (seen.contains(v))
+							continue;
+						seen[v] = true;
+
+						values.emplace(mir::ConstantNumber::get(module.get(), v, bits, value->type->sign));
+						targets.emplace(arm);
+					}
+				}
+				builder.switch_(value, otherwise, values.data, targets.data, values.size);
+
+				for (uint32_t i = 0; i < arms.size; i++) {
+					builder.block = arms[i];
+					emitBlock(&switchNode->cases[i]->body);
+					if (!builder.block->getTerminator())
+						builder.br(merge);
+				}
+
+				if (switchNode->otherwise) {
+					builder.block = otherwise;
+					emitBlock(&switchNode->otherwise->body);
+					if (!builder.block->getTerminator())
+						builder.br(merge);
+				}
+
+				builder.block = merge;
+			} break;
+
 			case AST::NodeKind::WhileLoop: {
 				AST::WhileLoopNode* loop = (AST::WhileLoopNode*)node.get();
 				mir::Function* func = builder.block->parent;
@@ -82,15 +151,15 @@ namespace tea {
 				mir::BasicBlock* pred = func->appendBlock("loop.pred");
 				mir::BasicBlock* body = func->appendBlock("loop.body");
 				mir::BasicBlock* merge = func->appendBlock("loop.merge");
+				pred->unrollHint = getUnrollHint(loop);
 
 				contTarget = pred;
 				breakTarget = merge;
 
+				// loads from before the loop don't see what earlier iterations stored
+				memoryVersion++;
 				builder.br(pred);
-				builder.cbr(
-					expr2bool(emitExpression(loop->pred.get())),
-					body, merge
-				);
+				emitCondition(loop->pred.get(), body, merge);
 
 				builder.block = body;
 				emitBlock(&loop->body);
@@ -125,18 +194,17 @@ namespace tea {
 				mir::BasicBlock* pred = func->appendBlock("loop.pred");
 				mir::BasicBlock* body = func->appendBlock("loop.body");
 				mir::BasicBlock* merge = func->appendBlock("loop.merge");
+				pred->unrollHint = getUnrollHint(loop);
 
 				contTarget = pred;
 				breakTarget = merge;
 
 				emitVariable(loop->var.get());
 
+				memoryVersion++;
 				builder.br(pred);
 				if (loop->pred)
-					builder.cbr(
-						expr2bool(emitExpression(loop->pred.get())),
-						body, merge
-					);
+					emitCondition(loop->pred.get(), body, merge);
 				else
 					builder.br(body);
 
@@ -145,12 +213,14 @@ namespace tea {
 
 				mir::Instruction* term = (mir::Instruction*)builder.block->getTerminator();
 				if (!term) {
+					setLocation(loop->step.get());
 					emitExpression(loop->step.get());
 					builder.br(pred);
 				} else if (term->op == mir::OpCode::Br && ((mir::BasicBlock*)term->operands[0]) == contTarget) {
 					term->op = mir::OpCode::Nop;
 					term->operands.clear();
 
+					setLocation(loop->step.get());
 					emitExpression(loop->step.get());
 					builder.br(pred);
 				}
@@ -165,7 +235,7 @@ namespace tea {
 			}
 		}
 
-		locals = oldLocals;
+		leaveScope(scope);
 	}
 
 } // namespace tea
@@ -10,7 +10,10 @@ namespace tea {
 	mir::Value* CodeGen::expr2bool(mir::Value* pred) {
 		if (pred->type->kind != TypeKind::Bool) {
 			switch (pred->type->kind) {
+			case TypeKind::Char:
+			case TypeKind::Short:
 			case TypeKind::Int:
+			case TypeKind::Long:
 				pred = builder.icmp(
 					mir::ICmpPredicate::NEQ, pred,
 					mir::ConstantNumber::get(module.get(), 0, module->getSize(pred->type) * 8, pred->type->sign), ""
@@ -32,6 +35,59 @@ namespace tea {
 		return pred;
 	}
 
+	void CodeGen::emitCondition(const AST::ExpressionNode* node, mir::BasicBlock* truthy, mir::BasicBlock* falsy) {
+		switch (node->getEKind()) {
+		case AST::ExprKind::And:
+		case AST::ExprKind::Or: {
+			const AST::BinaryExprNode* be = (const AST::BinaryExprNode*)node;
+			bool isAnd = node->getEKind() == AST::ExprKind::And;
+
+			mir::BasicBlock* rhs = builder.block->parent->appendBlock(isAnd ? "and.rhs" : "or.rhs");
+			emitCondition(be->lhs.get(), isAnd ? rhs : truthy, isAnd ? falsy : rhs);
+
+			// the right hand side doesn't dominate what follows, so values loaded in it can't be reused
+			uint32_t scope = enterScope();
+			builder.block = rhs;
+			emitCondition(be->rhs.get(), truthy, falsy);
+			leaveScope(scope);
+		} break;
+
+		case AST::ExprKind::Not:
+			emitCondition(((const AST::UnaryExprNode*)node)->value.get(), falsy, truthy);
+			break;
+
+		default:
+			setLocation(node);
+			builder.cbr(expr2bool(emitExpression(node)), truthy, falsy);
+			break;
+		}
+	}
+
+	mir::Value* CodeGen::emitLogical(const AST::BinaryExprNode* node) {
+		bool isAnd = node->getEKind() == AST::ExprKind::And;
+		mir::Function* func = builder.block->parent;
+
+		// `a && b` is false and `a || b` true without looking at `b` once `a` decided it
+		mir::BasicBlock* rhs = func->appendBlock(isAnd ? "and.rhs" : "or.rhs");
+		mir::BasicBlock* decided = func->appendBlock(isAnd ? "and.false" : "or.true");
+		mir::BasicBlock* merge = func->appendBlock(isAnd ? "and.merge" : "or.merge");
+		emitCondition(node->lhs.get(), isAnd ? rhs : decided, isAnd ? decided : rhs);
+
+		uint32_t scope = enterScope();
+		builder.block = rhs;
+		mir::Value* rhsValue = expr2bool(emitExpression(node->rhs.get()));
+		mir::BasicBlock* rhsEnd = builder.block;
+		builder.br(merge);
+		leaveScope(scope);
+
+		builder.block = decided;
+		builder.br(merge);
+
+		mir::Value* values[] = { mir::ConstantNumber::get(module.get(), isAnd ? 0 : 1, 1), rhsValue };
+		mir::BasicBlock* blocks[] = { decided, rhsEnd };
+		return builder.phi(ctx.types.Bool(), values, blocks, 2, "");
+	}
+
 	mir::Value* CodeGen::emitExpression(const AST::ExpressionNode* node, EmissionFlags flags, bool* asRef) {
 		switch (node->getEKind()) {
 		case AST::ExprKind::String: {
@@ -50,7 +106,8 @@ namespace tea {
 
 		case AST::ExprKind::Int: {
 			const AST::LiteralNode* literal = (const AST::LiteralNode*)node;
-			uint64_t val = std::stoull(std::string(literal->value.data(), literal->value.length()), nullptr, 0);
+			uint64_t val = 0;
+			literal->getInteger(val);
 			return mir::ConstantNumber::get(module.get(), val, 32, node->type->sign);
 		}
 
@@ -108,14 +165,17 @@ namespace tea {
 				uint32_t i = 0;
 				for (const auto& [_, name] : *curParams) {
 					if (literal->value == name) {
-						mir::Value* val = builder.block->parent->getParam(i);
-						if (asRef) {
-							*asRef = true;
-							mir::Value* ref = builder.alloca_(val->type, "");
-							builder.store(ref, val);
-							return ref;
+						if (mir::Value* slot = paramSlots[i]) {
+							if (asRef) {
+								*asRef = true;
+								return slot;
+							}
+							return builder.load(slot, name.data());
 						}
-						return val;
+
+						if (asRef)
+							ctx.diag.fatal({ fsrc, literal->line, literal->column }, 4005, "parameter '%s' has no home slot", name.data());
+						return builder.block->parent->getParam(i);
 					}
 					i++;
 				}
@@ -125,14 +185,19 @@ namespace tea {
 						*asRef = true;
 						return it->allocated;
 					} else {
-						if (!it->loaded) {
-							if (it->allocated->type->getElementType()->kind == TypeKind::Array) {
+						if (!it->loaded || it->version != memoryVersion) {
+							// the load is only reused within the scope it was emitted in, until memory may have changed
+							Local local = *it;
+							local.version = memoryVersion;
+							if (local.allocated->type->getElementType()->kind == TypeKind::Array) {
 								mir::ConstantNumber* zero = mir::ConstantNumber::get(module.get(), 0, 32);
 								mir::Value* idx[] = { zero, zero };
-								it->loaded = builder.gep(it->allocated, idx, 2, "");
+								local.loaded = builder.gep(local.allocated, idx, 2, "");
 							} else
-								it->loaded = builder.load(it->allocated, literal->value.data());
+								local.loaded = builder.load(local.allocated, literal->value.data());
 
+							setLocal(literal->value, local);
+							return local.loaded;
 						}
 						return it->loaded;
 					}
@@ -158,6 +223,7 @@ namespace tea {
 
 			for (const auto& arg : call->args)
 				args.emplace(emitExpression(arg.get()));
+			setLocation(call);
 
 			// TODO: improve
 			if (callee->kind == mir::ValueKind::Function && ((mir::Function*)callee)->hasAttribute(mir::FunctionAttribute::Inline)) {
@@ -180,10 +246,19 @@ namespace tea {
 					bb->body.reserve(block->body.size);
 
 					for (const auto& insn : block->body) {
+						// the callee's slots join the caller's, inlining into a loop mustn't grow the stack every iteration
+						if (insn.op == mir::OpCode::Alloca) {
+							valueMap[insn.result.get()] = emitAlloca(insn.result->type->getElementType(), insn.result->name);
+							continue;
+						}
+
 						mir::Instruction cloned;
 						cloned.op = insn.op;
 						cloned.extra = insn.extra;
 						cloned.operands = insn.operands;
+						// inlined code is attributed to the call
+						cloned.line = node->line;
+						cloned.column = node->column;
 
 						for (uint32_t i = 0; i < cloned.operands.size; i++) {
 							mir::Value* old = cloned.operands[i];
@@ -217,6 +292,11 @@ namespace tea {
 						term->operands[2] = (mir::Value*)blockMap[(const mir::BasicBlock*)term->operands[2]];
 						break;
 					}
+					case mir::OpCode::Switch: {
+						for (uint32_t i = 1; i < term->operands.size; i += 2)
+							term->operands[i] = (mir::Value*)blockMap[(const mir::BasicBlock*)term->operands[i]];
+						break;
+					}
 					case mir::OpCode::Ret: {
 						if (!term->operands.empty()) {
 							// the hope is that if the return value isnt mapped then its a global/constant
@@ -234,12 +314,14 @@ namespace tea {
 					}
 				}
 
+				memoryVersion++;
 				return retVal;
 
 			} else {
 				mir::Value* call = builder.call(callee, args.data, args.size, "");
 				if (callee->kind == mir::ValueKind::Function && ((mir::Function*)callee)->hasAttribute(mir::FunctionAttribute::Inline))
 					builder.unreachable();
+				memoryVersion++;
 				return call;
 			}
 		} break;
@@ -331,17 +413,10 @@ namespace tea {
 		case AST::ExprKind::Not:
 			return builder.binop(mir::OpCode::Not, expr2bool(emitExpression(((AST::UnaryExprNode*)node)->value.get())), nullptr, "");
 		case AST::ExprKind::And:
-			return builder.binop(mir::OpCode::And,
-				emitExpression(((AST::BinaryExprNode*)node)->lhs.get()),
-				emitExpression(((AST::BinaryExprNode*)node)->rhs.get()),
-				""
-			);
 		case AST::ExprKind::Or:
-			return builder.binop(mir::OpCode::Or,
-				emitExpression(((AST::BinaryExprNode*)node)->lhs.get()),
-				emitExpression(((AST::BinaryExprNode*)node)->rhs.get()),
-				""
-			);
+			if (flags.has(EmissionFlags::Constant))
+				ctx.diag.fatal({ fsrc, node->line, node->column }, 4003, "value is not a constant expression");
+			return emitLogical((const AST::BinaryExprNode*)node);
 
 		case AST::ExprKind::Cast: {
 			mir::Value* val = emitExpression(((AST::UnaryExprNode*)node)->value.get());
@@ -408,6 +483,7 @@ namespace tea {
 			}
 
 			builder.store(lhs, builder.cast(rhs, lhs->type->getElementType(), ""));
+			memoryVersion++;
 			return lhs;
 		} break;
 
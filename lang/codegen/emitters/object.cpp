@@ -17,10 +17,17 @@ namespace tea {
 			mir::Function* f = module->addFunction(std::format("{}_{}", node->type->name, method->name).c_str(), ctx.types.Function(method->returnType, argTypes, method->vararg));
 			f->cc = method->cc;
 			f->storage = method->vis;
+			f->fsrc = fsrc;
+			f->line = method->line;
+			f->getParam(0)->name = f->scope.add("this");
 				
 			builder.block = f->appendBlock("entry");
 			curParams = &method->params;
+			setLocation(method.get());
 
+			// the function's variables go out of scope with it
+			uint32_t scope = enterScope();
+			emitParamSlots(method.get());
 			for (const auto& var : method->variables)
 				emitVariable(var.get());
 
@@ -35,6 +42,7 @@ namespace tea {
 				}
 			}
 
+			leaveScope(scope);
 			curParams = nullptr;
 			builder.block = nullptr;
 		}
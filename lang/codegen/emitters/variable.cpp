@@ -1,16 +1,207 @@
 #include "codegen/codegen.h"
 
+#include "core/tea.h"
+
 namespace tea {
 
+	static void collectReferenced(const AST::Tree& tree, tea::vector<const tea::string*>& names);
+
+	// collect the names `emitExpression` will be asked for by reference: assigned to, referenced or indexed by field
+	static void collectReferenced(const AST::ExpressionNode* node, tea::vector<const tea::string*>& names) {
+		if (!node)
+			return;
+
+		auto refer = [&](const AST::ExpressionNode* operand) {
+			if (operand->getEKind() == AST::ExprKind::Identf)
+				names.emplace(&((const AST::LiteralNode*)operand)->value);
+		};
+
+		switch (node->getEKind()) {
+		case AST::ExprKind::String:
+		case AST::ExprKind::Char:
+		case AST::ExprKind::Int:
+		case AST::ExprKind::Float:
+		case AST::ExprKind::Double:
+		case AST::ExprKind::Identf:
+			break;
+
+		case AST::ExprKind::Call: {
+			const AST::CallNode* call = (const AST::CallNode*)node;
+			collectReferenced(call->callee.get(), names);
+			for (const auto& arg : call->args)
+				collectReferenced(arg.get(), names);
+		} break;
+
+		case AST::ExprKind::Ref:
+			refer(((const AST::UnaryExprNode*)node)->value.get());
+			TEA_FALLTHROUGH;
+		case AST::ExprKind::Not:
+		case AST::ExprKind::Deref:
+		case AST::ExprKind::Cast:
+			collectReferenced(((const AST::UnaryExprNode*)node)->value.get(), names);
+			break;
+
+		case AST::ExprKind::Array:
+			for (const auto& value : ((const AST::ArrayNode*)node)->values)
+				collectReferenced(value.get(), names);
+			break;
+
+		case AST::ExprKind::Assignment: {
+			const AST::AssignmentNode* assign = (const AST::AssignmentNode*)node;
+			refer(assign->lhs.get());
+			collectReferenced(assign->lhs.get(), names);
+			collectReferenced(assign->rhs.get(), names);
+		} break;
+
+		// the right hand side is the field's name
+		case AST::ExprKind::FieldIndex: {
+			const AST::BinaryExprNode* be = (const AST::BinaryExprNode*)node;
+			refer(be->lhs.get());
+			collectReferenced(be->lhs.get(), names);
+		} break;
+
+		default: {
+			const AST::BinaryExprNode* be = (const AST::BinaryExprNode*)node;
+			collectReferenced(be->lhs.get(), names);
+			collectReferenced(be->rhs.get(), names);
+		} break;
+		}
+	}
+
+	static void collectReferenced(const AST::Tree& tree, tea::vector<const tea::string*>& names) {
+		for (const auto& node : tree) {
+			switch (node->kind) {
+			case AST::NodeKind::Return:
+				collectReferenced(((const AST::ReturnNode*)node.get())->value.get(), names);
+				break;
+
+			case AST::NodeKind::Expression:
+				collectReferenced((const AST::ExpressionNode*)node.get(), names);
+				break;
+
+			case AST::NodeKind::If: {
+				const AST::IfNode* ifNode = (const AST::IfNode*)node.get();
+				collectReferenced(ifNode->pred.get(), names);
+				collectReferenced(ifNode->body, names);
+				for (const AST::ElseIfNode* elseIf = ifNode->elseIf.get(); elseIf; elseIf = elseIf->next.get()) {
+					collectReferenced(elseIf->pred.get(), names);
+					collectReferenced(elseIf->body, names);
+				}
+				if (ifNode->otherwise)
+					collectReferenced(ifNode->otherwise->body, names);
+			} break;
+
+			case AST::NodeKind::Switch: {
+				const AST::SwitchNode* switchNode = (const AST::SwitchNode*)node.get();
+				collectReferenced(switchNode->pred.get(), names);
+				for (const auto& arm : switchNode->cases)
+					collectReferenced(arm->body, names);
+				if (switchNode->otherwise)
+					collectReferenced(switchNode->otherwise->body, names);
+			} break;
+
+			case AST::NodeKind::WhileLoop: {
+				const AST::WhileLoopNode* loop = (const AST::WhileLoopNode*)node.get();
+				collectReferenced(loop->pred.get(), names);
+				collectReferenced(loop->body, names);
+			} break;
+
+			case AST::NodeKind::ForLoop: {
+				const AST::ForLoopNode* loop = (const AST::ForLoopNode*)node.get();
+				collectReferenced(loop->var->initializer.get(), names);
+				collectReferenced(loop->pred.get(), names);
+				collectReferenced(loop->step.get(), names);
+				collectReferenced(loop->body, names);
+			} break;
+
+			default:
+				break;
+			}
+		}
+	}
+
 	void CodeGen::emitVariable(const AST::VariableNode* node) {
-		mir::Value* allocated = builder.alloca_(node->type, node->name + ".addr");
+		setLocation(node);
+		mir::Value* allocated = emitAlloca(node->type, node->name + ".addr");
 		if (node->initializer)
 			builder.store(allocated, emitExpression(node->initializer.get()));
 
-		locals[node->name] = {
+		setLocal(node->name, {
 			.allocated = allocated,
-			.loaded = nullptr
-		};
+			.loaded = nullptr,
+			.version = 0
+		});
+	}
+
+	void CodeGen::emitParamSlots(const AST::FunctionNode* node) {
+		tea::vector<const tea::string*> referenced;
+		for (const auto& var : node->variables)
+			collectReferenced(var->initializer.get(), referenced);
+		collectReferenced(node->body, referenced);
+
+		// parameters are plain values, the ones written to or pointed at are spilled once on entry
+		paramSlots.clear();
+		for (uint32_t i = 0; i < node->params.size; i++) {
+			const tea::string& name = node->params[i].second;
+
+			mir::Value* slot = nullptr;
+			for (const tea::string* it : referenced) {
+				if (*it == name) {
+					slot = emitAlloca(node->params[i].first, name + ".addr");
+					builder.store(slot, builder.block->parent->getParam(i));
+					break;
+				}
+			}
+			paramSlots.emplace(slot);
+		}
+	}
+
+	mir::Value* CodeGen::emitAlloca(Type* type, const char* name) {
+		mir::BasicBlock* block = builder.block;
+		mir::BasicBlock* entry = block->parent->blocks[0].get();
+
+		// slots belong to no statement in particular
+		uint32_t line = builder.line, column = builder.column;
+		builder.block = entry;
+		builder.line = builder.column = 0;
+		mir::Value* slot = builder.alloca_(type, name);
+		builder.block = block;
+		builder.line = line;
+		builder.column = column;
+
+		// keep the entry block's allocas ahead of its code
+		uint32_t last = entry->body.size - 1;
+		uint32_t pos = 0;
+		while (pos < last && entry->body[pos].op == mir::OpCode::Alloca)
+			pos++;
+
+		if (pos != last) {
+			mir::Instruction insn = std::move(entry->body[last]);
+			entry->body.pop();
+			entry->body.emplace_at(pos, std::move(insn));
+		}
+		return slot;
+	}
+
+	void CodeGen::setLocal(const tea::string& name, const Local& local) {
+		Local* it = locals.find(name);
+		shadowed.emplace(name, it ? *it : Local{}, it != nullptr);
+
+		if (it)
+			*it = local;
+		else
+			locals.insert(name, local);
+	}
+
+	void CodeGen::leaveScope(uint32_t mark) {
+		while (shadowed.size > mark) {
+			ShadowedLocal& last = shadowed[shadowed.size - 1];
+			if (last.bound)
+				*locals.find(last.name) = last.local;
+			else
+				locals.erase(last.name);
+			shadowed.pop();
+		}
 	}
 
 } // namespace tea
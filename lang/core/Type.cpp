@@ -1,6 +1,7 @@
 #include "type.h"
 
 #include <string>
+#include <mutex>
 #include <functional>
 
 namespace tea {
@@ -19,6 +20,8 @@ namespace tea {
 	static std::unordered_map<tea::string, Type*> usertypes;
 
 	Type* TypeTable::primitive(TypeKind kind, bool constant, bool sign) {
+		std::lock_guard<std::recursive_mutex> guard(lock);
+
 		for (auto& type : types) {
 			if (type->kind == kind && type->constant == constant && type->sign == sign)
 				return type.get();
@@ -28,10 +31,13 @@ namespace tea {
 	}
 
 	PointerType* TypeTable::Pointer(Type* pointee, bool constant) {
+		std::lock_guard<std::recursive_mutex> guard(lock);
 		return allocate<PointerType>(pointee, constant);
 	}
 
 	FunctionType* TypeTable::Function(Type* returnType, const tea::vector<Type*>& params, bool vararg) {
+		std::lock_guard<std::recursive_mutex> guard(lock);
+
 		size_t hash = std::hash<Type*>()(returnType);
 		for (auto* param : params)
 			hash ^= std::hash<Type*>()(param) + 0x9e3779b9 + (hash << 6) + (hash >> 2);
@@ -49,10 +55,13 @@ namespace tea {
 	}
 
 	ArrayType* TypeTable::Array(Type* elementType, uint32_t size, bool constant) {
+		std::lock_guard<std::recursive_mutex> guard(lock);
 		return allocate<ArrayType>(elementType, size, constant);
 	}
 
 	StructType* TypeTable::Struct(Type** body, uint32_t n, const char* name, bool packed) {
+		std::lock_guard<std::recursive_mutex> guard(lock);
+
 		size_t hash = std::hash<const char*>()(name);
 		if (auto it = structTypes.find(hash))
 			return it->get();
@@ -85,6 +94,8 @@ namespace tea {
 
 	static inline bool notSpace(int ch) { return !isspace(ch); }
 	Type* TypeTable::get(const tea::string& name) {
+		std::lock_guard<std::recursive_mutex> guard(lock);
+
 		std::string s(name.data(), name.length());
 
 		s.erase(s.begin(), std::find_if(s.begin(), s.end(), notSpace));
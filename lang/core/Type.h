@@ -5,6 +5,7 @@
 #include "core/string.h"
 #include "core/vector.h"
 
+#include <mutex>
 #include <memory>
 
 namespace tea {
@@ -20,6 +21,10 @@ namespace tea {
 	struct PointerType;
 	struct FunctionType;
 
+	/// <summary>
+	/// Owns every type of the compilation, types are made and looked up under a lock so threads compiling
+	/// different modules can share the table. Types are never freed, what it hands out stays valid
+	/// </summary>
 	class TypeTable {
 	public:
 		tea::vector<std::unique_ptr<Type>> types;
@@ -44,6 +49,9 @@ namespace tea {
 		Type* Short(bool constant = false, bool sign = true);
 
 	private:
+		// recursive, lookups by name build the types they name with the other methods
+		std::recursive_mutex lock;
+
 		Type* primitive(TypeKind kind, bool constant = false, bool sign = true);
 
 		template<typename T, typename... Args>
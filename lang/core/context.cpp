@@ -1,10 +1,26 @@
 
 #include "core/context.h"
+#include "backends/llvm/LLVMSession.h"
 
 #include <cstdio>
 #include <cstdarg>
 
 namespace tea {
+    Context::Context() : shared(std::make_shared<Shared>()), types(shared->types), sources(shared->sources), diag(sources) {}
+
+    Context::Context(Context& parent)
+        : shared(parent.shared), types(shared->types), sources(shared->sources), diag(sources), importLookup(parent.importLookup) {
+    }
+
+    Context::~Context() = default;
+
+    backend::LLVMSession& Context::getLLVMSession() {
+        std::lock_guard<std::mutex> guard(shared->lock);
+        if (!shared->llvm)
+            shared->llvm = std::make_unique<backend::LLVMSession>();
+        return *shared->llvm;
+    }
+
     uint32_t SourceManager::load(const tea::string& path) {
         FILE* file;
         fopen_s(&file, path.data(), "rb");
@@ -18,12 +34,18 @@ namespace tea {
         fread(buf.data(), 1, size, file);
         fclose(file);
 
-        files.emplace(path, buf);
-        return (uint32_t)(files.size - 1);
+        return add(path, std::move(buf));
     }
 
     uint32_t SourceManager::loadVirtual(const tea::string& path, tea::string contents) {
-        files.emplace(path, contents);
+        return add(path, std::move(contents));
+    }
+
+    uint32_t SourceManager::add(const tea::string& path, tea::string contents) {
+        auto file = std::make_unique<std::pair<tea::string, tea::string>>(path, std::move(contents));
+
+        std::lock_guard<std::mutex> guard(lock);
+        files.emplace(std::move(file));
         return (uint32_t)(files.size - 1);
     }
 
@@ -52,6 +74,12 @@ namespace tea {
         }
     }
 
+    void Diagnostics::merge(const Diagnostics& other) {
+        for (const auto& diag : other.diags)
+            diags.emplace(diag);
+        hasError |= other.hasError;
+    }
+
     void Diagnostics::addFormatted(const SourceLoc& loc, uint32_t ecode, const tea::string& msg, const DiagSeverity sev, ...) {
         va_list va;
         va_start(va, sev);
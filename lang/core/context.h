@@ -2,6 +2,8 @@
 
 #include <cstdio>
 #include <cstdint>
+#include <mutex>
+#include <memory>
 #include <stdexcept>
 
 #include "core/tea.h"
@@ -26,16 +28,28 @@ namespace tea {
 		tea::string emsg;
 	};
 
+	/// <summary>
+	/// Append-only list of the loaded sources, safe to use from several threads. A source never moves once
+	/// loaded, so references to its path and contents stay valid while others are added
+	/// </summary>
 	class SourceManager {
 	public:
 		uint32_t load(const tea::string& path);
 		uint32_t loadVirtual(const tea::string& path, tea::string contents);
 
-		const tea::string& pathof(uint32_t id) const { return files[id].first; }
-		const tea::string& contentsof(uint32_t id) const { return files[id].second; }
+		const tea::string& pathof(uint32_t id) const { return get(id).first; }
+		const tea::string& contentsof(uint32_t id) const { return get(id).second; }
 
 	private:
-		tea::vector<std::pair<tea::string, tea::string>> files;
+		mutable std::mutex lock;
+		tea::vector<std::unique_ptr<std::pair<tea::string, tea::string>>> files;
+
+		uint32_t add(const tea::string& path, tea::string contents);
+
+		const std::pair<tea::string, tea::string>& get(uint32_t id) const {
+			std::lock_guard<std::mutex> guard(lock);
+			return *files[id];
+		}
 	};
 
 	class Diagnostics {
@@ -64,17 +78,48 @@ namespace tea {
 
 		void print() const;
 
+		/// <summary>
+		/// Append the diagnostics of `other`, reported by another thread, after the ones of this
+		/// </summary>
+		void merge(const Diagnostics& other);
+
 	private:
 		void addFormatted(const SourceLoc& loc, uint32_t ecode, const tea::string& msg, const DiagSeverity sev, ...);
 	};
 
+	namespace backend { class LLVMSession; }
+
 	struct Context {
-		Context() : diag(sources) {}
+		Context();
+
+		/// <summary>
+		/// Make a context to compile on another thread alongside `parent`. Types, sources and backend state are
+		/// shared with it, diagnostics are kept apart until merged back in
+		/// </summary>
+		explicit Context(Context& parent);
+		~Context();
 
-		TypeTable types;
+	private:
+		struct Shared {
+			TypeTable types;
+			SourceManager sources;
+
+			std::mutex lock;
+			std::unique_ptr<backend::LLVMSession> llvm;
+		};
+
+		std::shared_ptr<Shared> shared;
+
+	public:
+		TypeTable& types;
+		SourceManager& sources;
 		Diagnostics diag;
-		SourceManager sources;
 
 		tea::vector<tea::string> importLookup;
+
+		/// <summary>
+		/// Get the LLVM state shared by every module, set up by the first one lowered with LLVM
+		/// </summary>
+		backend::LLVMSession& getLLVMSession();
 	};
 }
@@ -1,8 +1,12 @@
 #include "tea.h"
 
 #include <fstream>
+#include <random>
+#include <cstring>
+#include <filesystem>
 
 #include "mir/dump/dump.h"
+#include "mir/passes/passes.h"
 #include "codegen/codegen.h"
 #include "frontend/lexer/Lexer.h"
 #include "frontend/parser/Parser.h"
@@ -11,61 +15,230 @@
 #include "frontend/semantics/SemanticAnalyzer.h"
 
 namespace tea {
-	void compile(
-		Context& ctx, uint32_t fsrc,
-		const char* outfile, const char* triple,
-		const CompilerFlags& flags, uint8_t optLevel
-	) {
-		clock_t start = clock();
-
+	// lex, parse, analyze and generate the MIR of `fsrc`, `ast` has to outlive the module
+	static std::unique_ptr<mir::Module> emitModule(Context& ctx, uint32_t fsrc, const char* triple, tea::frontend::AST::Tree& ast) {
 		const tea::vector<tea::frontend::Token>& tokens = tea::frontend::lex(ctx, fsrc);
 		if (ctx.diag.hasError)
-			return;
+			return nullptr;
 
 		tea::frontend::Parser parser(ctx);
-		const tea::frontend::AST::Tree& ast = parser.parse(tokens, fsrc);
+		ast = parser.parse(tokens, fsrc);
 		if (ctx.diag.hasError)
-			return;
+			return nullptr;
 
 		tea::frontend::SemanticAnalyzer analyzer(ctx);
 		analyzer.visit(ast, fsrc);
 		if (ctx.diag.hasError)
-			return;
+			return nullptr;
 
 		tea::CodeGen codegen(ctx);
 		tea::CodeGen::Options coptions;
 		if (triple)
 			coptions.triple = triple;
-		auto module = codegen.emit(fsrc, ast, coptions);
+		return codegen.emit(fsrc, ast, coptions);
+	}
+
+	// lex, parse, analyze and generate every source, linking them into the module of the first
+	static std::unique_ptr<mir::Module> emitProgram(Context& ctx, const tea::vector<uint32_t>& fsrcs, const char* triple, tea::vector<tea::frontend::AST::Tree>& asts) {
+		std::unique_ptr<mir::Module> program;
+		for (uint32_t fsrc : fsrcs) {
+			auto module = emitModule(ctx, fsrc, triple, *asts.emplace());
+			if (!module)
+				return nullptr;
+
+			if (!program)
+				program = std::move(module);
+			else
+				program->link(std::move(module));
+			if (ctx.diag.hasError)
+				return nullptr;
+		}
+		return program;
+	}
+
+	static void optimizeModule(Context& ctx, mir::Module* module, const CompilerFlags& flags, uint8_t optLevel, const PipelineOptions& pipeline) {
+		if (!ctx.diag.hasError)
+			tea::mir::optimize(module, {
+				.optLevel = optLevel,
+				.sizeLevel = pipeline.sizeLevel,
+				.verbose = flags.has(CompilerFlags::Verbose),
+				.timePasses = flags.has(CompilerFlags::TimePasses)
+			});
 
 		if (flags.has(CompilerFlags::DumpMIR)) {
-			tea::mir::dump(module.get());
+			tea::mir::dump(module);
 			putchar('\n');
 		}
+	}
+
+	static backend::Lowering::Options getLLVMOptions(const char* outfile, const CompilerFlags& flags, uint8_t optLevel, const PipelineOptions& pipeline) {
+		return {
+			.outfile = outfile,
+			.dumpModule = flags.has(CompilerFlags::DumpFinalIR),
+			.optLevel = optLevel,
+			.debugInfo = flags.has(CompilerFlags::DebugInfo),
+			.sizeLevel = pipeline.sizeLevel,
+			.vectorizeLoops = pipeline.vectorizeLoops,
+			.vectorizeSLP = pipeline.vectorizeSLP,
+			.timePasses = flags.has(CompilerFlags::TimePasses),
+			.passes = pipeline.passes,
+			.codegenThreads = pipeline.codegenThreads,
+			.cpu = pipeline.cpu,
+			.features = pipeline.features,
+			.hostFeatures = pipeline.hostFeatures
+		};
+	}
+
+	static void hashBytes(uint64_t& hash, const void* data, size_t size) {
+		for (size_t i = 0; i < size; i++) {
+			hash ^= ((const uint8_t*)data)[i];
+			hash *= 0x100000001b3ull;
+		}
+	}
+
+	// name of the cache entry for what the backend makes of `module` with these options
+	static std::filesystem::path getCacheEntry(Context& ctx, const mir::Module* module, const CompilerFlags& flags, uint8_t optLevel, const PipelineOptions& pipeline) {
+		bool debugInfo = flags.has(CompilerFlags::DebugInfo);
+		uint64_t hash = module->hash(debugInfo);
+
+		const uint8_t options[] = { optLevel, pipeline.sizeLevel, pipeline.vectorizeLoops, pipeline.vectorizeSLP, debugInfo };
+		hashBytes(hash, options, sizeof(options));
+		if (pipeline.passes)
+			hashBytes(hash, pipeline.passes, strlen(pipeline.passes) + 1);
+
+		// what the backend targets, with "native" standing for the host this runs on
+		if (pipeline.cpu || pipeline.features || pipeline.hostFeatures) {
+			std::string cpu, features;
+			ctx.getLLVMSession().resolveTarget(pipeline.cpu, pipeline.features, pipeline.hostFeatures, cpu, features);
+			hashBytes(hash, cpu.c_str(), cpu.size() + 1);
+			hashBytes(hash, features.c_str(), features.size() + 1);
+		}
 
+		// entries written by another build of the compiler are never picked up
+		const char* build = __DATE__ " " __TIME__;
+		hashBytes(hash, build, strlen(build));
+
+		char name[24];
+		snprintf(name, sizeof(name), "%016llx%s", (unsigned long long)hash, module->triple == "experimental-luau-0.730" ? ".luau" : ".o");
+		return std::filesystem::path(pipeline.cacheDir) / name;
+	}
+
+	static void emitOutput(Context& ctx, mir::Module* module, const char* outfile, const CompilerFlags& flags, uint8_t optLevel, const PipelineOptions& pipeline) {
+		optimizeModule(ctx, module, flags, optLevel, pipeline);
 		if (ctx.diag.hasError)
 			return;
 
+		std::filesystem::path entry;
+		// the cache keeps one file per output, split code generation writes several
+		if (pipeline.cacheDir && pipeline.codegenThreads <= 1) {
+			entry = getCacheEntry(ctx, module, flags, optLevel, pipeline);
+
+			// a dump of the final IR needs the backend to run
+			std::error_code ec;
+			if (!flags.has(CompilerFlags::DumpFinalIR) && std::filesystem::copy_file(entry, outfile, std::filesystem::copy_options::overwrite_existing, ec)) {
+				if (flags.has(CompilerFlags::Verbose))
+					printf("Cache: hit %s\n", entry.filename().string().c_str());
+				return;
+			}
+
+			if (flags.has(CompilerFlags::Verbose))
+				printf("Cache: miss %s\n", entry.filename().string().c_str());
+		}
+
 		if (module->triple == "experimental-luau-0.730") {
 			tea::backend::LuauLowering lowering(ctx);
-			lowering.lower(module.get(), {
+			lowering.lower(module, {
 				.outfile = outfile,
 				.dumpModule = flags.has(CompilerFlags::DumpFinalIR),
 				.optLevel = optLevel
 			});
 		} else {
-			tea::backend::LLVMLowering lowering(ctx);
-			lowering.lower(module.get(), {
-				.outfile = outfile,
-				.dumpModule = flags.has(CompilerFlags::DumpFinalIR),
-				.optLevel = optLevel,
-			});
+			tea::backend::LLVMLowering lowering(ctx, ctx.getLLVMSession());
+			lowering.lower(module, getLLVMOptions(outfile, flags, optLevel, pipeline));
 		}
 
+		if (!entry.empty() && !ctx.diag.hasError) {
+			// written under a temporary name and renamed, so concurrent builds never see half an entry
+			std::error_code ec;
+			std::filesystem::path temp = entry;
+			temp += "." + std::to_string(std::random_device{}()) + ".tmp";
+
+			std::filesystem::create_directories(entry.parent_path(), ec);
+			if (!ec)
+				std::filesystem::copy_file(outfile, temp, ec);
+			if (!ec)
+				std::filesystem::rename(temp, entry, ec);
+			if (ec) {
+				std::filesystem::remove(temp, ec);
+				ctx.diag.warn(TEA_NO_SOURCELOC, "could not store %s in the cache", outfile);
+			}
+		}
+	}
+
+	static void printElapsed(clock_t start) {
 		double diff = (clock() - start) / (double)CLOCKS_PER_SEC;
 		printf("Compilation took %ldm %lds %ldms\n",
 			(long)(diff / 60),
 			(long)diff % 60,
 			(long)((diff - (long)diff) * 1000));
 	}
+
+	void compile(
+		Context& ctx, uint32_t fsrc,
+		const char* outfile, const char* triple,
+		const CompilerFlags& flags, uint8_t optLevel,
+		const PipelineOptions& pipeline
+	) {
+		clock_t start = clock();
+
+		tea::frontend::AST::Tree ast;
+		auto module = emitModule(ctx, fsrc, triple, ast);
+		if (!module)
+			return;
+
+		emitOutput(ctx, module.get(), outfile, flags, optLevel, pipeline);
+		if (ctx.diag.hasError)
+			return;
+
+		printElapsed(start);
+	}
+
+	void compileProgram(
+		Context& ctx, const tea::vector<uint32_t>& fsrcs,
+		const char* outfile, const char* triple,
+		const CompilerFlags& flags, uint8_t optLevel,
+		const PipelineOptions& pipeline
+	) {
+		clock_t start = clock();
+
+		tea::vector<tea::frontend::AST::Tree> asts;
+		auto program = emitProgram(ctx, fsrcs, triple, asts);
+		if (!program)
+			return;
+
+		emitOutput(ctx, program.get(), outfile, flags, optLevel, pipeline);
+		if (ctx.diag.hasError)
+			return;
+
+		printElapsed(start);
+	}
+
+	int run(
+		Context& ctx, const tea::vector<uint32_t>& fsrcs,
+		const CompilerFlags& flags, uint8_t optLevel,
+		const PipelineOptions& pipeline,
+		int argc, const char* const* argv
+	) {
+		tea::vector<tea::frontend::AST::Tree> asts;
+		auto program = emitProgram(ctx, fsrcs, nullptr, asts);
+		if (!program)
+			return 1;
+
+		optimizeModule(ctx, program.get(), flags, optLevel, pipeline);
+		if (ctx.diag.hasError)
+			return 1;
+
+		tea::backend::LLVMLowering lowering(ctx, ctx.getLLVMSession());
+		return lowering.run(program.get(), getLLVMOptions(nullptr, flags, optLevel, pipeline), argc, argv);
+	}
 }
@@ -58,7 +58,10 @@ namespace tea {
 		enum Flag : uint8_t {
 			None = 0,
 			DumpMIR = 1,
-			DumpFinalIR = 2
+			DumpFinalIR = 2,
+			Verbose = 4,
+			DebugInfo = 8,
+			TimePasses = 16
 		};
 
 		uint8_t value;
@@ -89,9 +92,55 @@ namespace tea {
 		));
 	}
 
+	/// <summary>
+	/// How the optimization level is turned into a pipeline, and how its result is turned into code
+	/// </summary>
+	struct PipelineOptions {
+		// LLVM pass pipeline replacing the default one of the optimization level
+		const char* passes = nullptr;
+		// 1 for -Os, 2 for -Oz
+		uint8_t sizeLevel = 0;
+		// run the vectorizers even where the optimization level wouldn't
+		bool vectorizeLoops = false;
+		bool vectorizeSLP = false;
+		// threads emitting machine code, the module is split by function into one object per thread when there
+		// are several, written next to the output as `<output>.partN.o`
+		uint32_t codegenThreads = 1;
+		// directory of previously emitted outputs, looked up by the hash of the optimized module
+		const char* cacheDir = nullptr;
+		// CPU to tune and select instructions for, "native" for the host. None targets the baseline of the triple
+		const char* cpu = nullptr;
+		// features added to or removed from those of the CPU, like "+avx2,-fma"
+		const char* features = nullptr;
+		// -march=native, every feature the host reports is enabled as well
+		bool hostFeatures = false;
+	};
+
 	void compile(
 		tea::Context& ctx, uint32_t fsrc,
 		const char* outfile, const char* triple,
-		const CompilerFlags& flags, uint8_t optLevel
+		const CompilerFlags& flags, uint8_t optLevel,
+		const PipelineOptions& pipeline = {}
+	);
+
+	/// <summary>
+	/// Compile every source into a single module, optimized as a whole and written to one output
+	/// </summary>
+	void compileProgram(
+		tea::Context& ctx, const tea::vector<uint32_t>& fsrcs,
+		const char* outfile, const char* triple,
+		const CompilerFlags& flags, uint8_t optLevel,
+		const PipelineOptions& pipeline = {}
+	);
+
+	/// <summary>
+	/// Compile every source into a single module for the host and run its `main` in this process
+	/// </summary>
+	/// <returns>The exit code of the program</returns>
+	int run(
+		tea::Context& ctx, const tea::vector<uint32_t>& fsrcs,
+		const CompilerFlags& flags, uint8_t optLevel,
+		const PipelineOptions& pipeline,
+		int argc, const char* const* argv
 	);
 }
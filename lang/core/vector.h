@@ -166,6 +166,26 @@ namespace tea {
 			return &data[0];
 		}
 
+		template <typename... Args>
+		T* emplace_at(uint32_t i, Args&&... args) {
+			if (i >= size)
+				return emplace(std::forward<Args>(args)...);
+
+			grow();
+			if constexpr (std::is_trivially_copyable_v<T>) {
+				memmove(data + i + 1, data + i, (size - i) * sizeof(T));
+			}
+			else {
+				for (uint32_t j = size; j > i; j--) {
+					new (&data[j]) T(std::move(data[j - 1]));
+					data[j - 1].~T();
+				}
+			}
+			new (&data[i]) T(std::forward<Args>(args)...);
+			size++;
+			return &data[i];
+		}
+
 	private:
 		static void copyRange(T* dst, const T* src, uint32_t n) {
 			if constexpr (std::is_trivially_copyable_v<T>) {
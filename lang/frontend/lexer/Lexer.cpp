@@ -16,7 +16,8 @@ static const char* keywords[] = {
 	"func", "return", "end",
 	"var",
 	"__stdcall", "__fastcall", "__cdecl", "__auto",
-	"class"
+	"class",
+	"switch", "case", "default"
 };
 
 static bool isKeyword(const char* word, uint32_t len, int* idx) {
@@ -117,7 +118,7 @@ namespace tea::frontend {
 				while (isdigit(*pos))
 					pos++, col++;
 
-				if (c == '0' && (*pos == 'x' || *pos == 'X')) {
+				if (pos - start == (c == '-' ? 2 : 1) && *(pos - 1) == '0' && (*pos == 'x' || *pos == 'X')) {
 					pos += 2; col += 2;
 					while (isxdigit(*pos))
 						pos++, col++;
@@ -45,7 +45,8 @@ namespace tea::frontend {
 		Func, Return, End,
 		Var,
 		StdCC, FastCC, CCC, AutoCC,
-		Class//, New
+		Class,
+		Switch, Case, Default//, New
 	};
 	
 	struct Token {
@@ -1,6 +1,9 @@
 #pragma once
 
 #include <memory>
+#include <string>
+#include <cerrno>
+#include <cstdlib>
 
 #include "core/Type.h"
 #include "core/string.h"
@@ -15,6 +18,7 @@ namespace tea::frontend::AST {
 		Variable, GlobalVariable,
 		If, Else, ElseIf,
 		WhileLoop, ForLoop, LoopInterrupt,
+		Switch, Case,
 		Class, Attribute
 	};
 
@@ -54,6 +58,15 @@ namespace tea::frontend::AST {
 		Module = 1 << 0
 	};
 
+	enum class StatementAttribute : uint32_t {
+		Unroll = 1 << 0,
+
+		_count = 1
+	};
+
+	// larger @unroll factors are clamped to this
+	static constexpr uint32_t maxUnrollFactor = 256;
+
 	struct Node {
 		NodeKind kind;
 		uint32_t extra;
@@ -84,6 +97,15 @@ namespace tea::frontend::AST {
 		LiteralNode(ExprKind ekind, const tea::string& val, uint32_t line, uint32_t column)
 			: ExpressionNode(ekind, line, column), value(val) {
 		}
+
+		// the value of an integer literal, negative ones wrap around. false if it doesn't fit in 64 bits
+		bool getInteger(uint64_t& out) const {
+			std::string text(value.data(), value.length());
+			char* end = nullptr;
+			errno = 0;
+			out = strtoull(text.c_str(), &end, 0);
+			return errno != ERANGE && end != text.c_str() && !*end;
+		}
 	};
 
 	struct BinaryExprNode : ExpressionNode {
@@ -250,6 +272,29 @@ namespace tea::frontend::AST {
 		}
 	};
 
+	struct CaseNode : Node {
+		// integer constants selecting this arm, empty for `default`
+		ExpressionList values;
+
+		Tree body;
+
+		CaseNode(uint32_t line, uint32_t column)
+			: Node(NodeKind::Case, line, column) {
+		}
+	};
+
+	struct SwitchNode : Node {
+		std::unique_ptr<ExpressionNode> pred;
+		tea::vector<std::unique_ptr<CaseNode>> cases;
+		std::unique_ptr<CaseNode> otherwise;
+
+		SwitchNode(
+			std::unique_ptr<ExpressionNode> pred,
+			uint32_t line, uint32_t column
+		) : Node(NodeKind::Switch, line, column), pred(std::move(pred)) {
+		}
+	};
+
 	struct GlobalVariableNode : Node {
 		tea::string name;
 		Type* type;
@@ -294,6 +339,7 @@ namespace tea::frontend::AST {
 
 	struct WhileLoopNode : Node {
 		std::unique_ptr<ExpressionNode> pred;
+		tea::umap<StatementAttribute, ExpressionList> attrParams;
 
 		Tree body;
 
@@ -302,6 +348,18 @@ namespace tea::frontend::AST {
 			uint32_t line, uint32_t column
 		) : Node(NodeKind::WhileLoop, line, column), pred(std::move(pred)) {
 		}
+
+		void clearAttributes() { extra = 0; };
+		void addAttribute(StatementAttribute attr) { extra |= (uint32_t)attr; };
+		bool hasAttribute(StatementAttribute attr) const { return extra & (uint32_t)attr; };
+		void removeAttribute(StatementAttribute attr) { extra &= ~(uint32_t)attr; };
+
+		void addAttribute(StatementAttribute attr, ExpressionList&& params) {
+			extra |= (uint32_t)attr;
+			if (!params.empty())
+				attrParams[attr] = std::move(params);
+		};
+		const ExpressionList* getAttrParams(StatementAttribute attr) const { return attrParams.find(attr); }
 	};
 
 	struct AssignmentNode : ExpressionNode {
@@ -332,6 +390,7 @@ namespace tea::frontend::AST {
 		std::unique_ptr<VariableNode> var;
 		std::unique_ptr<ExpressionNode> pred;
 		std::unique_ptr<ExpressionNode> step;
+		tea::umap<StatementAttribute, ExpressionList> attrParams;
 		
 		Tree body;
 
@@ -342,6 +401,18 @@ namespace tea::frontend::AST {
 			uint32_t line, uint32_t column
 		) : Node(NodeKind::ForLoop, line, column), var(std::move(var)), pred(std::move(pred)), step(std::move(step)) {
 		}
+
+		void clearAttributes() { extra = 0; };
+		void addAttribute(StatementAttribute attr) { extra |= (uint32_t)attr; };
+		bool hasAttribute(StatementAttribute attr) const { return extra & (uint32_t)attr; };
+		void removeAttribute(StatementAttribute attr) { extra &= ~(uint32_t)attr; };
+
+		void addAttribute(StatementAttribute attr, ExpressionList&& params) {
+			extra |= (uint32_t)attr;
+			if (!params.empty())
+				attrParams[attr] = std::move(params);
+		};
+		const ExpressionList* getAttrParams(StatementAttribute attr) const { return attrParams.find(attr); }
 	};
 
 	struct ObjectNode : Node {
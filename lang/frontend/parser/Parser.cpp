@@ -44,6 +44,10 @@ namespace tea::frontend {
 		{"module", AST::GlobalAttribute::Module}
 	};
 
+	static const tea::map<tea::string, AST::StatementAttribute> name2statAttr = {
+		{"unroll", AST::StatementAttribute::Unroll}
+	};
+
 	AST::Tree Parser::parse(const tea::vector<Token>& tokens, uint32_t fsrc_) {
 		fsrc = fsrc_;
 		cur = tokens.begin();
@@ -373,6 +377,50 @@ namespace tea::frontend {
 				tree->push(std::move(ifNode));
 			} break;
 
+			case KeywordKind::Switch: {
+				next();
+
+				consume(TokenKind::Lpar);
+				auto pred = parseExpression();
+				consume(TokenKind::Rpar);
+
+				consume(KeywordKind::Do);
+
+				auto switchNode = mknode(AST::SwitchNode, std::move(pred));
+
+				// every arm ends where the next one starts, the last one at `end`
+				const Token* arm = cur++;
+				while (arm->kind == TokenKind::Keyword && (arm->extra == (uint32_t)KeywordKind::Case || arm->extra == (uint32_t)KeywordKind::Default)) {
+					auto caseNode = std::make_unique<AST::CaseNode>(arm->line, arm->column);
+					if (arm->extra == (uint32_t)KeywordKind::Case) {
+						do {
+							caseNode->values.emplace(parseExpression());
+						} while (match(TokenKind::Comma));
+					} else if (switchNode->otherwise)
+						ctx.diag.error({ fsrc, arm->line, arm->column }, 2004, "switch already has a 'default' arm");
+
+					consume(TokenKind::Colon);
+
+					treeHistory.emplace(tree);
+					tree = &caseNode->body;
+
+					parseBlock({ KeywordKind::Case, KeywordKind::Default });
+
+					if (arm->extra == (uint32_t)KeywordKind::Case)
+						switchNode->cases.emplace(std::move(caseNode));
+					else
+						switchNode->otherwise = std::move(caseNode);
+					arm = cur - 1;
+				}
+
+				if (arm->kind != TokenKind::Keyword || arm->extra != (uint32_t)KeywordKind::End) {
+					cur = arm;
+					unexpected();
+				}
+
+				tree->push(std::move(switchNode));
+			} break;
+
 			case KeywordKind::While: {
 				next();
 
@@ -426,6 +474,47 @@ namespace tea::frontend {
 			}
 		} break;
 
+		case TokenKind::At: {
+			next();
+
+			const tea::string& attrName = consume(TokenKind::Identf).text;
+			const AST::StatementAttribute* attr = name2statAttr.find(attrName);
+			if (!attr)
+				ctx.diag.error({ fsrc, _line, _column }, 2001, "'%s' is not a valid attribute", attrName.data());
+
+			AST::ExpressionList params;
+			if (match(TokenKind::Lpar)) {
+				while (cur->kind != TokenKind::Rpar) {
+					params.emplace(parsePrimary());
+					if (cur->kind == TokenKind::Comma) {
+						next();
+						continue;
+					}
+					break;
+				}
+				consume(TokenKind::Rpar);
+			}
+
+			// loops push themselves onto the tree instead of being returned
+			uint32_t before = tree->size;
+			auto node = parseStat();
+
+			AST::Node* target = node.get();
+			if (!target && tree->size > before)
+				target = tree->data[tree->size - 1].get();
+
+			if (!target || (target->kind != AST::NodeKind::ForLoop && target->kind != AST::NodeKind::WhileLoop))
+				ctx.diag.error({ fsrc, _line, _column }, 2001, "attribute '%s' can only be applied to loops", attrName.data());
+			else if (attr) {
+				if (target->kind == AST::NodeKind::ForLoop)
+					((AST::ForLoopNode*)target)->addAttribute(*attr, std::move(params));
+				else
+					((AST::WhileLoopNode*)target)->addAttribute(*attr, std::move(params));
+			}
+
+			return node;
+		}
+
 		default: {
 			auto node = parseExpression();
 			consume(TokenKind::Semicolon);
@@ -654,6 +743,16 @@ namespace tea::frontend {
 			node = mknode(AST::LiteralNode, AST::ExprKind::Int, cur->text);
 			next();
 		} break;
+		case TokenKind::Sub: {
+			next();
+			// only integer literals can be negated, the sign is folded into the literal like the lexer does for `-1`
+			if (cur->kind != TokenKind::Int)
+				unexpected();
+
+			const tea::string& text = cur->text;
+			node = mknode(AST::LiteralNode, AST::ExprKind::Int, text[0] == '-' ? tea::string(text.data() + 1, text.length() - 1) : "-" + text);
+			next();
+		} break;
 		case TokenKind::Float: {
 			node = mknode(AST::LiteralNode, AST::ExprKind::Float, cur->text);
 			next();
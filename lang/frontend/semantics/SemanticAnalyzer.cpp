@@ -236,9 +236,52 @@ namespace tea::frontend {
 			}
 		} break;
 
+		case AST::NodeKind::Switch: {
+			AST::SwitchNode* switchNode = (AST::SwitchNode*)node;
+
+			Type* type = visitExpression(switchNode->pred.get());
+			if (!type->isNumeric() || type->kind == TypeKind::Bool)
+				ctx.diag.error({ fsrc, switchNode->pred->line, switchNode->pred->column }, 3003,
+					"switch value must be an integer, got '%s'",
+					type->str().data()
+				);
+
+			tea::map<uint64_t, bool> seen;
+			for (const auto& caseNode : switchNode->cases) {
+				for (const auto& value : caseNode->values) {
+					visitExpression(value.get());
+
+					// negative values are folded into the literal by the parser and wrap around, codegen masks them to
+					// the switch type
+					const AST::LiteralNode* literal = (const AST::LiteralNode*)value.get();
+					uint64_t v = 0;
+					if (value->getEKind() == AST::ExprKind::Char)
+						v = (uint8_t)literal->value[0];
+					else if (value->getEKind() == AST::ExprKind::Int) {
+						// out of range, already reported by visitExpression
+						if (!literal->getInteger(v))
+							continue;
+					} else {
+						ctx.diag.error({ fsrc, value->line, value->column }, 3003, "case value must be an integer constant");
+						continue;
+					}
+
+					if (seen.contains(v))
+						ctx.diag.error({ fsrc, value->line, value->column }, 3007, "duplicate case value '%s'", literal->value.data());
+					seen[v] = true;
+				}
+
+				visitBlock(caseNode->body, inLoop);
+			}
+
+			if (switchNode->otherwise)
+				visitBlock(switchNode->otherwise->body, inLoop);
+		} break;
+
 		case AST::NodeKind::WhileLoop: {
 			AST::WhileLoopNode* loop = (AST::WhileLoopNode*)node;
 
+			visitLoopAttributes(loop, loop->attrParams);
 			visitExpression(loop->pred.get());
 			visitBlock(loop->body, true);
 		} break;
@@ -253,6 +296,7 @@ namespace tea::frontend {
 
 		case AST::NodeKind::ForLoop: {
 			AST::ForLoopNode* loop = (AST::ForLoopNode*)node;
+			visitLoopAttributes(loop, loop->attrParams);
 			if (loop->var) visitVariable(loop->var.get());
 			if (loop->pred) visitExpression(loop->pred.get());
 			if (loop->step) visitExpression(loop->step.get());
@@ -267,10 +311,48 @@ namespace tea::frontend {
 		}
 	}
 
+	void SemanticAnalyzer::visitLoopAttributes(const AST::Node* node, const tea::umap<AST::StatementAttribute, AST::ExpressionList>& attrParams) {
+		for (uint32_t attr = 0; attr < (uint32_t)AST::StatementAttribute::_count; attr++) {
+			if (!(node->extra & (1 << attr)))
+				continue;
+
+			const AST::ExpressionList* plist = attrParams.find((AST::StatementAttribute)(1 << attr));
+			uint32_t nparams = plist ? plist->size : 0;
+
+			switch ((AST::StatementAttribute)(1 << attr)) {
+			case AST::StatementAttribute::Unroll: {
+				if (nparams != 1) {
+					ctx.diag.error({ fsrc, node->line, node->column }, 3002, "argument count mismatch in attribute, expected 1, got %u", nparams);
+					break;
+				}
+
+				AST::LiteralNode* factor = (AST::LiteralNode*)(*plist)[0].get();
+				uint64_t value = 0;
+				if (factor->getEKind() != AST::ExprKind::Int || factor->value[0] == '-' || !factor->getInteger(value) || !value) {
+					ctx.diag.error({ fsrc, factor->line, factor->column }, 3003, "(attribute argument #1) unroll factor must be a positive integer constant");
+					break;
+				}
+
+				// codegen reads the factor back from the literal
+				if (value > AST::maxUnrollFactor)
+					factor->value = std::to_string(AST::maxUnrollFactor).c_str();
+			} break;
+
+			default:
+				break;
+			}
+		}
+	}
+
 	Type* SemanticAnalyzer::visitExpression(AST::ExpressionNode* node, bool isCallee) {
 		Type* type = ctx.types.Void();
 		switch (node->getEKind()) {
-		case AST::ExprKind::Int: type = ctx.types.Int(); break;
+		case AST::ExprKind::Int: {
+			uint64_t value = 0;
+			if (!((AST::LiteralNode*)node)->getInteger(value))
+				ctx.diag.error({ fsrc, node->line, node->column }, 3003, "integer literal '%s' is out of range", ((AST::LiteralNode*)node)->value.data());
+			type = ctx.types.Int();
+		} break;
 		case AST::ExprKind::Char: type = ctx.types.Char(); break;
 		case AST::ExprKind::Float: type = ctx.types.Float(); break;
 		case AST::ExprKind::String: type = ctx.types.String(); break;
@@ -614,6 +696,17 @@ namespace tea::frontend {
 						return r;
 			} break;
 
+			case AST::NodeKind::Switch: {
+				AST::SwitchNode* switchNode = (AST::SwitchNode*)node.get();
+				for (const auto& caseNode : switchNode->cases)
+					if (auto* r = findFirstReturn(caseNode->body))
+						return r;
+
+				if (switchNode->otherwise)
+					if (auto* r = findFirstReturn(switchNode->otherwise->body))
+						return r;
+			} break;
+
 			case AST::NodeKind::WhileLoop:
 				if (auto* r = findFirstReturn(((AST::WhileLoopNode*)node.get())->body))
 					return r;
@@ -54,6 +54,7 @@ namespace tea::frontend {
 		AST::ReturnNode* findFirstReturn(const AST::Tree& tree);
 		void visitStat(const frontend::AST::Node* node, bool inLoop = false);
 		void visitBlock(const frontend::AST::Tree& tree, bool inLoop = false);
+		void visitLoopAttributes(const AST::Node* node, const tea::umap<AST::StatementAttribute, AST::ExpressionList>& attrParams);
 
 		Type* visitExpression(frontend::AST::ExpressionNode* node, bool isCallee = false);
 	};
@@ -1,5 +1,8 @@
+#include <atomic>
+#include <thread>
 #include <fstream>
 #include <iostream>
+#include <algorithm>
 #include <filesystem>
 
 #include "argparse.h"
@@ -7,6 +10,23 @@
 
 namespace fs = std::filesystem;
 
+static void compileInput(tea::Context& ctx, const tea::args::Args& args, const char* input) {
+	tea::string outFile;
+
+	if (!args.outFile.empty() && args.inputs.size == 1)
+		outFile = args.outFile;
+	else {
+		fs::path path = std::string(input);
+		outFile = path.replace_extension(".o").string().c_str();
+	}
+
+	uint32_t fsrc = ctx.sources.load(input);
+	if (fsrc == tea::badid)
+		ctx.diag.error(TEA_NO_SOURCELOC, 2, "could not open file: %s", input);
+
+	tea::compile(ctx, fsrc, outFile, args.triple, args.flags, args.optLevel, args.pipeline);
+}
+
 int main(int argc, char** argv) {
 	tea::Context ctx;
 	try {
@@ -15,22 +35,68 @@ int main(int argc, char** argv) {
 		for (const char* p : args.importLookup)
 			ctx.importLookup.emplace(p);
 
-		for (const char* input : args.inputs) {
-			tea::string outFile;
+		if (args.run) {
+			tea::vector<uint32_t> fsrcs;
+			for (const char* input : args.inputs) {
+				uint32_t fsrc = ctx.sources.load(input);
+				if (fsrc == tea::badid)
+					ctx.diag.fatal(TEA_NO_SOURCELOC, 2, "could not open file: %s", input);
+				fsrcs.emplace(fsrc);
+			}
+
+			// the program sees itself as its first input
+			tea::vector<const char*> programArgs;
+			programArgs.emplace(args.inputs[0]);
+			for (const char* arg : args.programArgs)
+				programArgs.emplace(arg);
 
-			if (!args.outFile.empty() && args.inputs.size == 1)
-				outFile = args.outFile;
-			else {
-				fs::path path = std::string(input);
+			int result = tea::run(ctx, fsrcs, args.flags, args.optLevel, args.pipeline, (int)programArgs.size, programArgs.data);
+			ctx.diag.print();
+			return ctx.diag.hasError ? 1 : result;
+		}
+
+		if (args.wholeProgram) {
+			tea::vector<uint32_t> fsrcs;
+			for (const char* input : args.inputs) {
+				uint32_t fsrc = ctx.sources.load(input);
+				if (fsrc == tea::badid)
+					ctx.diag.error(TEA_NO_SOURCELOC, 2, "could not open file: %s", input);
+				fsrcs.emplace(fsrc);
+			}
+
+			tea::string outFile = args.outFile;
+			if (outFile.empty()) {
+				fs::path path = std::string(args.inputs[0]);
 				outFile = path.replace_extension(".o").string().c_str();
 			}
 
-			uint32_t fsrc = ctx.sources.load(input);
-			if (fsrc == tea::badid)
-				ctx.diag.error(TEA_NO_SOURCELOC, 2, "could not open file: %s", input);
+			tea::compileProgram(ctx, fsrcs, outFile, args.triple, args.flags, args.optLevel, args.pipeline);
+		} else if (args.jobs > 1 && args.inputs.size > 1) {
+			// every input gets a context of its own, their diagnostics are merged back in input order
+			tea::vector<std::unique_ptr<tea::Context>> jobs;
+			for (uint32_t i = 0; i < args.inputs.size; i++)
+				jobs.emplace(std::make_unique<tea::Context>(ctx));
 
-			tea::compile(ctx, fsrc, outFile, args.triple, args.flags, args.optLevel);
-		}
+			std::atomic<uint32_t> next = 0;
+			auto worker = [&] {
+				for (uint32_t i; (i = next++) < args.inputs.size;) {
+					tea::Context& job = *jobs[i];
+					try {
+						compileInput(job, args, args.inputs[i]);
+					} catch (const std::exception&) {}
+				}
+			};
+
+			tea::vector<std::thread> workers;
+			for (uint32_t i = 0; i < std::min(args.jobs, args.inputs.size); i++)
+				workers.emplace(worker);
+			for (auto& thread : workers)
+				thread.join();
+
+			for (const auto& job : jobs)
+				ctx.diag.merge(job->diag);
+		} else for (const char* input : args.inputs)
+			compileInput(ctx, args, input);
 
 	} catch (const std::exception&) {
 		ctx.diag.print();
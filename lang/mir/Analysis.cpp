@@ -0,0 +1,516 @@
+#include "Analysis.h"
+
+#include <algorithm>
+#include <cstring>
+
+#include "mir.h"
+
+namespace tea::mir {
+
+	// iterative depth first search, recursion would overflow the stack on large functions
+	static void computeRPO(uint32_t nodes, uint32_t root, const tea::vector<tea::vector<uint32_t>>& succs, tea::vector<uint32_t>& rpo) {
+		tea::vector<bool> visited(nodes, false);
+
+		tea::vector<uint32_t> post;
+		tea::vector<std::pair<uint32_t, uint32_t>> stack;
+		stack.emplace(root, 0u);
+		visited[root] = true;
+
+		while (!stack.empty()) {
+			uint32_t node = stack[stack.size - 1].first;
+			uint32_t next = stack[stack.size - 1].second;
+
+			if (next < succs[node].size) {
+				stack[stack.size - 1].second++;
+
+				uint32_t succ = succs[node][next];
+				if (!visited[succ]) {
+					visited[succ] = true;
+					stack.emplace(succ, 0u);
+				}
+			} else {
+				post.emplace(node);
+				stack.pop();
+			}
+		}
+
+		rpo.clear();
+		for (uint32_t i = post.size; i > 0; i--)
+			rpo.emplace(post[i - 1]);
+	}
+
+	ControlFlowGraph::ControlFlowGraph(const Function* func) {
+		uint32_t n = func->blocks.size;
+		for (uint32_t i = 0; i < n; i++) {
+			blocks.emplace(func->blocks[i].get());
+			indices[blocks[i]] = i;
+			succs.emplace();
+			preds.emplace();
+			rpoIndex.emplace(tea::badid);
+		}
+
+		for (uint32_t i = 0; i < n; i++) {
+			const Instruction* term = blocks[i]->getTerminator();
+			if (!term)
+				continue;
+
+			auto addEdge = [&](const Value* target) {
+				uint32_t succ = getIndex((const BasicBlock*)target);
+				if (succ == tea::badid || succs[i].find(succ))
+					return;
+				succs[i].emplace(succ);
+				preds[succ].emplace(i);
+			};
+
+			switch (term->op) {
+			case OpCode::Br:
+				addEdge(term->operands[0]);
+				break;
+			case OpCode::CondBr:
+				addEdge(term->operands[1]);
+				addEdge(term->operands[2]);
+				break;
+			case OpCode::Switch:
+				for (uint32_t t = 1; t < term->operands.size; t += 2)
+					addEdge(term->operands[t]);
+				break;
+			default:
+				break;
+			}
+		}
+
+		if (!n)
+			return;
+
+		computeRPO(n, 0, succs, rpo);
+		for (uint32_t i = 0; i < rpo.size; i++)
+			rpoIndex[rpo[i]] = i;
+	}
+
+	uint32_t ControlFlowGraph::getIndex(const BasicBlock* block) const {
+		const uint32_t* index = indices.find(block);
+		return index ? *index : tea::badid;
+	}
+
+	DominatorTree::DominatorTree(const ControlFlowGraph& cfg, bool post) {
+		uint32_t n = cfg.blocks.size;
+
+		// post-dominators are dominators of the reversed graph, rooted in a virtual exit node with index n
+		const tea::vector<tea::vector<uint32_t>>* succs = &cfg.succs;
+		const tea::vector<tea::vector<uint32_t>>* preds = &cfg.preds;
+		tea::vector<tea::vector<uint32_t>> reverseSuccs, reversePreds;
+
+		uint32_t nodes = n;
+		root = 0;
+		if (post) {
+			nodes = n + 1;
+			root = n;
+
+			reverseSuccs = cfg.preds;
+			reversePreds = cfg.succs;
+			reverseSuccs.emplace();
+			reversePreds.emplace();
+			for (uint32_t i = 0; i < n; i++) {
+				if (cfg.succs[i].empty()) {
+					reverseSuccs[n].emplace(i);
+					reversePreds[i].emplace(n);
+				}
+			}
+
+			succs = &reverseSuccs;
+			preds = &reversePreds;
+		}
+
+		idoms = tea::vector<uint32_t>(nodes, tea::badid);
+		children = tea::vector<tea::vector<uint32_t>>(nodes, {});
+		enter = tea::vector<uint32_t>(nodes, tea::badid);
+		exit = tea::vector<uint32_t>(nodes, tea::badid);
+
+		if (!n)
+			return;
+
+		tea::vector<uint32_t> rpo;
+		computeRPO(nodes, root, *succs, rpo);
+
+		tea::vector<uint32_t> order(nodes, tea::badid);
+		for (uint32_t i = 0; i < rpo.size; i++)
+			order[rpo[i]] = i;
+
+		auto intersect = [&](uint32_t a, uint32_t b) {
+			while (a != b) {
+				while (order[a] > order[b])
+					a = idoms[a];
+				while (order[b] > order[a])
+					b = idoms[b];
+			}
+			return a;
+		};
+
+		idoms[root] = root;
+		bool changed = true;
+		while (changed) {
+			changed = false;
+			for (uint32_t i = 1; i < rpo.size; i++) {
+				uint32_t node = rpo[i];
+
+				uint32_t idom = tea::badid;
+				for (uint32_t pred : (*preds)[node]) {
+					if (idoms[pred] == tea::badid)
+						continue;
+					idom = idom == tea::badid ? pred : intersect(pred, idom);
+				}
+
+				if (idom != idoms[node]) {
+					idoms[node] = idom;
+					changed = true;
+				}
+			}
+		}
+
+		for (uint32_t node : rpo)
+			if (node != root)
+				children[idoms[node]].emplace(node);
+
+		// number the tree so that a dominates b iff b's interval lies within a's
+		uint32_t counter = 0;
+		tea::vector<std::pair<uint32_t, uint32_t>> stack;
+		stack.emplace(root, 0u);
+		enter[root] = counter++;
+		while (!stack.empty()) {
+			uint32_t node = stack[stack.size - 1].first;
+			uint32_t next = stack[stack.size - 1].second;
+
+			if (next < children[node].size) {
+				stack[stack.size - 1].second++;
+
+				uint32_t child = children[node][next];
+				enter[child] = counter++;
+				stack.emplace(child, 0u);
+			} else {
+				exit[node] = counter++;
+				stack.pop();
+			}
+		}
+
+		idoms[root] = tea::badid;
+		if (post) {
+			for (uint32_t i = 0; i < n; i++)
+				if (idoms[i] == n)
+					idoms[i] = tea::badid;
+		}
+	}
+
+	uint32_t DominatorTree::getIdom(uint32_t block) const {
+		return idoms[block];
+	}
+
+	bool DominatorTree::dominates(uint32_t a, uint32_t b) const {
+		if (enter[a] == tea::badid || enter[b] == tea::badid)
+			return false;
+		return enter[a] <= enter[b] && exit[b] <= exit[a];
+	}
+
+	LoopNest::LoopNest(const ControlFlowGraph& cfg, const DominatorTree& domTree) {
+		uint32_t n = cfg.blocks.size;
+
+		innermost = tea::vector<uint32_t>(n, tea::badid);
+		tea::vector<uint32_t> marks(n, tea::badid);
+
+		// a header dominates every block of its loop and so comes before them in reverse postorder, which
+		// makes enclosing loops get discovered before the loops nested in them
+		tea::vector<uint32_t> worklist;
+		for (uint32_t header : cfg.rpo) {
+			Loop loop;
+			loop.header = header;
+			for (uint32_t pred : cfg.preds[header])
+				if (domTree.dominates(header, pred))
+					loop.latches.emplace(pred);
+
+			if (loop.latches.empty())
+				continue;
+
+			uint32_t index = loops.size;
+			marks[header] = index;
+			loop.blocks.emplace(header);
+
+			worklist = loop.latches;
+			while (!worklist.empty()) {
+				uint32_t block = worklist[worklist.size - 1];
+				worklist.pop();
+
+				if (marks[block] == index)
+					continue;
+				marks[block] = index;
+				loop.blocks.emplace(block);
+
+				for (uint32_t pred : cfg.preds[block])
+					if (marks[pred] != index && cfg.isReachable(pred))
+						worklist.emplace(pred);
+			}
+			std::sort(loop.blocks.begin() + 1, loop.blocks.end());
+
+			// the innermost loop containing the header so far is the closest enclosing one
+			loop.parent = innermost[header];
+			if (loop.parent != tea::badid) {
+				loop.depth = loops[loop.parent].depth + 1;
+				loops[loop.parent].children.emplace(index);
+			}
+
+			for (uint32_t block : loop.blocks)
+				innermost[block] = index;
+			loops.emplace(std::move(loop));
+		}
+	}
+
+	Liveness::Liveness(const Function* func, const ControlFlowGraph& cfg) {
+		uint32_t n = cfg.blocks.size;
+
+		// parameters are defined on entry
+		tea::map<const Value*, uint32_t> defBlocks;
+		for (const auto& param : func->params)
+			defBlocks[param.get()] = 0;
+		for (uint32_t b = 0; b < n; b++)
+			for (const auto& insn : cfg.blocks[b]->body)
+				if (insn.result)
+					defBlocks[insn.result.get()] = b;
+
+		// calls `fn(value, useBlock, isPhi)` for every value operand of `insn` in block `b`
+		auto forEachUse = [&](const Instruction& insn, uint32_t b, auto&& fn) {
+			switch (insn.op) {
+			case OpCode::Br:
+				return;
+			case OpCode::CondBr:
+			case OpCode::Switch:
+				fn(insn.operands[0], b, false);
+				return;
+			case OpCode::Phi:
+				for (uint32_t i = 1; i + 1 < insn.operands.size; i += 2) {
+					uint32_t pred = cfg.getIndex((const BasicBlock*)insn.operands[i + 1]);
+					if (pred != tea::badid)
+						fn(insn.operands[i], pred, true);
+				}
+				return;
+			default:
+				for (Value* op : insn.operands)
+					fn(op, b, false);
+				return;
+			}
+		};
+
+		for (uint32_t b = 0; b < n; b++) {
+			for (const auto& insn : cfg.blocks[b]->body) {
+				forEachUse(insn, b, [&](const Value* v, uint32_t useBlock, bool phi) {
+					const uint32_t* def = defBlocks.find(v);
+					if (!def || (*def == useBlock && !phi) || indices.contains(v))
+						return;
+					indices[v] = values.size;
+					values.emplace(v);
+				});
+			}
+		}
+
+		uint32_t words = (values.size + 63) / 64;
+		Bitset empty(words, 0);
+
+		// upward exposed uses, definitions and values flowing into successor phis
+		tea::vector<Bitset> uses(n, empty), defs(n, empty), phiUses(n, empty);
+		liveIn = tea::vector<Bitset>(n, empty);
+		liveOut = tea::vector<Bitset>(n, empty);
+
+		for (uint32_t b = 0; b < n; b++) {
+			for (const auto& insn : cfg.blocks[b]->body) {
+				forEachUse(insn, b, [&](const Value* v, uint32_t useBlock, bool phi) {
+					uint32_t bit = getIndex(v);
+					if (bit == tea::badid)
+						return;
+					if (phi)
+						phiUses[useBlock][bit / 64] |= 1ull << (bit % 64);
+					else if (!test(defs[b], bit))
+						uses[b][bit / 64] |= 1ull << (bit % 64);
+				});
+
+				uint32_t bit = insn.result ? getIndex(insn.result.get()) : tea::badid;
+				if (bit != tea::badid)
+					defs[b][bit / 64] |= 1ull << (bit % 64);
+			}
+		}
+
+		for (const auto& param : func->params) {
+			uint32_t bit = getIndex(param.get());
+			if (bit != tea::badid && n)
+				defs[0][bit / 64] |= 1ull << (bit % 64);
+		}
+
+		// backward dataflow, visiting blocks in postorder converges in a few rounds
+		tea::vector<uint32_t> order;
+		for (uint32_t i = cfg.rpo.size; i > 0; i--)
+			order.emplace(cfg.rpo[i - 1]);
+
+		bool changed = true;
+		while (changed) {
+			changed = false;
+			for (uint32_t b : order) {
+				Bitset& out = liveOut[b];
+				Bitset& in = liveIn[b];
+
+				for (uint32_t w = 0; w < words; w++) {
+					uint64_t o = phiUses[b][w];
+					for (uint32_t succ : cfg.succs[b])
+						o |= liveIn[succ][w];
+
+					uint64_t i = uses[b][w] | (o & ~defs[b][w]);
+					if (o != out[w] || i != in[w]) {
+						out[w] = o;
+						in[w] = i;
+						changed = true;
+					}
+				}
+			}
+		}
+	}
+
+	uint32_t Liveness::getIndex(const Value* v) const {
+		const uint32_t* index = indices.find(v);
+		return index ? *index : tea::badid;
+	}
+
+	// functions and globals `v` refers to, looking through constant arrays
+	static void collectReferences(const Value* v, tea::vector<const Value*>& refs) {
+		if (!v)
+			return;
+
+		if (v->kind == ValueKind::Function || v->kind == ValueKind::Global)
+			refs.emplace(v);
+		else if (v->kind == ValueKind::Constant && (ConstantKind)v->subclassData == ConstantKind::Array)
+			for (const Value* el : ((const ConstantArray*)v)->values)
+				collectReferences(el, refs);
+	}
+
+	CallGraph::CallGraph(const Module* module) {
+		for (const auto& value : module->body) {
+			if (value->kind != ValueKind::Function)
+				continue;
+
+			Function* func = (Function*)value.get();
+			indices[func] = nodes.size;
+			nodes.emplace()->func = func;
+		}
+
+		// functions and globals referenced by each function or global initializer
+		tea::map<const Value*, tea::vector<const Value*>> refs;
+		// a function used as anything but the callee of a call, directly or in a constant array, can be called
+		// through a pointer from anywhere
+		auto addRef = [&](const Value* from, const Value* to) {
+			tea::vector<const Value*>& list = refs[from];
+			uint32_t first = list.size;
+			collectReferences(to, list);
+
+			for (uint32_t i = first; i < list.size; i++)
+				if (list[i]->kind == ValueKind::Function)
+					nodes[*indices.find((const Function*)list[i])].addressTaken = true;
+		};
+
+		for (Node& node : nodes) {
+			for (const auto& block : node.func->blocks) {
+				for (auto& insn : block->body) {
+					if (insn.op == OpCode::Br || insn.op == OpCode::CondBr || insn.op == OpCode::Switch || insn.op == OpCode::Phi) {
+						if (insn.op == OpCode::CondBr || insn.op == OpCode::Switch)
+							addRef(node.func, insn.operands[0]);
+						for (uint32_t i = 1; insn.op == OpCode::Phi && i < insn.operands.size; i += 2)
+							addRef(node.func, insn.operands[i]);
+						continue;
+					}
+
+					for (uint32_t i = 0; i < insn.operands.size; i++) {
+						const Value* op = insn.operands[i];
+						if (insn.op != OpCode::Call || i != 0 || op->kind != ValueKind::Function) {
+							addRef(node.func, op);
+							continue;
+						}
+
+						refs[node.func].emplace(op);
+
+						Node& callee = nodes[*indices.find((const Function*)op)];
+						callee.callers.emplace(CallSite{ node.func, block.get(), &insn });
+						if (!node.callees.find(callee.func))
+							node.callees.emplace(callee.func);
+					}
+				}
+			}
+		}
+
+		tea::vector<const Value*> worklist;
+		for (const auto& value : module->body) {
+			const Value* v = value.get();
+			if (v->kind == ValueKind::Global)
+				addRef(v, ((const Global*)v)->initializer);
+
+			// declarations are defined elsewhere and only needed when something here refers to them
+			bool exported;
+			if (v->kind == ValueKind::Function) {
+				const Function* f = (const Function*)v;
+				exported = !f->blocks.empty() && (f->storage == StorageClass::Public || f->linkName || (f->name && !strcmp(f->name, "main")));
+			} else
+				exported = ((const Global*)v)->storage == StorageClass::Public;
+
+			if (exported) {
+				reachable[v] = true;
+				worklist.emplace(v);
+			}
+		}
+
+		while (!worklist.empty()) {
+			const Value* v = worklist[worklist.size - 1];
+			worklist.pop();
+
+			if (const auto* to = refs.find(v)) {
+				for (const Value* ref : *to) {
+					if (reachable.contains(ref))
+						continue;
+					reachable[ref] = true;
+					worklist.emplace(ref);
+				}
+			}
+		}
+	}
+
+	const CallGraph::Node* CallGraph::getNode(const Function* func) const {
+		const uint32_t* index = indices.find(func);
+		return index ? &nodes[*index] : nullptr;
+	}
+
+	const ControlFlowGraph& Function::getCFG() {
+		if (!analyses.cfg)
+			analyses.cfg = std::make_unique<ControlFlowGraph>(this);
+		return *analyses.cfg;
+	}
+
+	const DominatorTree& Function::getDominatorTree() {
+		if (!analyses.domTree)
+			analyses.domTree = std::make_unique<DominatorTree>(getCFG(), false);
+		return *analyses.domTree;
+	}
+
+	const DominatorTree& Function::getPostDominatorTree() {
+		if (!analyses.postDomTree)
+			analyses.postDomTree = std::make_unique<DominatorTree>(getCFG(), true);
+		return *analyses.postDomTree;
+	}
+
+	const LoopNest& Function::getLoopNest() {
+		if (!analyses.loops)
+			analyses.loops = std::make_unique<LoopNest>(getCFG(), getDominatorTree());
+		return *analyses.loops;
+	}
+
+	const Liveness& Function::getLiveness() {
+		if (!analyses.liveness)
+			analyses.liveness = std::make_unique<Liveness>(this, getCFG());
+		return *analyses.liveness;
+	}
+
+	void Function::invalidateAnalyses() {
+		analyses = AnalysisCache();
+	}
+
+} // namespace tea::mir
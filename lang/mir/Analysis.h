@@ -0,0 +1,197 @@
+#pragma once
+
+#include <memory>
+
+#include "core/tea.h"
+#include "core/map.h"
+#include "core/vector.h"
+
+namespace tea::mir {
+
+	class Value;
+	class BasicBlock;
+	class Function;
+	class Module;
+	struct Instruction;
+
+	// Blocks are referred to by their position in `Function::blocks` at the time an analysis was computed,
+	// so every analysis is only valid until the function's blocks or instructions change
+
+	class ControlFlowGraph {
+	public:
+		tea::vector<BasicBlock*> blocks;
+		tea::vector<tea::vector<uint32_t>> succs;
+		tea::vector<tea::vector<uint32_t>> preds;
+
+		// blocks reachable from the entry block in reverse postorder
+		tea::vector<uint32_t> rpo;
+
+		ControlFlowGraph(const Function* func);
+
+		/// <summary>
+		/// Get the index of `block`
+		/// </summary>
+		/// <returns>The index or `tea::badid` if the block isn't part of the function</returns>
+		uint32_t getIndex(const BasicBlock* block) const;
+
+		bool isReachable(uint32_t block) const { return rpoIndex[block] != tea::badid; }
+
+	private:
+		tea::map<const BasicBlock*, uint32_t> indices;
+		tea::vector<uint32_t> rpoIndex;
+	};
+
+	class DominatorTree {
+	public:
+		/// <summary>
+		/// Compute the (post-)dominator tree with the Cooper-Harvey-Kennedy algorithm. Post-dominators are rooted
+		/// in a virtual exit node that every block without successors leads to
+		/// </summary>
+		DominatorTree(const ControlFlowGraph& cfg, bool post);
+
+		/// <summary>
+		/// Get the immediate (post-)dominator of `block`
+		/// </summary>
+		/// <returns>The index of the immediate dominator, `tea::badid` for the root, unreachable blocks
+		/// and blocks only post-dominated by the virtual exit</returns>
+		uint32_t getIdom(uint32_t block) const;
+
+		/// <summary>
+		/// Check whether `a` (post-)dominates `b`, every block dominates itself
+		/// </summary>
+		bool dominates(uint32_t a, uint32_t b) const;
+
+		const tea::vector<uint32_t>& getChildren(uint32_t block) const { return children[block]; }
+
+	private:
+		uint32_t root;
+		tea::vector<uint32_t> idoms;
+		tea::vector<tea::vector<uint32_t>> children;
+
+		// preorder interval of every node in the tree for constant time dominance queries
+		tea::vector<uint32_t> enter;
+		tea::vector<uint32_t> exit;
+	};
+
+	struct Loop {
+		uint32_t header = 0;
+		uint32_t parent = tea::badid;
+		uint32_t depth = 1;
+
+		// blocks of the loop including nested loops, the header comes first
+		tea::vector<uint32_t> blocks;
+		// blocks with a back edge to the header
+		tea::vector<uint32_t> latches;
+		tea::vector<uint32_t> children;
+	};
+
+	class LoopNest {
+	public:
+		// outer loops come before the loops nested in them
+		tea::vector<Loop> loops;
+
+		/// <summary>
+		/// Find the natural loops of the function and how they nest
+		/// </summary>
+		LoopNest(const ControlFlowGraph& cfg, const DominatorTree& domTree);
+
+		/// <summary>
+		/// Get the innermost loop containing `block`
+		/// </summary>
+		/// <returns>The index into `loops` or `tea::badid` if the block isn't part of a loop</returns>
+		uint32_t getLoopFor(uint32_t block) const { return innermost[block]; }
+
+		uint32_t getDepth(uint32_t block) const { return innermost[block] == tea::badid ? 0 : loops[innermost[block]].depth; }
+
+	private:
+		tea::vector<uint32_t> innermost;
+	};
+
+	class Liveness {
+	public:
+		typedef tea::vector<uint64_t> Bitset;
+
+		// values live across block boundaries, the bit index of a value is its position here. Values only
+		// used in the block defining them are never live in or out of any block and don't get a bit
+		tea::vector<const Value*> values;
+
+		tea::vector<Bitset> liveIn;
+		tea::vector<Bitset> liveOut;
+
+		/// <summary>
+		/// Compute which values are live at the start and end of every block. A value used by a phi is
+		/// live out of the incoming block, not live into the phi's block
+		/// </summary>
+		Liveness(const Function* func, const ControlFlowGraph& cfg);
+
+		/// <summary>
+		/// Get the bit index of `v`
+		/// </summary>
+		/// <returns>The index or `tea::badid` if the value never crosses a block boundary</returns>
+		uint32_t getIndex(const Value* v) const;
+
+		bool isLiveIn(const Value* v, uint32_t block) const { return test(liveIn[block], getIndex(v)); }
+		bool isLiveOut(const Value* v, uint32_t block) const { return test(liveOut[block], getIndex(v)); }
+
+	private:
+		tea::map<const Value*, uint32_t> indices;
+
+		static bool test(const Bitset& set, uint32_t bit) {
+			return bit != tea::badid && (set[bit / 64] >> (bit % 64)) & 1;
+		}
+	};
+
+	class CallGraph {
+	public:
+		// call instructions move when their block grows, so call sites are only valid until the caller is changed
+		struct CallSite {
+			Function* caller = nullptr;
+			BasicBlock* block = nullptr;
+			Instruction* insn = nullptr;
+		};
+
+		struct Node {
+			Function* func = nullptr;
+			// distinct functions called directly
+			tea::vector<Function*> callees;
+			// every direct call of the function
+			tea::vector<CallSite> callers;
+			// the function is used as a value, so it may be called from anywhere
+			bool addressTaken = false;
+		};
+
+		// one node per function in module order
+		tea::vector<Node> nodes;
+
+		/// <summary>
+		/// Collect the direct calls between the functions of `module` and which functions and globals
+		/// can be reached from the public definitions and `main`
+		/// </summary>
+		CallGraph(const Module* module);
+
+		/// <summary>
+		/// Get the node of `func`
+		/// </summary>
+		/// <returns>The node or null if the function isn't part of the module</returns>
+		const Node* getNode(const Function* func) const;
+
+		/// <summary>
+		/// Check whether the function or global `v` is defined visibly outside of the module or referenced
+		/// by code or data that is
+		/// </summary>
+		bool isReachable(const Value* v) const { return reachable.contains(v); }
+
+	private:
+		tea::map<const Function*, uint32_t> indices;
+		tea::map<const Value*, bool> reachable;
+	};
+
+	// analyses of a function, computed on first use
+	struct AnalysisCache {
+		std::unique_ptr<ControlFlowGraph> cfg;
+		std::unique_ptr<DominatorTree> domTree;
+		std::unique_ptr<DominatorTree> postDomTree;
+		std::unique_ptr<LoopNest> loops;
+		std::unique_ptr<Liveness> liveness;
+	};
+}
@@ -7,8 +7,15 @@
 
 namespace tea::mir {
 
-	Instruction* Builder::ret(Value* val) {
+	Instruction* Builder::emplace() {
 		Instruction* insn = block->body.emplace();
+		insn->line = line;
+		insn->column = column;
+		return insn;
+	}
+
+	Instruction* Builder::ret(Value* val) {
+		Instruction* insn = emplace();
 		insn->op = OpCode::Ret;
 		if (val)
 			insn->operands.push(val);
@@ -16,7 +23,7 @@ namespace tea::mir {
 	}
 
 	Value* Builder::alloca_(Type* type, const char* name) {
-		Instruction* insn = block->body.emplace();
+		Instruction* insn = emplace();
 		insn->op = OpCode::Alloca;
 
 		insn->result = std::make_unique<Value>(ValueKind::Instruction, ctx.types.Pointer(type));
@@ -26,7 +33,7 @@ namespace tea::mir {
 	}
 
 	Instruction* Builder::store(Value* ptr, Value* val, bool volat) {
-		Instruction* insn = block->body.emplace();
+		Instruction* insn = emplace();
 		insn->op = OpCode::Store;
 		insn->operands.emplace(ptr);
 		insn->operands.emplace(val);
@@ -37,7 +44,7 @@ namespace tea::mir {
 	}
 
 	Value* Builder::load(Value* ptr, const char* name, bool volat) {
-		Instruction* insn = block->body.emplace();
+		Instruction* insn = emplace();
 		insn->op = OpCode::Load;
 		insn->operands.emplace(ptr);
 
@@ -101,7 +108,7 @@ namespace tea::mir {
 			}
 		}
 
-		Instruction* insn = block->body.emplace();
+		Instruction* insn = emplace();
 		insn->op = OpCode::Cast;
 		insn->operands.emplace(val);
 
@@ -128,7 +135,7 @@ namespace tea::mir {
 		if (op < OpCode::Not || op > OpCode::Shr || (rhs && !lhs->type->equals(rhs->type)))
 			return nullptr;
 
-		Instruction* insn = block->body.emplace();
+		Instruction* insn = emplace();
 		insn->op = op;
 		insn->operands.emplace(lhs);
 		insn->operands.emplace(rhs);
@@ -170,7 +177,7 @@ namespace tea::mir {
 			}
 			return nullptr;
 		} else {
-			Instruction* insn = block->body.emplace();
+			Instruction* insn = emplace();
 			insn->op = op;
 			insn->operands.emplace(lhs);
 			insn->operands.emplace(rhs);
@@ -183,7 +190,7 @@ namespace tea::mir {
 	}
 
 	Instruction* Builder::unreachable() {
-		Instruction* insn = block->body.emplace();
+		Instruction* insn = emplace();
 		insn->op = OpCode::Unreachable;
 		return insn;
 	}
@@ -196,7 +203,7 @@ namespace tea::mir {
 			((PointerType*)ptr->type)->pointee->kind == TypeKind::Struct
 		) {
 			Module* module = block->parent->parent;
-			Instruction* insn = block->body.emplace();
+			Instruction* insn = emplace();
 			insn->op = OpCode::GetElementPtr;
 			insn->operands.emplace(ptr);
 			insn->operands.emplace(ConstantNumber::get(module, 0, 32));
@@ -217,7 +224,7 @@ namespace tea::mir {
 		if (!ptr->type->isIndexable() || !indicies || !n || !name)
 			return nullptr;
 
-		Instruction* insn = block->body.emplace();
+		Instruction* insn = emplace();
 		insn->op = OpCode::GetElementPtr;
 		insn->operands.emplace(ptr);
 
@@ -238,7 +245,7 @@ namespace tea::mir {
 	}
 
 	Instruction* Builder::br(BasicBlock* b, bool change) {
-		Instruction* insn = block->body.emplace();
+		Instruction* insn = emplace();
 		insn->op = OpCode::Br;
 		insn->operands.emplace((Value*)b);
 
@@ -253,7 +260,7 @@ namespace tea::mir {
 	}
 
 	Value* Builder::call(Value* func, Value** args, uint32_t n, const char* name) {
-		Instruction* insn = block->body.emplace();
+		Instruction* insn = emplace();
 		insn->op = OpCode::Call;
 
 		insn->operands.emplace(func);
@@ -301,7 +308,7 @@ namespace tea::mir {
 			default: break;
 			}
 		} else {
-			Instruction* insn = block->body.emplace();
+			Instruction* insn = emplace();
 			insn->op = OpCode::ICmp;
 			insn->operands.emplace(lhs);
 			insn->operands.emplace(rhs);
@@ -335,7 +342,7 @@ namespace tea::mir {
 			default: return nullptr;
 			}
 		} else {
-			Instruction* insn = block->body.emplace();
+			Instruction* insn = emplace();
 			insn->op = OpCode::FCmp;
 			insn->operands.emplace(lhs);
 			insn->operands.emplace(rhs);
@@ -349,11 +356,43 @@ namespace tea::mir {
 		return nullptr;
 	}
 
+	Value* Builder::phi(Type* type, Value** values, BasicBlock** blocks, uint32_t n, const char* name) {
+		Instruction* insn = emplace();
+		insn->op = OpCode::Phi;
+
+		insn->operands.emplace((Value*)type);
+		for (uint32_t i = 0; i < n; i++) {
+			insn->operands.emplace(values[i]);
+			insn->operands.emplace((Value*)blocks[i]);
+		}
+
+		insn->result = std::make_unique<Value>(ValueKind::Instruction, type);
+		insn->result->name = block->scope.add(name);
+
+		return insn->result.get();
+	}
+
+	Value* Builder::select(Value* cond, Value* truthy, Value* falsy, const char* name) {
+		if (cond->type->kind != TypeKind::Bool || truthy->type->kind != falsy->type->kind || !truthy->type->equals(falsy->type))
+			return nullptr;
+
+		Instruction* insn = emplace();
+		insn->op = OpCode::Select;
+		insn->operands.emplace(cond);
+		insn->operands.emplace(truthy);
+		insn->operands.emplace(falsy);
+
+		insn->result = std::make_unique<Value>(ValueKind::Instruction, truthy->type);
+		insn->result->name = block->scope.add(name);
+
+		return insn->result.get();
+	}
+
 	Instruction* Builder::cbr(Value* pred, BasicBlock* truthy, BasicBlock* falsy) {
 		if (pred->type->kind != TypeKind::Bool)
 			return nullptr;
 
-		Instruction* insn = block->body.emplace();
+		Instruction* insn = emplace();
 		insn->op = OpCode::CondBr;
 		insn->operands.emplace(pred);
 		insn->operands.emplace((Value*)truthy);
@@ -362,4 +401,20 @@ namespace tea::mir {
 		return insn;
 	}
 
+	Instruction* Builder::switch_(Value* val, BasicBlock* otherwise, Value** cases, BasicBlock** targets, uint32_t n) {
+		if (!val->type->isNumeric() || val->type->kind == TypeKind::Bool)
+			return nullptr;
+
+		Instruction* insn = emplace();
+		insn->op = OpCode::Switch;
+		insn->operands.emplace(val);
+		insn->operands.emplace((Value*)otherwise);
+		for (uint32_t i = 0; i < n; i++) {
+			insn->operands.emplace(cases[i]);
+			insn->operands.emplace((Value*)targets[i]);
+		}
+
+		return insn;
+	}
+
 } // namespace tea::mir
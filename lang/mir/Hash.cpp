@@ -0,0 +1,270 @@
+#include "mir.h"
+
+#include <cstring>
+#include <filesystem>
+
+#include "core/map.h"
+
+// Structural hashing
+//
+// The hash covers everything the backends read from the module and nothing that depends on where it lives
+// in memory: values defined in the module are numbered in the order they're defined in, functions and
+// globals are named by their symbol and constants are hashed by contents. Value names inside functions
+// don't reach the output and are left out, so are source locations unless debug info is emitted
+
+namespace tea::mir {
+
+	class Hasher {
+		const Module* module;
+		bool locations;
+
+		uint64_t state = 0xcbf29ce484222325ull;
+
+		// values and blocks local to the function being hashed
+		tea::map<const void*, uint64_t> locals;
+		// structs being hashed, a struct reached from its own body is only hashed by name
+		tea::vector<const StructType*> structs;
+
+		void add(uint64_t v) {
+			// FNV-1a over the bytes, mixed once more so neighbouring values spread
+			for (int i = 0; i < 8; i++) {
+				state ^= (v >> (i * 8)) & 0xff;
+				state *= 0x100000001b3ull;
+			}
+			state ^= state >> 29;
+		}
+
+		void add(const char* str) {
+			if (!str) {
+				add((uint64_t)0);
+				return;
+			}
+
+			size_t length = strlen(str);
+			add((uint64_t)length + 1);
+			for (size_t i = 0; i < length; i++) {
+				state ^= (uint8_t)str[i];
+				state *= 0x100000001b3ull;
+			}
+		}
+
+		void add(const Type* type) {
+			if (!type) {
+				add((uint64_t)0);
+				return;
+			}
+
+			add(((uint64_t)type->kind + 1) | (uint64_t)type->constant << 8 | (uint64_t)type->sign << 9 | (uint64_t)type->extra << 32);
+
+			switch (type->kind) {
+			case TypeKind::Pointer:
+				add(((const PointerType*)type)->pointee);
+				break;
+			case TypeKind::Array:
+				add(((const ArrayType*)type)->elementType);
+				break;
+			case TypeKind::Function: {
+				const FunctionType* ftype = (const FunctionType*)type;
+				add(ftype->returnType);
+				add((uint64_t)ftype->params.size);
+				for (const Type* param : ftype->params)
+					add(param);
+				break;
+			}
+			case TypeKind::Struct: {
+				const StructType* st = (const StructType*)type;
+				add(st->name);
+
+				for (const StructType* it : structs)
+					if (it == st)
+						return;
+
+				structs.emplace(st);
+				add((uint64_t)st->body.size);
+				for (const Type* field : st->body)
+					add(field);
+				structs.pop();
+				break;
+			}
+			default:
+				break;
+			}
+		}
+
+		void add(const Value* value) {
+			if (!value) {
+				add((uint64_t)0);
+				return;
+			}
+
+			add((uint64_t)value->kind + 1);
+			switch (value->kind) {
+			case ValueKind::Function:
+			case ValueKind::Global:
+				// unique within the module
+				add(value->name);
+				break;
+
+			case ValueKind::Parameter:
+			case ValueKind::Instruction:
+				if (auto* it = locals.find(value))
+					add(*it);
+				else
+					add(~0ull);
+				break;
+
+			case ValueKind::Constant:
+				add(value->type);
+				add((uint64_t)value->subclassData);
+				switch ((ConstantKind)value->subclassData) {
+				case ConstantKind::Number:
+					add(((const ConstantNumber*)value)->getInteger());
+					break;
+				case ConstantKind::String:
+					add(((const ConstantString*)value)->value.data());
+					break;
+				case ConstantKind::Array:
+					add((uint64_t)((const ConstantArray*)value)->values.size);
+					for (const Value* element : ((const ConstantArray*)value)->values)
+						add(element);
+					break;
+				case ConstantKind::Pointer:
+					add((uint64_t)((const ConstantPointer*)value)->value);
+					break;
+				}
+				break;
+
+			case ValueKind::Null:
+				add(value->type);
+				break;
+			}
+		}
+
+		void addBlock(const void* block) {
+			if (auto* it = locals.find(block))
+				add(*it);
+			else
+				add(~0ull);
+		}
+
+		void add(const Instruction& insn) {
+			add((uint64_t)insn.op | (uint64_t)insn.extra << 32);
+			add((uint64_t)insn.operands.size);
+
+			// some operands are blocks or types in disguise
+			for (uint32_t i = 0; i < insn.operands.size; i++) {
+				const Value* operand = insn.operands[i];
+				switch (insn.op) {
+				case OpCode::Br:
+					addBlock(operand);
+					break;
+				case OpCode::CondBr:
+					if (i == 0)
+						add(operand);
+					else
+						addBlock(operand);
+					break;
+				case OpCode::Switch:
+					if (i % 2 == 0)
+						add(operand);
+					else
+						addBlock(operand);
+					break;
+				case OpCode::Phi:
+					if (i == 0)
+						add((const Type*)operand);
+					else if (i % 2)
+						add(operand);
+					else
+						addBlock(operand);
+					break;
+				default:
+					add(operand);
+					break;
+				}
+			}
+
+			if (insn.result) {
+				add(insn.result->type);
+				add((uint64_t)insn.result->kind);
+			} else
+				add((uint64_t)0);
+
+			if (locations) {
+				add((uint64_t)insn.line);
+				add((uint64_t)insn.column);
+			}
+		}
+
+		void add(const Function* func) {
+			add(func->name);
+			add(func->linkName);
+			add(func->type);
+			add((uint64_t)func->storage | (uint64_t)func->cc << 8 | (uint64_t)func->subclassData << 32);
+			add((uint64_t)func->inferred);
+			add(func->nonnullParams);
+
+			if (locations) {
+				add(func->fsrc == badid ? nullptr : std::filesystem::absolute(module->ctx.sources.pathof(func->fsrc).data()).string().c_str());
+				add((uint64_t)func->line);
+			}
+
+			locals.clear();
+
+			uint64_t next = 0;
+			for (const auto& param : func->params)
+				locals.insert(param.get(), next++);
+			for (const auto& block : func->blocks)
+				locals.insert(block.get(), next++);
+
+			// results are numbered up front, phis may use them before they're defined
+			for (const auto& block : func->blocks)
+				for (const auto& insn : block->body)
+					if (insn.result)
+						locals.insert(insn.result.get(), next++);
+
+			add((uint64_t)func->blocks.size);
+			for (const auto& block : func->blocks) {
+				add((uint64_t)block->body.size);
+				add((uint64_t)block->unrollHint);
+				for (const auto& insn : block->body)
+					add(insn);
+			}
+		}
+
+		void add(const Global* global) {
+			add(global->name);
+			add(global->linkName);
+			add(global->type);
+			add((uint64_t)global->storage | (uint64_t)global->subclassData << 32);
+			add(global->initializer);
+		}
+
+	public:
+		Hasher(const Module* module, bool locations) : module(module), locations(locations) {
+		}
+
+		uint64_t hash() {
+			add(module->source.data());
+			add(module->triple.data());
+			add((uint64_t)module->dl.endian | (uint64_t)module->dl.maxNativeBytes << 8);
+
+			add((uint64_t)module->body.size);
+			for (const auto& value : module->body) {
+				if (value->kind == ValueKind::Function)
+					add((const Function*)value.get());
+				else if (value->kind == ValueKind::Global)
+					add((const Global*)value.get());
+				else
+					add(value.get());
+			}
+
+			return state;
+		}
+	};
+
+	uint64_t Module::hash(bool locations) const {
+		return Hasher(this, locations).hash();
+	}
+
+} // namespace tea::mir
@@ -0,0 +1,189 @@
+#include "mir.h"
+
+#include "core/tea.h"
+#include "mir/passes/utils.h"
+
+// Module linking
+//
+// Public values are matched by the symbol they are emitted under: their link name, or their name with `::`
+// replaced by `_` (see LLVMLowering). A declaration takes the definition of the same symbol from the other
+// module and its uses are redirected to it, two definitions of one symbol are an error. Names stay unique
+// within the module, values whose symbol doesn't depend on their name are renamed when theirs is taken
+
+namespace tea::mir {
+
+	static const char* getLinkName(const Value* value) {
+		return value->kind == ValueKind::Function ? ((const Function*)value)->linkName : ((const Global*)value)->linkName;
+	}
+
+	static bool isPublic(const Value* value) {
+		if (value->kind == ValueKind::Function)
+			return ((const Function*)value)->storage == StorageClass::Public;
+		return ((const Global*)value)->storage == StorageClass::Public;
+	}
+
+	static bool isDefinition(const Value* value) {
+		return value->kind != ValueKind::Function || !((const Function*)value)->blocks.empty();
+	}
+
+	static tea::string getSymbol(const Value* value) {
+		if (const char* linkName = getLinkName(value))
+			return linkName;
+
+		std::string symbol = value->name;
+		for (size_t p = 0; (p = symbol.find("::", p)) != std::string::npos; p += 1)
+			symbol.replace(p, 2, "_");
+		return symbol.c_str();
+	}
+
+	// exact, unlike Type::equals which lets any numeric type stand in for another. Symbols that only agree
+	// that way would be called with the wrong ABI
+	static bool sameType(const Type* a, const Type* b) {
+		if (a == b)
+			return true;
+		if (a->kind != b->kind)
+			return false;
+
+		switch (a->kind) {
+		case TypeKind::Pointer:
+			return sameType(a->getElementType(), b->getElementType());
+
+		case TypeKind::Array:
+			return a->extra == b->extra && sameType(a->getElementType(), b->getElementType());
+
+		case TypeKind::Function: {
+			const FunctionType* fa = (const FunctionType*)a;
+			const FunctionType* fb = (const FunctionType*)b;
+			if (fa->extra != fb->extra || fa->params.size != fb->params.size || !sameType(fa->returnType, fb->returnType))
+				return false;
+
+			for (uint32_t i = 0; i < fa->params.size; i++)
+				if (!sameType(fa->params[i], fb->params[i]))
+					return false;
+			return true;
+		}
+
+		case TypeKind::Struct:
+			return false;
+
+		default:
+			return true;
+		}
+	}
+
+	// redirect `value` and, through constant arrays of any depth, every value it refers to
+	static void remapConstant(Value*& value, const ValueMap& vmap) {
+		if (Value* const* it = vmap.find(value)) {
+			value = *it;
+			return;
+		}
+
+		if (value->kind == ValueKind::Constant && (ConstantKind)value->subclassData == ConstantKind::Array)
+			for (Value*& element : ((ConstantArray*)value)->values)
+				remapConstant(element, vmap);
+	}
+
+	class Linker {
+		Module* module;
+		tea::map<tea::string, Value*> names;
+		tea::map<tea::string, Value*> symbols;
+		ValueMap vmap;
+
+	public:
+		Linker(Module* module) : module(module) {
+			for (const auto& value : module->body) {
+				names[value->name] = value.get();
+				if (isPublic(value.get()))
+					symbols[getSymbol(value.get())] = value.get();
+			}
+		}
+
+		void link(Module* other) {
+			for (auto& owned : other->body) {
+				Value* value = owned.get();
+
+				Value** existing = isPublic(value) ? symbols.find(getSymbol(value)) : nullptr;
+				if (existing && !resolve(*existing, owned))
+					continue;
+
+				claimName(value);
+				if (value->kind == ValueKind::Function)
+					((Function*)value)->parent = module;
+
+				if (existing)
+					*existing = value;
+				else {
+					if (isPublic(value))
+						symbols[getSymbol(value)] = value;
+					module->body.emplace(std::move(owned));
+				}
+			}
+
+			// a declaration may have been resolved to one that was replaced by a definition later
+			for (auto& [from, to] : vmap)
+				while (Value** next = vmap.find(to))
+					to = *next;
+
+			for (const auto& value : module->body) {
+				if (value->kind == ValueKind::Function) {
+					for (const auto& block : ((Function*)value.get())->blocks)
+						remapOperands(block.get(), vmap, {});
+				} else if (Global* g = (Global*)value.get(); g->initializer)
+					remapConstant(g->initializer, vmap);
+			}
+		}
+
+	private:
+		// merge `owned` with the value of the same symbol, true if `owned` took its place
+		bool resolve(Value* existing, std::unique_ptr<Value>& owned) {
+			Value* value = owned.get();
+			tea::string symbol = getSymbol(value);
+
+			if (existing->kind != value->kind || !sameType(existing->type, value->type)) {
+				module->ctx.diag.error(TEA_NO_SOURCELOC, 4006, "conflicting declarations of '%s'", symbol.data());
+				return false;
+			}
+
+			if (isDefinition(existing) && isDefinition(value)) {
+				module->ctx.diag.error(TEA_NO_SOURCELOC, 4007, "duplicate definition of '%s'", symbol.data());
+				return false;
+			}
+
+			if (!isDefinition(value)) {
+				vmap[value] = existing;
+				return false;
+			}
+
+			// the definition takes the declaration's place, the declaration stays behind in the linked module
+			vmap[existing] = value;
+			names.erase(existing->name);
+			for (auto& slot : module->body) {
+				if (slot.get() == existing) {
+					std::swap(slot, owned);
+					break;
+				}
+			}
+			return true;
+		}
+
+		void claimName(Value* value) {
+			Value** taken = names.find(value->name);
+			if (taken && *taken != value) {
+				// if neither could be renamed they would have had the same symbol
+				Value* renamed = !isPublic(value) || getLinkName(value) ? value : *taken;
+				renamed->name = module->scope.add(renamed->name);
+				names[renamed->name] = renamed;
+			} else
+				module->scope.add(value->name, false);
+
+			names[value->name] = value;
+		}
+	};
+
+	void Module::link(std::unique_ptr<Module> other) {
+		Linker linker(this);
+		linker.link(other.get());
+		linked.emplace(std::move(other));
+	}
+
+} // namespace tea::mir
@@ -10,8 +10,9 @@ namespace tea::mir {
 		"add", "sub", "mul", "div", "mod",
 		"not", "and", "or", "xor", "shl", "shr",
 		NULL, NULL,
+		"select",
 		"load", "store", NULL, NULL,
-		NULL, NULL, "ret", "phi",
+		NULL, NULL, NULL, "ret", "phi",
 		NULL,
 		"nop", NULL, "unreachable"
 	};
@@ -164,12 +165,35 @@ namespace tea::mir {
 			dump(insn->operands[1]);
 			break;
 
+		case OpCode::Phi:
+			printf("%%%s = phi %s ", insn->result->name, ((Type*)insn->operands[0])->str().data());
+			for (uint32_t i = 1; i + 1 < insn->operands.size; i += 2) {
+				if (i > 1) {
+					putchar(','); putchar(' ');
+				}
+				putchar('[');
+				dump(insn->operands[i]);
+				printf(", %%%s]", ((BasicBlock*)insn->operands[i + 1])->name);
+			}
+			break;
+
 		case OpCode::CondBr:
 			fputs("cbr ", stdout);
 			dump(insn->operands[0]);
 			printf(", %%%s, %%%s", ((BasicBlock*)insn->operands[1])->name, ((BasicBlock*)insn->operands[2])->name);
 			break;
 
+		case OpCode::Switch:
+			fputs("switch ", stdout);
+			dump(insn->operands[0]);
+			printf(", %%%s", ((BasicBlock*)insn->operands[1])->name);
+			for (uint32_t i = 2; i + 1 < insn->operands.size; i += 2) {
+				fputs(", [", stdout);
+				dump(insn->operands[i]);
+				printf(", %%%s]", ((BasicBlock*)insn->operands[i + 1])->name);
+			}
+			break;
+
 		default:
 		_default:
 			if (insn->result)
@@ -100,4 +100,8 @@ namespace tea::mir {
 		return blocks.emplace(std::make_unique<BasicBlock>(scope.add(name), this))->get();
 	}
 
+	BasicBlock* Function::insertBlock(uint32_t at, const tea::string& name) {
+		return blocks.emplace_at(at, std::make_unique<BasicBlock>(scope.add(name), this))->get();
+	}
+
 } // namespace tea::mir
@@ -3,6 +3,7 @@
 #include <memory>
 
 #include "mir/Scope.h"
+#include "mir/Analysis.h"
 #include "core/context.h"
 #include "frontend/parser/AST.h"
 
@@ -23,11 +24,14 @@ namespace tea::mir {
 		// Comparison
 		ICmp, FCmp,
 
+		// Selection
+		Select,
+
 		// Memory
 		Load, Store, Alloca, GetElementPtr,
 
 		// Control flow
-		Br, CondBr, Ret, Phi,
+		Br, CondBr, Switch, Ret, Phi,
 
 		// Functions
 		Call,
@@ -76,6 +80,10 @@ namespace tea::mir {
 		tea::vector<Value*> operands;
 		std::unique_ptr<Value> result;
 
+		// source location the instruction was generated for, 0 if it has none of its own
+		uint32_t line = 0;
+		uint32_t column = 0;
+
 		Instruction()
 			: op(OpCode::Nop), extra(0), result(nullptr) {
 		}
@@ -84,6 +92,22 @@ namespace tea::mir {
 	class Module;
 	class Function;
 
+	// facts about a function proven by `inferAttributes`, lowered to the matching LLVM attributes
+	enum class InferredAttribute : uint32_t {
+		// touches no memory its callers can see
+		ReadNone = 1 << 0,
+		// only reads memory its callers can see
+		ReadOnly = 1 << 1,
+		// only touches memory its pointer parameters point to
+		ArgMemOnly = 1 << 2,
+		// can't reach `except::throw`
+		NoUnwind = 1 << 3,
+		// always returns, it has no loops and only calls functions that always return
+		WillReturn = 1 << 4,
+		// the returned pointer is a fresh allocation nothing else refers to
+		NoAliasReturn = 1 << 5
+	};
+
 	class BasicBlock {
 	public:
 		Scope scope;
@@ -92,6 +116,9 @@ namespace tea::mir {
 		Function* parent = nullptr;
 		const char* name = nullptr;
 
+		// requested unroll factor if this block is a loop header (0 = let the optimizer decide, 1 = never unroll)
+		uint32_t unrollHint = 0;
+
 		BasicBlock(const char* name, Function* parent)
 			: name(name), parent(parent) {
 		}
@@ -105,6 +132,7 @@ namespace tea::mir {
 			case OpCode::Br:
 			case OpCode::Ret:
 			case OpCode::CondBr:
+			case OpCode::Switch:
 			case OpCode::Unreachable:
 				return insn;
 			default:
@@ -215,6 +243,14 @@ namespace tea::mir {
 		Module* parent = nullptr;
 		const char* linkName = nullptr;
 
+		// source file and line of the definition, for debug info
+		uint32_t fsrc = badid;
+		uint32_t line = 0;
+
+		// `InferredAttribute`s, and a bit for each parameter that is never null
+		uint32_t inferred = 0;
+		uint64_t nonnullParams = 0;
+
 		Function(StorageClass storage, tea::FunctionType* type, Module* parent)
 			: Value(ValueKind::Function, type), storage(storage), parent(parent), cc(CallingConvention::Auto) {
 		};
@@ -224,10 +260,47 @@ namespace tea::mir {
 		bool hasAttribute(FunctionAttribute attr) const { return subclassData & (uint32_t)attr; };
 		void removeAttribute(FunctionAttribute attr) { subclassData &= ~(uint32_t)attr; };
 
+		bool hasInferred(InferredAttribute attr) const { return inferred & (uint32_t)attr; };
+		bool isNonNull(uint32_t param) const { return param < 64 && (nonnullParams >> param) & 1; };
+
 		BasicBlock* appendBlock(const tea::string& name);
+		BasicBlock* insertBlock(uint32_t at, const tea::string& name);
 
 		Value* getParam(uint32_t i) const { return params[i].get(); }
 		BasicBlock* getBlock(uint32_t i) { return blocks[i].get(); }
+
+		/// <summary>
+		/// Get the successor and predecessor lists of every block, computed on first use
+		/// </summary>
+		const ControlFlowGraph& getCFG();
+
+		/// <summary>
+		/// Get the dominator tree rooted in the entry block, computed on first use
+		/// </summary>
+		const DominatorTree& getDominatorTree();
+
+		/// <summary>
+		/// Get the post-dominator tree, computed on first use
+		/// </summary>
+		const DominatorTree& getPostDominatorTree();
+
+		/// <summary>
+		/// Get the natural loops and how they nest, computed on first use
+		/// </summary>
+		const LoopNest& getLoopNest();
+
+		/// <summary>
+		/// Get the values live into and out of every block, computed on first use
+		/// </summary>
+		const Liveness& getLiveness();
+
+		/// <summary>
+		/// Drop every cached analysis, must be called once blocks or instructions were changed
+		/// </summary>
+		void invalidateAnalyses();
+
+	private:
+		AnalysisCache analyses;
 	};
 
 	class Global : public Value {
@@ -271,12 +344,27 @@ namespace tea::mir {
 
 		tea::umap<size_t, std::unique_ptr<ConstantPointer>> ptrConst;
 
+		// modules linked into this one, they still own the constants and names their values use
+		tea::vector<std::unique_ptr<Module>> linked;
+
 		Module(tea::Context& ctx, const tea::string& source) : ctx(ctx), source(source) {
 		}
 
 		Function* addFunction(const tea::string& name, tea::FunctionType* ftype);
 		Global* addGlobal(const tea::string& name, Type* type, Value* initializer);
 
+		/// <summary>
+		/// Move the functions and globals of `other` into this module, resolving declarations of either module with
+		/// the other's definitions. Private values are renamed if their name is taken
+		/// </summary>
+		void link(std::unique_ptr<Module> other);
+
+		/// <summary>
+		/// Hash the structure of the module, equal for modules the backends lower to the same code and stable
+		/// across runs. Instruction and function source locations are only included if `locations` is set
+		/// </summary>
+		uint64_t hash(bool locations) const;
+
 		Global* getNamedGlobal(const tea::string& name) const;
 		Function* getNamedFunction(const tea::string& name) const;
 
@@ -288,8 +376,14 @@ namespace tea::mir {
 		tea::Context& ctx;
 		BasicBlock* block = nullptr;
 
+		// source location stamped on every emitted instruction
+		uint32_t line = 0;
+		uint32_t column = 0;
+
 		Builder(tea::Context& ctx) : ctx(ctx) {};
 
+		Instruction* emplace();
+
 		Instruction* unreachable();
 		Instruction* ret(Value* val);
 		Value* globalString(const tea::string& str);
@@ -303,10 +397,13 @@ namespace tea::mir {
 		Value* binop(OpCode op, Value* lhs, Value* rhs, const char* name);
 		Value* arithm(OpCode op, Value* lhs, Value* rhs, const char* name);
 		Instruction* cbr(Value* pred, BasicBlock* truthy, BasicBlock* falsy);
+		Instruction* switch_(Value* val, BasicBlock* otherwise, Value** cases, BasicBlock** targets, uint32_t n);
 		Value* call(Value* func, Value** args, uint32_t n, const char* name);
 		Value* gep(Value* ptr, Value** indicies, uint32_t n, const char* name);
 		Value* icmp(ICmpPredicate pred, Value* lhs, Value* rhs, const char* name);
 		Value* fcmp(FCmpPredicate pred, Value* lhs, Value* rhs, const char* name);
+		Value* select(Value* cond, Value* truthy, Value* falsy, const char* name);
+		Value* phi(Type* type, Value** values, BasicBlock** blocks, uint32_t n, const char* name);
 	};
 
 } // namespace tea::mir
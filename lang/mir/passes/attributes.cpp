@@ -0,0 +1,481 @@
+#include "passes.h"
+
+#include <bit>
+#include <cstdio>
+#include <cstring>
+
+#include "core/tea.h"
+#include "mir/passes/escape.h"
+
+// Function attribute inference
+//
+// Works out what a call of each function can do, so the backend can tell LLVM and let it hoist, merge and
+// drop calls like other instructions instead of treating them as opaque:
+//
+//   readnone, readonly     no loads or stores through pointers from outside the function, or only loads
+//   argmemonly             memory is only touched through pointer parameters
+//   nounwind               `except::throw` can't be reached
+//   willreturn             no loops, and only calls to functions that always return
+//   nonnull                `this`, and string parameters of private functions only ever given non-null strings
+//   noalias (return)       `memory::alloc`, and functions only returning what such a function allocated
+//
+// Memory effects and throwing start out empty for every definition and grow with those of the callees until
+// nothing changes, so recursion doesn't make a function look worse than it is. The other attributes go the
+// opposite way: a function only gets them once its callees and callers have shown it, which leaves recursion out.
+// Declarations are opaque and may touch any memory, only the `except` library is assumed to throw.
+//
+// Locals are looked through: the value loaded from a slot whose address never escapes and that is only ever
+// assigned one value (like the home slot of a parameter) is that value
+
+namespace tea::mir {
+
+	// loads and casts followed to find where a value comes from
+	static constexpr uint32_t maxDepth = 16;
+
+	// what a call of a function may do
+	enum Effect : uint8_t {
+		ReadArgument = 1 << 0,
+		WriteArgument = 1 << 1,
+		ReadOther = 1 << 2,
+		WriteOther = 1 << 3,
+		Throws = 1 << 4,
+
+		ArgumentMemory = ReadArgument | WriteArgument,
+		OtherMemory = ReadOther | WriteOther,
+		AnyMemory = ArgumentMemory | OtherMemory,
+		AnyEffect = AnyMemory | Throws
+	};
+
+	// where a pointer points, the frame of the function isn't visible to its callers
+	enum class Origin {
+		Local,
+		Argument,
+		Other
+	};
+
+	class AttributeInference {
+		struct FunctionInfo {
+			Function* func = nullptr;
+			std::unique_ptr<EscapeAnalysis> escape;
+			// the instruction defining every result
+			tea::map<const Value*, const Instruction*> defs;
+
+			uint8_t effects = 0;
+			bool willReturn = false;
+			bool noAliasReturn = false;
+		};
+
+		CallGraph graph;
+		// parallel to the nodes of `graph`
+		tea::vector<FunctionInfo> infos;
+
+	public:
+		uint32_t inferred = 0;
+
+		AttributeInference(const Module* module) : graph(module) {
+		}
+
+		void run() {
+			for (const CallGraph::Node& node : graph.nodes) {
+				FunctionInfo* info = infos.emplace();
+				info->func = node.func;
+				info->func->inferred = 0;
+				info->func->nonnullParams = 0;
+
+				if (isDefinition(node.func)) {
+					info->escape = std::make_unique<EscapeAnalysis>(node.func);
+					info->escape->recompute();
+
+					for (const auto& block : node.func->blocks)
+						for (const auto& insn : block->body)
+							if (insn.result)
+								info->defs[insn.result.get()] = &insn;
+				} else if (node.func->name && !strcmp(node.func->name, "memory::alloc"))
+					info->noAliasReturn = true;
+			}
+
+			inferEffects();
+			inferReturns();
+			inferNonNull();
+
+			for (const FunctionInfo& info : infos) {
+				Function* func = info.func;
+				if (isDefinition(func)) {
+					if (!(info.effects & AnyMemory))
+						func->inferred |= (uint32_t)InferredAttribute::ReadNone;
+					else {
+						if (!(info.effects & (WriteArgument | WriteOther)))
+							func->inferred |= (uint32_t)InferredAttribute::ReadOnly;
+						if (!(info.effects & OtherMemory))
+							func->inferred |= (uint32_t)InferredAttribute::ArgMemOnly;
+					}
+
+					if (!(info.effects & Throws))
+						func->inferred |= (uint32_t)InferredAttribute::NoUnwind;
+					if (info.willReturn)
+						func->inferred |= (uint32_t)InferredAttribute::WillReturn;
+				}
+				if (info.noAliasReturn)
+					func->inferred |= (uint32_t)InferredAttribute::NoAliasReturn;
+
+				inferred += (uint32_t)std::popcount(func->inferred) + (uint32_t)std::popcount(func->nonnullParams);
+			}
+		}
+
+	private:
+		static bool isDefinition(const Function* func) {
+			return !func->blocks.empty() && !func->hasAttribute(FunctionAttribute::Inline);
+		}
+
+		static bool isPointer(const Value* v) {
+			return v->type->kind == TypeKind::Pointer || v->type->kind == TypeKind::String;
+		}
+
+		FunctionInfo* getInfo(const Value* callee) {
+			if (callee->kind != ValueKind::Function)
+				return nullptr;
+
+			const CallGraph::Node* node = graph.getNode((const Function*)callee);
+			return node ? &infos[(uint32_t)(node - graph.nodes.data)] : nullptr;
+		}
+
+		const Instruction* getDef(const FunctionInfo& info, const Value* v) const {
+			if (v->kind != ValueKind::Instruction)
+				return nullptr;
+
+			const Instruction* const* def = info.defs.find(v);
+			return def ? *def : nullptr;
+		}
+
+		// the only value ever stored to the local `slot`, null if there are several or the slot escapes
+		const Value* getSlotValue(const FunctionInfo& info, const Value* slot) const {
+			if (info.escape->isEscaping(slot))
+				return nullptr;
+
+			const Value* value = nullptr;
+			for (const EscapeAnalysis::Use& use : info.escape->getUses(slot)) {
+				switch (use.insn->op) {
+				case OpCode::Load:
+				case OpCode::ICmp:
+					break;
+
+				case OpCode::Store:
+					if (value && value != use.insn->operands[1])
+						return nullptr;
+					value = use.insn->operands[1];
+					break;
+
+				// stores through a field or a cast pointer aren't seen
+				default:
+					return nullptr;
+				}
+			}
+
+			return value;
+		}
+
+		// `v`, or the value it was loaded from a local that only ever holds that value
+		const Value* getSource(const FunctionInfo& info, const Value* v) const {
+			for (uint32_t depth = 0; depth < maxDepth; depth++) {
+				const Instruction* def = getDef(info, v);
+				if (!def || def->op != OpCode::Load || def->extra)
+					break;
+
+				const Instruction* slot = getDef(info, def->operands[0]);
+				if (!slot || slot->op != OpCode::Alloca)
+					break;
+
+				const Value* value = getSlotValue(info, def->operands[0]);
+				if (!value)
+					break;
+				v = value;
+			}
+			return v;
+		}
+
+		Origin getOrigin(const FunctionInfo& info, const Value* ptr) const {
+			for (uint32_t depth = 0; depth < maxDepth; depth++) {
+				ptr = getSource(info, ptr);
+				if (ptr->kind == ValueKind::Parameter)
+					return Origin::Argument;
+
+				const Instruction* def = getDef(info, ptr);
+				if (!def)
+					return Origin::Other;
+
+				if (def->op == OpCode::Alloca)
+					return Origin::Local;
+				else if (def->op == OpCode::GetElementPtr || (def->op == OpCode::Cast && isPointer(def->operands[0])))
+					ptr = def->operands[0];
+				else
+					return Origin::Other;
+			}
+			return Origin::Other;
+		}
+
+		uint8_t getAccess(const FunctionInfo& info, const Value* ptr, bool write) const {
+			switch (getOrigin(info, ptr)) {
+			case Origin::Local: return 0;
+			case Origin::Argument: return write ? WriteArgument : ReadArgument;
+			default: return write ? WriteOther : ReadOther;
+			}
+		}
+
+		uint8_t getCallEffects(const FunctionInfo& info, const Instruction& insn) {
+			FunctionInfo* callee = getInfo(insn.operands[0]);
+			if (!callee)
+				return AnyEffect;
+
+			uint8_t effects;
+			if (isDefinition(callee->func))
+				effects = callee->effects;
+			else if (callee->func->hasAttribute(FunctionAttribute::Inline))
+				effects = AnyEffect;
+			else {
+				const char* name = callee->func->name;
+				bool throws = !name || !strncmp(name, "except::", 8) || !strcmp(name, "assert");
+				effects = AnyMemory | (throws ? Throws : 0);
+			}
+
+			// what the callee does through its parameters happens to whatever the arguments point to here
+			uint8_t result = effects & (OtherMemory | Throws);
+			if (effects & ArgumentMemory) {
+				for (uint32_t i = 1; i < insn.operands.size; i++) {
+					if (!isPointer(insn.operands[i]))
+						continue;
+
+					switch (getOrigin(info, insn.operands[i])) {
+					case Origin::Local: break;
+					case Origin::Argument: result |= effects & ArgumentMemory; break;
+					default: result |= (effects & ArgumentMemory) << 2; break;
+					}
+				}
+			}
+			return result;
+		}
+
+		uint8_t computeEffects(const FunctionInfo& info) {
+			uint8_t effects = 0;
+			for (const auto& block : info.func->blocks) {
+				for (const auto& insn : block->body) {
+					switch (insn.op) {
+					case OpCode::Load:
+					case OpCode::Store:
+						// volatile accesses must stay where they are, even to locals
+						if (insn.extra)
+							effects |= ReadOther | WriteOther;
+						else
+							effects |= getAccess(info, insn.operands[0], insn.op == OpCode::Store);
+						break;
+
+					case OpCode::Call:
+						effects |= getCallEffects(info, insn);
+						break;
+
+					default:
+						break;
+					}
+				}
+			}
+			return effects;
+		}
+
+		void inferEffects() {
+			bool changed = true;
+			while (changed) {
+				changed = false;
+				for (FunctionInfo& info : infos) {
+					if (!isDefinition(info.func))
+						continue;
+
+					uint8_t effects = info.effects | computeEffects(info);
+					if (effects != info.effects) {
+						info.effects = effects;
+						changed = true;
+					}
+				}
+			}
+		}
+
+		bool computeWillReturn(FunctionInfo& info) {
+			if (info.func->hasAttribute(FunctionAttribute::NoReturn) || !info.func->getLoopNest().loops.empty())
+				return false;
+
+			for (const auto& block : info.func->blocks)
+				for (const auto& insn : block->body)
+					if (insn.op == OpCode::Call) {
+						FunctionInfo* callee = getInfo(insn.operands[0]);
+						if (!callee || !callee->willReturn)
+							return false;
+					}
+			return true;
+		}
+
+		// whether the pointer `v` is only loaded from, stored through, compared or returned, possibly after
+		// going through locals that only ever hold it
+		bool isUncaptured(const FunctionInfo& info, const Value* v, uint32_t depth = 0) const {
+			if (depth >= maxDepth)
+				return false;
+
+			for (const EscapeAnalysis::Use& use : info.escape->getUses(v)) {
+				const Instruction* insn = use.insn;
+				switch (insn->op) {
+				case OpCode::Ret:
+				case OpCode::Load:
+				case OpCode::ICmp:
+					break;
+
+				case OpCode::Store: {
+					if (use.operand == 0)
+						break;
+
+					// kept in a local, every load of it has to stay uncaptured as well
+					const Instruction* slot = getDef(info, insn->operands[0]);
+					if (!slot || slot->op != OpCode::Alloca || getSlotValue(info, insn->operands[0]) != v)
+						return false;
+
+					for (const EscapeAnalysis::Use& load : info.escape->getUses(insn->operands[0]))
+						if (load.insn->op == OpCode::Load && !isUncaptured(info, load.insn->result.get(), depth + 1))
+							return false;
+				} break;
+
+				default:
+					return false;
+				}
+			}
+			return true;
+		}
+
+		bool computeNoAliasReturn(FunctionInfo& info) {
+			if (((FunctionType*)info.func->type)->returnType->kind != TypeKind::Pointer)
+				return false;
+
+			bool returns = false;
+			for (const auto& block : info.func->blocks) {
+				const Instruction* ret = block->getTerminator();
+				if (!ret || ret->op != OpCode::Ret)
+					continue;
+				if (ret->operands.empty())
+					return false;
+
+				const Value* value = getSource(info, ret->operands[0]);
+				const Instruction* def = getDef(info, value);
+				if (!def || def->op != OpCode::Call)
+					return false;
+
+				FunctionInfo* callee = getInfo(def->operands[0]);
+				if (!callee || !callee->noAliasReturn || !isUncaptured(info, value))
+					return false;
+				returns = true;
+			}
+			return returns;
+		}
+
+		void inferReturns() {
+			bool changed = true;
+			while (changed) {
+				changed = false;
+				for (FunctionInfo& info : infos) {
+					if (!isDefinition(info.func))
+						continue;
+
+					if (!info.willReturn && computeWillReturn(info))
+						info.willReturn = changed = true;
+					if (!info.noAliasReturn && computeNoAliasReturn(info))
+						info.noAliasReturn = changed = true;
+				}
+			}
+		}
+
+		bool isNonNull(const FunctionInfo& info, const Value* v) const {
+			for (uint32_t depth = 0; depth < maxDepth; depth++) {
+				v = getSource(info, v);
+
+				switch (v->kind) {
+				case ValueKind::Global:
+				case ValueKind::Function:
+					return true;
+
+				case ValueKind::Constant:
+					return (ConstantKind)v->subclassData == ConstantKind::String;
+
+				case ValueKind::Parameter: {
+					for (uint32_t i = 0; i < info.func->params.size; i++)
+						if (info.func->getParam(i) == v)
+							return info.func->isNonNull(i);
+					return false;
+				}
+
+				case ValueKind::Instruction: {
+					const Instruction* def = getDef(info, v);
+					if (!def)
+						return false;
+
+					if (def->op == OpCode::Alloca)
+						return true;
+					// pointer arithmetic on a string literal or a local
+					if (def->op != OpCode::GetElementPtr && (def->op != OpCode::Cast || !isPointer(def->operands[0])))
+						return false;
+					v = def->operands[0];
+				} break;
+
+				default:
+					return false;
+				}
+			}
+			return false;
+		}
+
+		void inferNonNull() {
+			// methods are only called on objects
+			for (FunctionInfo& info : infos) {
+				Function* func = info.func;
+				if (!func->params.empty() && func->getParam(0)->name && !strcmp(func->getParam(0)->name, "this"))
+					func->nonnullParams |= 1;
+			}
+
+			bool changed = true;
+			while (changed) {
+				changed = false;
+				for (uint32_t n = 0; n < infos.size; n++) {
+					Function* func = infos[n].func;
+					const CallGraph::Node& node = graph.nodes[n];
+
+					// every call site has to be known
+					if (!isDefinition(func) || func->storage != StorageClass::Private || func->linkName || node.addressTaken || node.callers.empty())
+						continue;
+
+					for (uint32_t i = 0; i < func->params.size && i < 64; i++) {
+						if (func->isNonNull(i) || func->getParam(i)->type->kind != TypeKind::String)
+							continue;
+
+						bool nonnull = true;
+						for (const CallGraph::CallSite& site : node.callers) {
+							const FunctionInfo* caller = getInfo(site.caller);
+							if (!caller || !caller->escape || i + 1 >= site.insn->operands.size || !isNonNull(*caller, site.insn->operands[i + 1])) {
+								nonnull = false;
+								break;
+							}
+						}
+
+						if (nonnull) {
+							func->nonnullParams |= 1ull << i;
+							changed = true;
+						}
+					}
+				}
+			}
+		}
+	};
+
+	uint32_t inferAttributes(Module* module, const PassOptions& options) {
+		AttributeInference inference(module);
+		inference.run();
+
+		if (options.verbose && inference.inferred)
+			printf("MIR: inferred %u function and parameter attribute(s)\n", inference.inferred);
+
+		return inference.inferred;
+	}
+
+} // namespace tea::mir
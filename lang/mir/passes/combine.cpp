@@ -0,0 +1,409 @@
+#include "passes.h"
+
+#include <cstdio>
+
+#include "core/tea.h"
+#include "mir/passes/utils.h"
+
+// Peephole combiner
+//
+// Every instruction is matched against the rule table below, the first rule whose opcode and operand
+// patterns match rewrites it. A rewrite either names a value that replaces the instruction's result
+// (`add %x, 0` => %x) or changes the instruction in place (`mul %x, 8` => `shl %x, 3`). Instructions
+// without side effects whose result ends up unused are removed. Sweeps repeat until nothing changes.
+//
+// Only integer arithmetic is simplified, floating point identities don't hold for NaNs and signed zeros
+
+namespace tea::mir {
+
+	// a function that doesn't reach a fixpoint after this many sweeps is left as is
+	static constexpr uint32_t maxSweeps = 16;
+
+	enum class Match : uint8_t {
+		Any,
+		Zero,
+		One,
+		AllOnes,
+		PowerOfTwo,
+		Constant,
+		// the same value as the left hand side
+		Lhs,
+		// the result of an instruction with the same opcode as the one being matched
+		Same
+	};
+
+	enum class Rewrite : uint8_t {
+		// replace the result with the operand matched by the left/right hand side pattern
+		Lhs,
+		Rhs,
+		// replace the result with zero of its own type
+		Zero,
+		Custom
+	};
+
+	class Combiner;
+
+	// returns the replacement value, the instruction's own result if it was changed in place or null if nothing matched
+	typedef Value* (*RewriteFn)(Combiner& combiner, Instruction& insn, Value* lhs, Value* rhs);
+
+	struct Rule {
+		const char* name;
+		OpCode op;
+		Match lhs;
+		Match rhs;
+		bool commutative;
+		Rewrite rewrite;
+		RewriteFn custom = nullptr;
+	};
+
+	static bool isIntConstant(const Value* v) {
+		return v && v->kind == ValueKind::Constant && (ConstantKind)v->subclassData == ConstantKind::Number && !v->type->isFloat();
+	}
+
+	static uint8_t getBitwidth(const Type* type) {
+		switch (type->kind) {
+		case TypeKind::Bool: return 1;
+		case TypeKind::Char: return 8;
+		case TypeKind::Short: return 16;
+		case TypeKind::Int: return 32;
+		case TypeKind::Long: return 64;
+		default: return 0;
+		}
+	}
+
+	static uint64_t truncate(uint64_t value, uint8_t bits) {
+		return bits >= 64 ? value : value & ((1ull << bits) - 1);
+	}
+
+	class Combiner {
+		Function* func;
+		tea::map<const Value*, Instruction*> defs;
+		tea::map<const Value*, uint32_t> useCounts;
+
+	public:
+		Module* module;
+		bool luau;
+		tea::vector<uint32_t> hits;
+		uint32_t dead = 0;
+
+		Combiner(Function* func)
+			: func(func), module(func->parent), luau(isLuauTarget(func->parent)) {
+		}
+
+		void run();
+
+		const Instruction* getDef(const Value* v) const {
+			Instruction* const* def = defs.find(v);
+			return def ? *def : nullptr;
+		}
+
+		Value* getZero(const Type* type) const {
+			return ConstantNumber::get(module, 0, getBitwidth(type), type->sign);
+		}
+
+		Value* getBool(bool value) const {
+			return ConstantNumber::get(module, value, 1);
+		}
+
+	private:
+		bool sweep();
+		bool matches(Match pattern, Value* v, Value* lhs, OpCode op) const;
+		Value* apply(const Rule& rule, Instruction& insn, Value* lhs, Value* rhs);
+		bool isTriviallyDead(const Instruction& insn) const;
+	};
+
+	static Value* mulToShift(Combiner& combiner, Instruction& insn, Value* lhs, Value* rhs) {
+		// shifts are library calls in Luau
+		if (combiner.luau)
+			return nullptr;
+
+		uint8_t bits = getBitwidth(insn.result->type);
+		uint64_t factor = truncate(((ConstantNumber*)rhs)->getInteger(), bits);
+
+		uint64_t shift = 0;
+		while ((1ull << shift) != factor)
+			shift++;
+
+		insn.op = OpCode::Shl;
+		insn.operands.clear();
+		insn.operands.emplace(lhs);
+		insn.operands.emplace(ConstantNumber::get(combiner.module, shift, bits, insn.result->type->sign));
+		return insn.result.get();
+	}
+
+	static Value* foldNotNot(Combiner& combiner, Instruction&, Value* lhs, Value*) {
+		return combiner.getDef(lhs)->operands[0];
+	}
+
+	static Value* foldSelfCompare(Combiner& combiner, Instruction& insn, Value*, Value*) {
+		switch ((ICmpPredicate)insn.extra) {
+		case ICmpPredicate::EQ:
+		case ICmpPredicate::SGE:
+		case ICmpPredicate::UGE:
+		case ICmpPredicate::SLE:
+		case ICmpPredicate::ULE:
+			return combiner.getBool(true);
+		default:
+			return combiner.getBool(false);
+		}
+	}
+
+	// integer casts compose as long as no bits of the source are lost in between and extensions agree on
+	// their kind, the extension performed by a cast depends on the signedness of its destination type
+	static Value* foldCastChain(Combiner& combiner, Instruction& insn, Value* lhs, Value*) {
+		Value* src = combiner.getDef(lhs)->operands[0];
+		const Type* srcType = src->type;
+		const Type* midType = lhs->type;
+		const Type* dstType = insn.result->type;
+
+		uint8_t srcBits = getBitwidth(srcType), midBits = getBitwidth(midType), dstBits = getBitwidth(dstType);
+		if (srcBits <= 1 || midBits <= 1 || dstBits <= 1)
+			return nullptr;
+
+		bool composes = false;
+		if (srcBits <= midBits && dstBits <= midBits)
+			composes = dstBits <= srcBits || midType->sign == dstType->sign;
+		else if (srcBits <= midBits && midBits <= dstBits)
+			composes = midType->sign == dstType->sign;
+		else if (srcBits >= midBits && midBits >= dstBits)
+			composes = true;
+
+		if (!composes)
+			return nullptr;
+
+		if (srcType->kind == dstType->kind && srcType->sign == dstType->sign)
+			return src;
+
+		insn.operands[0] = src;
+		return insn.result.get();
+	}
+
+	static Value* foldConstants(Combiner& combiner, Instruction& insn, Value* lhs, Value* rhs) {
+		uint8_t bits = getBitwidth(insn.result->type);
+		uint64_t a = ((ConstantNumber*)lhs)->getInteger();
+		uint64_t b = ((ConstantNumber*)rhs)->getInteger();
+
+		uint64_t value = 0;
+		switch (insn.op) {
+		case OpCode::Add: value = a + b; break;
+		case OpCode::Sub: value = a - b; break;
+		case OpCode::Mul: value = a * b; break;
+		case OpCode::And: value = a & b; break;
+		case OpCode::Or: value = a | b; break;
+		case OpCode::Xor: value = a ^ b; break;
+		case OpCode::Shl:
+			if (truncate(b, bits) >= bits)
+				return nullptr;
+			value = a << b;
+			break;
+		default:
+			return nullptr;
+		}
+
+		return ConstantNumber::get(combiner.module, truncate(value, bits), bits, insn.result->type->sign);
+	}
+
+	// `select` with a known condition or the same value on both sides
+	static Value* foldSelect(Combiner&, Instruction& insn, Value* lhs, Value*) {
+		Value* result = nullptr;
+		if (insn.operands[1] == insn.operands[2])
+			result = insn.operands[1];
+		else if (isIntConstant(lhs))
+			result = insn.operands[((ConstantNumber*)lhs)->getInteger() & 1 ? 1 : 2];
+
+		if (!result || result->type->sign != insn.result->type->sign)
+			return nullptr;
+		return result;
+	}
+
+	static constexpr Rule rules[] = {
+		{ "add-zero", OpCode::Add, Match::Any, Match::Zero, true, Rewrite::Lhs },
+		{ "sub-zero", OpCode::Sub, Match::Any, Match::Zero, false, Rewrite::Lhs },
+		{ "sub-self", OpCode::Sub, Match::Any, Match::Lhs, false, Rewrite::Zero },
+		{ "mul-zero", OpCode::Mul, Match::Any, Match::Zero, true, Rewrite::Zero },
+		{ "mul-one", OpCode::Mul, Match::Any, Match::One, true, Rewrite::Lhs },
+		{ "mul-pow2", OpCode::Mul, Match::Any, Match::PowerOfTwo, true, Rewrite::Custom, mulToShift },
+		{ "div-one", OpCode::Div, Match::Any, Match::One, false, Rewrite::Lhs },
+		{ "mod-one", OpCode::Mod, Match::Any, Match::One, false, Rewrite::Zero },
+		{ "and-zero", OpCode::And, Match::Any, Match::Zero, true, Rewrite::Zero },
+		{ "and-ones", OpCode::And, Match::Any, Match::AllOnes, true, Rewrite::Lhs },
+		{ "and-self", OpCode::And, Match::Any, Match::Lhs, false, Rewrite::Lhs },
+		{ "or-zero", OpCode::Or, Match::Any, Match::Zero, true, Rewrite::Lhs },
+		{ "or-ones", OpCode::Or, Match::Any, Match::AllOnes, true, Rewrite::Rhs },
+		{ "or-self", OpCode::Or, Match::Any, Match::Lhs, false, Rewrite::Lhs },
+		{ "xor-zero", OpCode::Xor, Match::Any, Match::Zero, true, Rewrite::Lhs },
+		{ "xor-self", OpCode::Xor, Match::Any, Match::Lhs, false, Rewrite::Zero },
+		{ "shl-zero", OpCode::Shl, Match::Any, Match::Zero, false, Rewrite::Lhs },
+		{ "shr-zero", OpCode::Shr, Match::Any, Match::Zero, false, Rewrite::Lhs },
+		{ "shl-of-zero", OpCode::Shl, Match::Zero, Match::Any, false, Rewrite::Zero },
+		{ "shr-of-zero", OpCode::Shr, Match::Zero, Match::Any, false, Rewrite::Zero },
+		{ "not-not", OpCode::Not, Match::Same, Match::Any, false, Rewrite::Custom, foldNotNot },
+		{ "icmp-self", OpCode::ICmp, Match::Any, Match::Lhs, false, Rewrite::Custom, foldSelfCompare },
+		{ "cast-cast", OpCode::Cast, Match::Same, Match::Any, false, Rewrite::Custom, foldCastChain },
+		{ "fold-select", OpCode::Select, Match::Any, Match::Any, false, Rewrite::Custom, foldSelect },
+		{ "fold-add", OpCode::Add, Match::Constant, Match::Constant, false, Rewrite::Custom, foldConstants },
+		{ "fold-sub", OpCode::Sub, Match::Constant, Match::Constant, false, Rewrite::Custom, foldConstants },
+		{ "fold-mul", OpCode::Mul, Match::Constant, Match::Constant, false, Rewrite::Custom, foldConstants },
+		{ "fold-and", OpCode::And, Match::Constant, Match::Constant, false, Rewrite::Custom, foldConstants },
+		{ "fold-or", OpCode::Or, Match::Constant, Match::Constant, false, Rewrite::Custom, foldConstants },
+		{ "fold-xor", OpCode::Xor, Match::Constant, Match::Constant, false, Rewrite::Custom, foldConstants },
+		{ "fold-shl", OpCode::Shl, Match::Constant, Match::Constant, false, Rewrite::Custom, foldConstants },
+	};
+
+	static constexpr uint32_t ruleCount = sizeof(rules) / sizeof(rules[0]);
+
+	bool Combiner::matches(Match pattern, Value* v, Value* lhs, OpCode op) const {
+		if (pattern == Match::Any)
+			return true;
+		if (pattern == Match::Lhs)
+			return v == lhs;
+		if (pattern == Match::Same) {
+			const Instruction* def = getDef(v);
+			return def && def->op == op;
+		}
+
+		if (!isIntConstant(v))
+			return false;
+
+		uint64_t value = truncate(((ConstantNumber*)v)->getInteger(), getBitwidth(v->type));
+		switch (pattern) {
+		case Match::Zero: return value == 0;
+		case Match::One: return value == 1;
+		case Match::AllOnes: return ((ConstantNumber*)v)->getSInteger() == -1;
+		case Match::PowerOfTwo: return value >= 2 && !(value & (value - 1));
+		case Match::Constant: return true;
+		default: return false;
+		}
+	}
+
+	Value* Combiner::apply(const Rule& rule, Instruction& insn, Value* lhs, Value* rhs) {
+		Value* result = nullptr;
+		switch (rule.rewrite) {
+		case Rewrite::Lhs: result = lhs; break;
+		case Rewrite::Rhs: result = rhs; break;
+		case Rewrite::Zero: return getZero(insn.result->type);
+		case Rewrite::Custom: return rule.custom(*this, insn, lhs, rhs);
+		}
+
+		// signedness decides how shifts and casts of the value are lowered, so it must not change
+		if (result->type->kind != insn.result->type->kind || result->type->sign != insn.result->type->sign)
+			return nullptr;
+		return result;
+	}
+
+	bool Combiner::isTriviallyDead(const Instruction& insn) const {
+		if (!insn.result || useCounts.contains(insn.result.get()))
+			return false;
+
+		switch (insn.op) {
+		case OpCode::Load:
+			return !insn.extra;
+		case OpCode::Call:
+		case OpCode::Store:
+		case OpCode::Nop:
+			return false;
+		default:
+			return insn.op < OpCode::Br || insn.op == OpCode::Cast;
+		}
+	}
+
+	bool Combiner::sweep() {
+		defs.clear();
+		useCounts.clear();
+		for (const auto& block : func->blocks) {
+			for (auto& insn : block->body) {
+				if (insn.result)
+					defs[insn.result.get()] = &insn;
+				for (uint32_t i = 0; i < insn.operands.size; i++)
+					if (insn.operands[i] && !(insn.op == OpCode::Phi && i == 0))
+						useCounts[insn.operands[i]]++;
+			}
+		}
+
+		bool changed = false;
+		ValueMap replacements;
+		for (const auto& block : func->blocks) {
+			for (auto& insn : block->body) {
+				if (isTriviallyDead(insn)) {
+					insn.op = OpCode::Nop;
+					insn.operands.clear();
+					dead++;
+					changed = true;
+					continue;
+				}
+
+				if (!insn.result || insn.operands.empty() || insn.result->type->isFloat())
+					continue;
+
+				Value* lhs = insn.operands[0];
+				Value* rhs = insn.operands.size > 1 ? insn.operands[1] : nullptr;
+
+				for (uint32_t i = 0; i < ruleCount; i++) {
+					const Rule& rule = rules[i];
+					if (rule.op != insn.op)
+						continue;
+
+					Value* a = lhs, * b = rhs;
+					bool matched = matches(rule.lhs, a, a, insn.op) && matches(rule.rhs, b, a, insn.op);
+					if (!matched && rule.commutative) {
+						std::swap(a, b);
+						matched = matches(rule.lhs, a, a, insn.op) && matches(rule.rhs, b, a, insn.op);
+					}
+					if (!matched)
+						continue;
+
+					Value* result = apply(rule, insn, a, b);
+					if (!result)
+						continue;
+
+					hits[i]++;
+					changed = true;
+					if (result != insn.result.get()) {
+						replacements[insn.result.get()] = result;
+						insn.op = OpCode::Nop;
+						insn.operands.clear();
+					}
+					break;
+				}
+			}
+		}
+
+		if (replacements.empty())
+			return changed;
+
+		// a replacement may itself have been replaced during the same sweep
+		for (auto& [from, to] : replacements)
+			while (Value** next = replacements.find(to))
+				to = *next;
+
+		for (const auto& block : func->blocks)
+			remapOperands(block.get(), replacements, {});
+		return true;
+	}
+
+	void Combiner::run() {
+		hits.clear();
+		for (uint32_t i = 0; i < ruleCount; i++)
+			hits.emplace(0);
+
+		for (uint32_t i = 0; i < maxSweeps && sweep(); i++);
+	}
+
+	uint32_t combineInstructions(Function* func, const PassOptions&, RuleHits& hits) {
+		Combiner combiner(func);
+		combiner.run();
+
+		uint32_t total = combiner.dead;
+		for (uint32_t i = 0; i < ruleCount; i++) {
+			if (!combiner.hits[i])
+				continue;
+			hits[rules[i].name] += combiner.hits[i];
+			total += combiner.hits[i];
+		}
+		if (combiner.dead)
+			hits["dead"] += combiner.dead;
+
+		return total;
+	}
+
+} // namespace tea::mir
@@ -0,0 +1,67 @@
+#include "escape.h"
+
+#include "core/tea.h"
+
+namespace tea::mir {
+
+	void EscapeAnalysis::recompute() {
+		uses.clear();
+		allocas.clear();
+
+		for (const auto& block : func->blocks)
+			for (auto& insn : block->body)
+				for (uint32_t i = 0; i < insn.operands.size; i++)
+					uses[insn.operands[i]].emplace(Use{ &insn, i });
+
+		for (const auto& block : func->blocks)
+			for (const auto& insn : block->body)
+				if (insn.op == OpCode::Alloca)
+					allocas[insn.result.get()] = escapes(insn.result.get());
+	}
+
+	const EscapeAnalysis::UseList& EscapeAnalysis::getUses(const Value* v) const {
+		static const UseList none;
+
+		const UseList* list = uses.find(v);
+		return list ? *list : none;
+	}
+
+	bool EscapeAnalysis::isEscaping(const Value* ptr) const {
+		const bool* escaping = allocas.find(ptr);
+		return !escaping || *escaping;
+	}
+
+	bool EscapeAnalysis::escapes(const Value* ptr) const {
+		for (const Use& use : getUses(ptr)) {
+			const Instruction* insn = use.insn;
+
+			switch (insn->op) {
+			case OpCode::Load:
+			case OpCode::ICmp:
+				break;
+
+			case OpCode::Store:
+				// storing through the pointer is fine, storing the pointer itself isn't
+				if (use.operand != 0)
+					return true;
+				break;
+
+			case OpCode::GetElementPtr:
+				if (use.operand != 0 || escapes(insn->result.get()))
+					return true;
+				break;
+
+			case OpCode::Cast:
+				if (insn->result->type->kind != TypeKind::Pointer || escapes(insn->result.get()))
+					return true;
+				break;
+
+			default:
+				return true;
+			}
+		}
+
+		return false;
+	}
+
+} // namespace tea::mir
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "mir/mir.h"
+#include "mir/passes/utils.h"
+
+namespace tea::mir {
+	// Tracks where the address of every alloca in a function can end up. An address escapes once it is
+	// stored somewhere, passed to a call, returned or merged through a phi; loads, stores through it,
+	// pointer arithmetic on it and comparisons don't let it leave the function
+	class EscapeAnalysis {
+	public:
+		struct Use {
+			Instruction* insn = nullptr;
+			uint32_t operand = 0;
+		};
+
+		typedef tea::vector<Use> UseList;
+
+	private:
+		Function* func;
+		tea::map<const Value*, UseList> uses;
+		tea::map<const Value*, bool> allocas;
+
+	public:
+		EscapeAnalysis(Function* func) : func(func) {
+		}
+
+		/// <summary>
+		/// Rebuild the use lists and escape information, must be called after the function was modified
+		/// </summary>
+		void recompute();
+
+		/// <summary>
+		/// Get every instruction operand referring to `v`
+		/// </summary>
+		const UseList& getUses(const Value* v) const;
+
+		/// <summary>
+		/// Check whether the address of `ptr`, or any pointer derived from it, may leave the function
+		/// </summary>
+		/// <returns>True if `ptr` isn't an alloca or its address escapes</returns>
+		bool isEscaping(const Value* ptr) const;
+
+	private:
+		bool escapes(const Value* ptr) const;
+	};
+}
@@ -0,0 +1,44 @@
+#include "passes.h"
+
+#include <cstdio>
+
+#include "core/tea.h"
+
+// Dead function and global elimination
+//
+// Public functions and globals and `main` may be used from outside of the module, everything they refer to
+// (directly or through other functions and global initializers) is kept. Private functions and globals that
+// can't be reached that way are removed, and so are declarations of functions nothing refers to, which
+// are mostly the unused parts of imported libraries
+
+namespace tea::mir {
+
+	uint32_t eliminateDeadGlobals(Module* module, const PassOptions& options) {
+		CallGraph graph(module);
+
+		uint32_t functions = 0;
+		uint32_t globals = 0;
+		uint32_t count = 0;
+		for (uint32_t i = 0; i < module->body.size; i++) {
+			const Value* v = module->body[i].get();
+
+			bool dead = !graph.isReachable(v);
+			if (dead && v->kind == ValueKind::Function)
+				functions++;
+			else if (dead)
+				globals++;
+
+			if (!dead)
+				std::swap(module->body[count++], module->body[i]);
+		}
+
+		while (module->body.size > count)
+			module->body.pop();
+
+		if (options.verbose && (functions || globals))
+			printf("MIR: removed %u unreachable function(s) and %u global(s)\n", functions, globals);
+
+		return functions + globals;
+	}
+
+} // namespace tea::mir
@@ -0,0 +1,305 @@
+#include "passes.h"
+
+#include <cstdio>
+
+#include "core/tea.h"
+#include "mir/passes/utils.h"
+
+// If-conversion
+//
+//   cbr %c, %then, %else                 %v = select %c, %a, %b
+//   then: store %x, %a; br %merge   =>   store %x, %v
+//   else: store %x, %b; br %merge        br %merge
+//
+// Diamonds (two arms meeting again) and triangles (one arm rejoining the other edge) whose arms are a few
+// instructions that are safe to execute either way are flattened into their head. The arms run
+// unconditionally, the values they store and the phis they feed are picked with `select`. Stores are only
+// sunk to locals and globals, which can be loaded for their old value when just one arm writes them
+
+namespace tea::mir {
+
+	// hoisted instructions per arm, not counting stores
+	static constexpr uint32_t maxArmInstructions = 4;
+	// selects a single conversion may create
+	static constexpr uint32_t maxSelects = 4;
+
+	class BranchConverter {
+		struct Arm {
+			BasicBlock* block = nullptr;
+			// the value stored last to each address, in order of the first store
+			tea::vector<std::pair<Value*, Value*>> stores;
+		};
+
+		Function* func;
+		PredecessorMap preds;
+		tea::map<const Value*, bool> slots;
+
+	public:
+		uint32_t converted = 0;
+
+		BranchConverter(Function* func) : func(func) {
+		}
+
+		void run() {
+			for (const auto& value : func->parent->body)
+				if (value->kind == ValueKind::Global)
+					slots[value.get()] = true;
+			for (const auto& block : func->blocks)
+				for (const auto& insn : block->body)
+					if (insn.op == OpCode::Alloca)
+						slots[insn.result.get()] = true;
+
+			computePredecessors(func, preds);
+
+			// arms are removed as their heads are converted, so the list is walked by index
+			for (uint32_t i = 0; i < func->blocks.size; i++)
+				if (convert(func->blocks[i].get()))
+					converted++;
+		}
+
+	private:
+		static bool isSameType(const Type* a, const Type* b) {
+			return a->kind == b->kind && a->equals(b);
+		}
+
+		BasicBlock* getSinglePred(const BasicBlock* block) const {
+			const auto* list = preds.find(block);
+			return list && list->size == 1 ? (*list)[0] : nullptr;
+		}
+
+		// the block `block` jumps to unconditionally
+		static BasicBlock* getJumpTarget(const BasicBlock* block) {
+			const Instruction* term = block->getTerminator();
+			return term && term->op == OpCode::Br ? (BasicBlock*)term->operands[0] : nullptr;
+		}
+
+		// whether `insn` may run even when its block wouldn't have
+		bool isSpeculatable(const Instruction& insn) const {
+			switch (insn.op) {
+			case OpCode::Add:
+			case OpCode::Sub:
+			case OpCode::Mul:
+			case OpCode::Not:
+			case OpCode::And:
+			case OpCode::Or:
+			case OpCode::Xor:
+			case OpCode::Shl:
+			case OpCode::Shr:
+			case OpCode::ICmp:
+			case OpCode::FCmp:
+			case OpCode::Select:
+			case OpCode::Cast:
+			case OpCode::GetElementPtr:
+				return true;
+
+			// reading a local or global can't fault, anything else might point anywhere
+			case OpCode::Load:
+				return !insn.extra && slots.contains(insn.operands[0]);
+
+			default:
+				return false;
+			}
+		}
+
+		bool analyzeArm(Arm& arm) const {
+			if (!arm.block)
+				return true;
+
+			uint32_t hoisted = 0;
+			for (const auto& insn : arm.block->body) {
+				if (&insn == arm.block->getTerminator() || insn.op == OpCode::Nop)
+					continue;
+
+				if (insn.op == OpCode::Store) {
+					if (insn.extra || !slots.contains(insn.operands[0]))
+						return false;
+
+					bool found = false;
+					for (auto& [ptr, value] : arm.stores) {
+						if (ptr == insn.operands[0]) {
+							value = insn.operands[1];
+							found = true;
+						}
+					}
+					if (!found)
+						arm.stores.push({ insn.operands[0], insn.operands[1] });
+					continue;
+				}
+
+				if (!isSpeculatable(insn) || ++hoisted > maxArmInstructions)
+					return false;
+
+				// stores are sunk below every load, so a load can't read an earlier store of its own arm
+				if (insn.op == OpCode::Load)
+					for (const auto& [ptr, _] : arm.stores)
+						if (ptr == insn.operands[0])
+							return false;
+			}
+			return true;
+		}
+
+		static Value* findStore(const Arm& arm, const Value* ptr) {
+			for (const auto& [p, value] : arm.stores)
+				if (p == ptr)
+					return value;
+			return nullptr;
+		}
+
+		// the value a phi in the merge block receives along the true or false edge
+		static Value* getIncoming(const Instruction& phi, const BasicBlock* from) {
+			for (uint32_t i = 1; i + 1 < phi.operands.size; i += 2)
+				if ((const BasicBlock*)phi.operands[i + 1] == from)
+					return phi.operands[i];
+			return nullptr;
+		}
+
+		bool convert(BasicBlock* head) {
+			Instruction* term = (Instruction*)head->getTerminator();
+			if (!term || term->op != OpCode::CondBr || term->operands[1] == term->operands[2])
+				return false;
+
+			BasicBlock* truthy = (BasicBlock*)term->operands[1];
+			BasicBlock* falsy = (BasicBlock*)term->operands[2];
+			BasicBlock* entry = func->blocks[0].get();
+
+			// the arms of the shape, null where an edge goes straight to the merge block
+			Arm arms[2];
+			BasicBlock* merge = nullptr;
+			if (getSinglePred(truthy) == head && getSinglePred(falsy) == head && getJumpTarget(truthy) && getJumpTarget(truthy) == getJumpTarget(falsy)) {
+				arms[0].block = truthy;
+				arms[1].block = falsy;
+				merge = getJumpTarget(truthy);
+			} else if (getSinglePred(truthy) == head && getJumpTarget(truthy) == falsy) {
+				arms[0].block = truthy;
+				merge = falsy;
+			} else if (getSinglePred(falsy) == head && getJumpTarget(falsy) == truthy) {
+				arms[1].block = falsy;
+				merge = truthy;
+			} else
+				return false;
+
+			if (merge == head || merge == entry || (merge == truthy && arms[0].block) || (merge == falsy && arms[1].block))
+				return false;
+			if (preds.find(merge)->size != 2 || !analyzeArm(arms[0]) || !analyzeArm(arms[1]))
+				return false;
+
+			BasicBlock* fromTruthy = arms[0].block ? arms[0].block : head;
+			BasicBlock* fromFalsy = arms[1].block ? arms[1].block : head;
+
+			tea::vector<Value*> stored;
+			for (const Arm& arm : arms)
+				for (const auto& [ptr, _] : arm.stores)
+					if (!stored.find(ptr))
+						stored.push(ptr);
+
+			uint32_t selects = 0;
+			for (Value* ptr : stored) {
+				// an arm that doesn't store passes the old value on
+				Type* old = ((PointerType*)ptr->type)->pointee;
+				Value* a = findStore(arms[0], ptr);
+				Value* b = findStore(arms[1], ptr);
+				if (!isSameType(a ? a->type : old, b ? b->type : old))
+					return false;
+				selects += a != b;
+			}
+
+			for (const auto& insn : merge->body) {
+				if (insn.op != OpCode::Phi)
+					break;
+
+				Value* a = getIncoming(insn, fromTruthy);
+				Value* b = getIncoming(insn, fromFalsy);
+				if (!a || !b || !isSameType(a->type, b->type))
+					return false;
+				selects += a != b;
+			}
+
+			if (selects > maxSelects)
+				return false;
+
+			Value* cond = term->operands[0];
+			head->body.pop();
+
+			for (const Arm& arm : arms) {
+				if (!arm.block)
+					continue;
+
+				for (auto& insn : arm.block->body) {
+					if (insn.op == OpCode::Nop || insn.op == OpCode::Store || insn.op == OpCode::Br)
+						continue;
+					if (insn.result)
+						insn.result->name = head->scope.add(insn.result->name ? insn.result->name : "");
+					head->body.emplace(std::move(insn));
+				}
+			}
+
+			Builder builder(func->parent->ctx);
+			builder.block = head;
+
+			for (Value* ptr : stored) {
+				Value* a = findStore(arms[0], ptr);
+				Value* b = findStore(arms[1], ptr);
+				if (!a || !b) {
+					Value* old = builder.load(ptr, "");
+					a = a ? a : old;
+					b = b ? b : old;
+				}
+				builder.store(ptr, a == b ? a : builder.select(cond, a, b, ""));
+			}
+
+			ValueMap vmap;
+			for (auto& insn : merge->body) {
+				if (insn.op != OpCode::Phi)
+					break;
+
+				Value* a = getIncoming(insn, fromTruthy);
+				Value* b = getIncoming(insn, fromFalsy);
+				vmap[insn.result.get()] = a == b ? a : builder.select(cond, a, b, insn.result->name);
+
+				insn.op = OpCode::Nop;
+				insn.operands.clear();
+			}
+			builder.br(merge, false);
+
+			if (!vmap.empty())
+				for (const auto& block : func->blocks)
+					remapOperands(block.get(), vmap, {});
+
+			for (const Arm& arm : arms) {
+				if (!arm.block)
+					continue;
+
+				arm.block->body.clear();
+				for (uint32_t i = 0; i < func->blocks.size; i++) {
+					if (func->blocks[i].get() == arm.block) {
+						func->blocks[i].reset();
+						break;
+					}
+				}
+			}
+
+			uint32_t count = 0;
+			for (uint32_t i = 0; i < func->blocks.size; i++)
+				if (func->blocks[i])
+					std::swap(func->blocks[count++], func->blocks[i]);
+			while (func->blocks.size > count)
+				func->blocks.pop();
+
+			auto& mergePreds = *preds.find(merge);
+			mergePreds.clear();
+			mergePreds.emplace(head);
+			return true;
+		}
+	};
+
+	uint32_t convertBranches(Function* func, const PassOptions& options) {
+		BranchConverter converter(func);
+		converter.run();
+
+		if (options.verbose && converter.converted)
+			printf("MIR: '%s': %u branch(es) converted to selects\n", func->name, converter.converted);
+
+		return converter.converted;
+	}
+
+} // namespace tea::mir
@@ -0,0 +1,313 @@
+#include "passes.h"
+
+#include <cstdio>
+
+#include "core/tea.h"
+#include "mir/passes/loops.h"
+
+// Induction variable simplification
+//
+// For every counted loop (see loops.h):
+//   - loads of the counter that happen before the latch updates it are replaced by the header's load,
+//     so the counter is read once per iteration
+//   - values derived from the counter (`mul %i, C`, `shl %i, C` and `gep %base, %i`) get a slot of their
+//     own that is initialized in the preheader and advanced in the latch, which turns the per-iteration
+//     multiplication into an addition
+
+namespace tea::mir {
+
+	// how deep an invariant expression may be to still get rematerialized in the preheader
+	static constexpr uint32_t maxHoistDepth = 4;
+
+	struct DerivedIV {
+		OpCode op;
+		// the constant factor for mul/shl, the base pointer for gep
+		Value* operand;
+		tea::vector<Value*> users;
+	};
+
+	class IVSimplifier {
+		Function* func;
+		Module* module;
+		LoopAnalysis analysis;
+
+	public:
+		uint32_t canonicalized = 0;
+		uint32_t reduced = 0;
+
+		IVSimplifier(Function* func)
+			: func(func), module(func->parent), analysis(func) {
+		}
+
+		void run() {
+			// only natural loop headers are worth the full analysis
+			tea::vector<BasicBlock*> headers;
+			const ControlFlowGraph& cfg = func->getCFG();
+			for (const Loop& l : func->getLoopNest().loops) {
+				BasicBlock* block = cfg.blocks[l.header];
+				const Instruction* term = block->getTerminator();
+				if (term && term->op == OpCode::CondBr)
+					headers.emplace(block);
+			}
+
+			for (BasicBlock* header : headers) {
+				analysis.recompute();
+
+				CountedLoop loop;
+				if (!analysis.analyze(header, loop))
+					continue;
+
+				canonicalize(loop);
+				reduce(loop);
+			}
+		}
+
+	private:
+		void replaceUses(const ValueMap& replacements) {
+			if (replacements.empty())
+				return;
+			for (const auto& block : func->blocks)
+				remapOperands(block.get(), replacements, {});
+		}
+
+		static void erase(Instruction* insn) {
+			insn->op = OpCode::Nop;
+			insn->operands.clear();
+		}
+
+		static bool isIntConstant(const Value* v) {
+			return v->kind == ValueKind::Constant && (ConstantKind)v->subclassData == ConstantKind::Number && !v->type->isFloat();
+		}
+
+		void canonicalize(const CountedLoop& loop) {
+			ValueMap replacements;
+			for (BasicBlock* block : loop.region) {
+				for (auto& insn : block->body) {
+					// everything past the update sees the next iteration's value
+					if (block == loop.latch && insn.op == OpCode::Store && insn.operands[0] == loop.counter)
+						break;
+
+					if (insn.op != OpCode::Load || insn.extra || insn.operands[0] != loop.counter)
+						continue;
+
+					replacements[insn.result.get()] = loop.counterLoad;
+					erase(&insn);
+					canonicalized++;
+				}
+			}
+
+			replaceUses(replacements);
+		}
+
+		// a load of a local that is never written inside the loop
+		bool isInvariantLoad(const CountedLoop& loop, const Instruction* insn) const {
+			if (insn->op != OpCode::Load || insn->extra || insn->operands[0] == loop.counter || analysis.isEscaping(insn->operands[0]))
+				return false;
+
+			for (BasicBlock* block : loop.region)
+				for (const auto& other : block->body)
+					if (other.op == OpCode::Store && other.operands[0] == insn->operands[0])
+						return false;
+			return true;
+		}
+
+		// check that `v` can be recomputed in the preheader, collecting the instructions to clone in dependency order
+		bool collectHoistable(const CountedLoop& loop, Value* v, tea::vector<const Instruction*>& chain, uint32_t depth = 0) const {
+			BasicBlock* block = nullptr;
+			const Instruction* def = analysis.getDef(v, &block);
+			if (!def || !loop.contains(block))
+				return v->kind != ValueKind::Instruction || def;
+
+			if (depth >= maxHoistDepth)
+				return false;
+
+			switch (def->op) {
+			case OpCode::Load:
+				if (!isInvariantLoad(loop, def))
+					return false;
+				break;
+
+			case OpCode::GetElementPtr:
+			case OpCode::Cast:
+			case OpCode::Add:
+			case OpCode::Sub:
+			case OpCode::Mul:
+				for (Value* op : def->operands)
+					if (!collectHoistable(loop, op, chain, depth + 1))
+						return false;
+				break;
+
+			default:
+				return false;
+			}
+
+			for (const Instruction* insn : chain)
+				if (insn == def)
+					return true;
+			chain.emplace(def);
+			return true;
+		}
+
+		void collectDerived(const CountedLoop& loop, tea::vector<DerivedIV>& ivs, tea::vector<const Instruction*>& chain) {
+			bool luau = isLuauTarget(module);
+			uint8_t bits = loop.bits;
+
+			for (BasicBlock* block : loop.region) {
+				for (auto& insn : block->body) {
+					Value* operand = nullptr;
+
+					switch (insn.op) {
+					case OpCode::Mul:
+						if (insn.operands[0] == loop.counterLoad && isIntConstant(insn.operands[1]))
+							operand = insn.operands[1];
+						else if (insn.operands[1] == loop.counterLoad && isIntConstant(insn.operands[0]))
+							operand = insn.operands[0];
+						break;
+
+					case OpCode::Shl:
+						if (insn.operands[0] == loop.counterLoad && isIntConstant(insn.operands[1]) && ((ConstantNumber*)insn.operands[1])->getInteger() < bits)
+							operand = insn.operands[1];
+						break;
+
+					case OpCode::GetElementPtr: {
+						if (luau || insn.operands.size != 2 || insn.operands[1] != loop.counterLoad)
+							break;
+
+						uint32_t before = chain.size;
+						if (collectHoistable(loop, insn.operands[0], chain))
+							operand = insn.operands[0];
+						else while (chain.size > before)
+							chain.pop();
+					} break;
+
+					default:
+						break;
+					}
+
+					if (!operand)
+						continue;
+
+					DerivedIV* iv = nullptr;
+					for (auto& other : ivs)
+						if (other.op == insn.op && other.operand == operand)
+							iv = &other;
+
+					if (!iv) {
+						iv = ivs.emplace();
+						iv->op = insn.op;
+						iv->operand = operand;
+					}
+					iv->users.emplace(insn.result.get());
+				}
+			}
+		}
+
+		void reduce(const CountedLoop& loop) {
+			tea::vector<DerivedIV> ivs;
+			tea::vector<const Instruction*> chain;
+			collectDerived(loop, ivs, chain);
+			if (ivs.empty())
+				return;
+
+			Builder builder(module->ctx);
+
+			// the entry block may also be the preheader, so allocate the slots before anything is placed relative to its end
+			BasicBlock* entry = func->blocks[0].get();
+			tea::vector<Value*> slots;
+			for (const auto& iv : ivs) {
+				builder.block = entry;
+				uint32_t at = entry->body.size;
+				slots.emplace(builder.alloca_(iv.users[0]->type, "iv"));
+				moveTail(entry, at, 0);
+			}
+
+			// recompute the invariant parts of gep bases in the preheader
+			BasicBlock* preheader = loop.preheader;
+			uint32_t preheaderEnd = preheader->body.size - 1;
+
+			ValueMap hoisted;
+			for (const Instruction* insn : chain)
+				cloneInstruction(*insn, preheader, hoisted);
+			remapOperands(preheader, hoisted, {});
+
+			builder.block = preheader;
+			Value* init = builder.load(loop.counter, "");
+
+			BasicBlock* latch = loop.latch;
+			uint32_t latchEnd = latch->body.size - 1;
+
+			ValueMap replacements;
+			for (uint32_t i = 0; i < ivs.size; i++) {
+				const DerivedIV& iv = ivs[i];
+				Value* slot = slots[i];
+				Type* type = iv.users[0]->type;
+
+				// first value, computed from the counter's initial value
+				builder.block = preheader;
+				Value* first = nullptr;
+				Value* increment = nullptr;
+				switch (iv.op) {
+				case OpCode::Mul:
+				case OpCode::Shl: {
+					int64_t factor = ((ConstantNumber*)iv.operand)->getSInteger();
+					if (iv.op == OpCode::Shl)
+						factor = (int64_t)(1ull << factor);
+
+					first = iv.op == OpCode::Mul ? builder.arithm(OpCode::Mul, init, iv.operand, "") : builder.binop(OpCode::Shl, init, iv.operand, "");
+					increment = ConstantNumber::get(module, (uint64_t)(factor * loop.step), loop.bits, type->sign);
+				} break;
+
+				case OpCode::GetElementPtr: {
+					Value* base = iv.operand;
+					if (Value** mapped = hoisted.find(base))
+						base = *mapped;
+
+					first = builder.gep(base, &init, 1, "");
+					increment = ConstantNumber::get(module, (uint64_t)loop.step, 32);
+				} break;
+
+				default:
+					TEA_UNREACHABLE();
+				}
+				builder.store(slot, first);
+
+				// current value, read once per iteration in the header
+				builder.block = loop.header;
+				uint32_t at = loop.header->body.size;
+				Value* current = builder.load(slot, "");
+				moveTail(loop.header, at, 0);
+
+				// advance along with the counter
+				builder.block = latch;
+				Value* next = iv.op == OpCode::GetElementPtr ? builder.gep(current, &increment, 1, "") : builder.arithm(OpCode::Add, current, increment, "");
+				builder.store(slot, next);
+
+				for (Value* user : iv.users)
+					replacements[user] = current;
+				reduced++;
+			}
+
+			moveTail(preheader, preheaderEnd + 1, preheaderEnd);
+			moveTail(latch, latchEnd + 1, latchEnd);
+
+			for (BasicBlock* block : loop.region)
+				for (auto& insn : block->body)
+					if (insn.result && replacements.contains(insn.result.get()))
+						erase(&insn);
+			replaceUses(replacements);
+		}
+	};
+
+	uint32_t simplifyInductionVariables(Function* func, const PassOptions& options) {
+		IVSimplifier simplifier(func);
+		simplifier.run();
+
+		uint32_t changes = simplifier.canonicalized + simplifier.reduced;
+		if (options.verbose && changes)
+			printf("MIR: '%s': %u counter load(s) folded, %u induction variable(s) reduced\n",
+				func->name, simplifier.canonicalized, simplifier.reduced);
+
+		return changes;
+	}
+
+} // namespace tea::mir
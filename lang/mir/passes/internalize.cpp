@@ -0,0 +1,48 @@
+#include "passes.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include "core/tea.h"
+#include "mir/passes/utils.h"
+
+// Internal calling convention
+//
+// A private function whose address is never taken is only ever called directly from this module, so nothing
+// outside of it depends on how its arguments are passed. Such functions without an explicit calling convention
+// are switched to `fast`, which the backend lowers to LLVM's fastcc along with every call of them. Together with
+// their internal linkage this lets LLVM change how arguments are passed, and inline or drop them more freely
+
+namespace tea::mir {
+
+	uint32_t internalizeFunctions(Module* module, const PassOptions& options) {
+		// Luau has a single calling convention
+		if (isLuauTarget(module))
+			return 0;
+
+		CallGraph graph(module);
+
+		uint32_t count = 0;
+		for (const CallGraph::Node& node : graph.nodes) {
+			Function* func = node.func;
+			if (func->blocks.empty() || func->hasAttribute(FunctionAttribute::Inline) || func->cc != CallingConvention::Auto)
+				continue;
+
+			if (func->storage != StorageClass::Private || func->linkName || node.addressTaken || (func->name && !strcmp(func->name, "main")))
+				continue;
+
+			// fastcc has no variadic form
+			if (((FunctionType*)func->type)->extra)
+				continue;
+
+			func->cc = CallingConvention::Fast;
+			count++;
+		}
+
+		if (options.verbose && count)
+			printf("MIR: switched %u function(s) to fastcc\n", count);
+
+		return count;
+	}
+
+} // namespace tea::mir
@@ -0,0 +1,356 @@
+#include "passes.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "core/tea.h"
+#include "mir/passes/utils.h"
+
+// Interprocedural constant propagation and function specialization
+//
+//   private func f(int x, int mode)          private func f(int x, int mode)
+//       ... %mode ...                  =>        ... int 2 ...
+//   call @f(%a, 2); call @f(%b, 2)
+//
+// Every parameter of a private function whose address is never taken starts out unknown and is joined with
+// the argument of every call site. Arguments that are parameters of another such function contribute that
+// parameter's value, so constants flow through chains of calls. Parameters that end up with a single
+// constant are replaced by it in the callee.
+//
+// Call sites that pass constants the callee doesn't always get are grouped by those constants. Groups called
+// from a loop or from more than one place get a clone of the callee (`f.spec.N`) with the constants
+// substituted, as long as the callee is small enough and the module's growth budget isn't used up
+
+namespace tea::mir {
+
+	// callees with more instructions than this are never cloned
+	static constexpr uint32_t maxSpecializationSize = 256;
+	// clones of a single function
+	static constexpr uint32_t maxSpecializations = 4;
+	// instructions any module may grow by, larger modules may grow by an eighth of their size
+	static constexpr uint32_t minGrowthBudget = 512;
+
+	class ArgumentPropagator {
+		struct ParamState {
+			Value* constant = nullptr;
+			bool overdefined = false;
+		};
+
+		struct ParamRef {
+			Function* func = nullptr;
+			uint32_t index = 0;
+		};
+
+		struct Group {
+			Function* callee = nullptr;
+			// constants by parameter index, null for parameters that stay variable
+			tea::vector<Value*> constants;
+			tea::vector<CallGraph::CallSite> sites;
+			bool hot = false;
+			uint32_t score = 0;
+		};
+
+		Module* module;
+		const PassOptions& options;
+
+		tea::map<const Function*, tea::vector<ParamState>> states;
+		tea::map<const Value*, ParamRef> params;
+
+	public:
+		uint32_t propagated = 0;
+		uint32_t specialized = 0;
+
+		ArgumentPropagator(Module* module, const PassOptions& options)
+			: module(module), options(options) {
+		}
+
+		void run() {
+			propagate();
+			specialize();
+		}
+
+	private:
+		static bool isDefinition(const Function* func) {
+			return !func->blocks.empty() && !func->hasAttribute(FunctionAttribute::Inline);
+		}
+
+		static uint32_t countInstructions(const Function* func) {
+			uint32_t size = 0;
+			for (const auto& block : func->blocks)
+				size += block->body.size;
+			return size;
+		}
+
+		// whether `arg` can stand in for `param` everywhere in the callee
+		static bool isPropagatable(const Value* arg, const Value* param) {
+			switch (arg->kind) {
+			case ValueKind::Global:
+			case ValueKind::Function:
+				return arg->type == param->type;
+
+			case ValueKind::Constant: {
+				if ((ConstantKind)arg->subclassData != ConstantKind::Number || arg->type->kind != param->type->kind)
+					return false;
+
+				// shifts and casts of the value look at its type's sign, which only matters for negative numbers
+				const ConstantNumber* num = (const ConstantNumber*)arg;
+				return arg->type->isFloat() || arg->type->sign == param->type->sign || num->getSInteger() >= 0;
+			}
+
+			default:
+				return false;
+			}
+		}
+
+		static bool isSameConstant(const Value* a, const Value* b) {
+			if (a == b)
+				return true;
+			if (a->kind != ValueKind::Constant || b->kind != ValueKind::Constant || a->type->kind != b->type->kind)
+				return false;
+			return ((const ConstantNumber*)a)->getInteger() == ((const ConstantNumber*)b)->getInteger();
+		}
+
+		static bool hasUses(const Function* func, const Value* v) {
+			for (const auto& block : func->blocks)
+				for (const auto& insn : block->body)
+					for (uint32_t i = insn.op == OpCode::Phi ? 1 : 0; i < insn.operands.size; i++)
+						if (insn.operands[i] == v)
+							return true;
+			return false;
+		}
+
+		// the value `arg` contributes to a parameter, null while it is still unknown
+		Value* resolve(Value* arg, bool& overdefined) const {
+			if (arg->kind == ValueKind::Parameter) {
+				const ParamRef* ref = params.find(arg);
+				if (!ref) {
+					overdefined = true;
+					return nullptr;
+				}
+
+				const ParamState& state = (*states.find(ref->func))[ref->index];
+				overdefined = state.overdefined;
+				return state.constant;
+			}
+
+			overdefined = false;
+			return arg;
+		}
+
+		void propagate() {
+			CallGraph graph(module);
+
+			for (const auto& node : graph.nodes) {
+				Function* func = node.func;
+				if (func->storage != StorageClass::Private || !isDefinition(func) || node.addressTaken || node.callers.empty())
+					continue;
+
+				states[func] = tea::vector<ParamState>(func->params.size, ParamState());
+				for (uint32_t i = 0; i < func->params.size; i++)
+					params[func->getParam(i)] = { func, i };
+			}
+
+			bool changed = true;
+			while (changed) {
+				changed = false;
+
+				for (auto& [func, state] : states) {
+					for (const auto& site : graph.getNode(func)->callers) {
+						for (uint32_t i = 0; i < state.size; i++) {
+							ParamState& param = state[i];
+							if (param.overdefined)
+								continue;
+
+							bool overdefined = false;
+							Value* arg = resolve(site.insn->operands[i + 1], overdefined);
+							if (!overdefined && !arg)
+								continue;
+
+							if (overdefined || !isPropagatable(arg, func->getParam(i)) || (param.constant && !isSameConstant(param.constant, arg))) {
+								param.overdefined = true;
+								param.constant = nullptr;
+								changed = true;
+							} else if (!param.constant) {
+								param.constant = arg;
+								changed = true;
+							}
+						}
+					}
+				}
+			}
+
+			for (auto& [func, state] : states) {
+				ValueMap vmap;
+				for (uint32_t i = 0; i < state.size; i++) {
+					if (state[i].overdefined || !state[i].constant || !hasUses(func, func->getParam(i)))
+						continue;
+
+					vmap[func->getParam(i)] = state[i].constant;
+					propagated++;
+				}
+
+				if (vmap.empty())
+					continue;
+
+				Function* f = (Function*)func;
+				for (const auto& block : f->blocks)
+					remapOperands(block.get(), vmap, {});
+
+				if (options.verbose)
+					printf("MIR: '%s': %u constant argument(s) propagated\n", func->name, vmap.size());
+			}
+		}
+
+		void collectGroups(const CallGraph& graph, tea::vector<Group>& groups) {
+			for (const auto& node : graph.nodes) {
+				Function* callee = node.func;
+				if (!isDefinition(callee) || countInstructions(callee) > maxSpecializationSize)
+					continue;
+
+				tea::vector<bool> used;
+				for (uint32_t i = 0; i < callee->params.size; i++)
+					used.emplace(hasUses(callee, callee->getParam(i)));
+
+				uint32_t first = groups.size;
+				for (const auto& site : node.callers) {
+					// recursive calls stay with the original, the clone is copied from the callee's body
+					if (site.caller == callee)
+						continue;
+
+					tea::vector<Value*> constants;
+					bool any = false;
+					for (uint32_t i = 0; i < callee->params.size; i++) {
+						Value* arg = site.insn->operands[i + 1];
+						bool constant = used[i] && isPropagatable(arg, callee->getParam(i));
+						constants.emplace(constant ? arg : nullptr);
+						any |= constant;
+					}
+
+					if (!any)
+						continue;
+
+					Group* group = nullptr;
+					for (uint32_t g = first; g < groups.size && !group; g++) {
+						bool same = true;
+						for (uint32_t i = 0; i < constants.size && same; i++) {
+							Value* a = groups[g].constants[i];
+							same = a == constants[i] || (a && constants[i] && isSameConstant(a, constants[i]));
+						}
+						if (same)
+							group = &groups[g];
+					}
+
+					if (!group) {
+						group = groups.emplace();
+						group->callee = callee;
+						group->constants = std::move(constants);
+					}
+					group->sites.emplace(site);
+
+					const ControlFlowGraph& cfg = site.caller->getCFG();
+					if (site.caller->getLoopNest().getDepth(cfg.getIndex(site.block)) > 0)
+						group->hot = true;
+				}
+			}
+
+			for (Group& group : groups) {
+				uint32_t constants = 0;
+				for (Value* c : group.constants)
+					constants += c != nullptr;
+
+				group.hot |= group.sites.size > 1;
+				group.score = group.sites.size * constants * (group.hot ? 8 : 1);
+			}
+
+			std::stable_sort(groups.begin(), groups.end(), [](const Group& a, const Group& b) { return a.score > b.score; });
+		}
+
+		Function* clone(const Group& group) {
+			Function* callee = group.callee;
+
+			tea::string name = tea::string(callee->name) + ".spec." + std::to_string(specialized).c_str();
+			// appended to the module, every function is declared before any is lowered so its place doesn't matter
+			Function* f = module->addFunction(name, (FunctionType*)callee->type);
+
+			f->subclassData = callee->subclassData;
+			f->storage = StorageClass::Private;
+			f->cc = callee->cc;
+			f->fsrc = callee->fsrc;
+			f->line = callee->line;
+
+			ValueMap vmap;
+			for (uint32_t i = 0; i < callee->params.size; i++)
+				vmap[callee->getParam(i)] = group.constants[i] ? group.constants[i] : f->getParam(i);
+
+			BlockMap bmap;
+			for (const auto& block : callee->blocks) {
+				BasicBlock* copy = f->appendBlock(block->name);
+				copy->unrollHint = block->unrollHint;
+				bmap[block.get()] = copy;
+			}
+
+			for (const auto& block : callee->blocks)
+				for (const auto& insn : block->body)
+					cloneInstruction(insn, *bmap.find(block.get()), vmap);
+
+			for (const auto& block : f->blocks)
+				remapOperands(block.get(), vmap, bmap);
+
+			return f;
+		}
+
+		void specialize() {
+			CallGraph graph(module);
+
+			uint32_t moduleSize = 0;
+			for (const auto& node : graph.nodes)
+				moduleSize += countInstructions(node.func);
+			uint32_t budget = std::max(minGrowthBudget, moduleSize / 8);
+
+			tea::vector<Group> groups;
+			collectGroups(graph, groups);
+
+			tea::map<const Function*, uint32_t> clones;
+			for (const Group& group : groups) {
+				if (!group.hot)
+					continue;
+
+				uint32_t size = countInstructions(group.callee);
+				uint32_t& count = clones[group.callee];
+				if (size > budget || count >= maxSpecializations) {
+					if (options.verbose)
+						printf("MIR: not specializing '%s' for %u call site(s), %s\n", group.callee->name, group.sites.size,
+							size > budget ? "over the size budget" : "too many clones");
+					continue;
+				}
+
+				Function* f = clone(group);
+				for (const auto& site : group.sites)
+					site.insn->operands[0] = f;
+
+				if (options.verbose)
+					printf("MIR: specialized '%s' as '%s' for %u call site(s), %u instruction(s)\n", group.callee->name, f->name, group.sites.size, size);
+
+				budget -= size;
+				count++;
+				specialized++;
+			}
+		}
+	};
+
+	uint32_t propagateArguments(Module* module, const PassOptions& options) {
+		ArgumentPropagator propagator(module, options);
+		propagator.run();
+
+		// call sites were rated by their loop depth
+		for (const auto& value : module->body)
+			if (value->kind == ValueKind::Function)
+				((Function*)value.get())->invalidateAnalyses();
+
+		if (options.verbose && (propagator.propagated || propagator.specialized))
+			printf("MIR: propagated %u constant argument(s), %u specialization(s)\n", propagator.propagated, propagator.specialized);
+
+		return propagator.propagated + propagator.specialized;
+	}
+
+} // namespace tea::mir
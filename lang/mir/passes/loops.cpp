@@ -0,0 +1,286 @@
+#include "loops.h"
+
+#include "core/tea.h"
+
+namespace tea::mir {
+
+	// how many single-predecessor blocks to walk back looking for the counter's initial value
+	static constexpr uint32_t maxInitSearchDepth = 8;
+
+	void LoopAnalysis::recompute() {
+		computePredecessors(func, preds);
+
+		defs.clear();
+		for (const auto& block : func->blocks)
+			for (const auto& insn : block->body)
+				if (insn.result)
+					defs[insn.result.get()] = { block.get(), &insn };
+	}
+
+	const Instruction* LoopAnalysis::getDef(const Value* v, BasicBlock** block) const {
+		const Definition* def = defs.find(v);
+		if (!def)
+			return nullptr;
+		if (block)
+			*block = def->block;
+		return def->insn;
+	}
+
+	bool LoopAnalysis::isEscaping(const Value* ptr) const {
+		const Instruction* def = getDef(ptr);
+		if (!def || def->op != OpCode::Alloca)
+			return true;
+
+		for (const auto& block : func->blocks) {
+			for (const auto& insn : block->body) {
+				for (uint32_t i = 0; i < insn.operands.size; i++) {
+					if (insn.operands[i] != ptr)
+						continue;
+					if (i == 0 && (insn.op == OpCode::Load || insn.op == OpCode::Store))
+						continue;
+					return true;
+				}
+			}
+		}
+
+		return false;
+	}
+
+	bool LoopAnalysis::hasCycle(const CountedLoop& loop, BasicBlock* block, tea::map<const BasicBlock*, uint8_t>& state) const {
+		state[block] = 1;
+
+		tea::vector<BasicBlock*> succs;
+		getSuccessors(block, succs);
+		for (BasicBlock* succ : succs) {
+			if (!loop.inRegion(succ))
+				continue;
+
+			uint8_t s = state[succ];
+			if (s == 1 || (s == 0 && hasCycle(loop, succ, state)))
+				return true;
+		}
+
+		state[block] = 2;
+		return false;
+	}
+
+	bool LoopAnalysis::collectRegion(CountedLoop& loop) const {
+		tea::vector<BasicBlock*> worklist;
+		worklist.emplace(loop.body);
+		loop.region.emplace(loop.body);
+
+		tea::vector<BasicBlock*> succs;
+		while (!worklist.empty()) {
+			BasicBlock* block = worklist[worklist.size - 1];
+			worklist.pop();
+
+			succs.clear();
+			getSuccessors(block, succs);
+			for (BasicBlock* succ : succs) {
+				if (succ == loop.header) {
+					if (loop.latch)
+						return false;
+					loop.latch = block;
+					continue;
+				}
+
+				if (succ == loop.exit) {
+					loop.hasBreak = true;
+					continue;
+				}
+
+				if (succ == func->blocks[0].get())
+					return false;
+
+				if (!loop.inRegion(succ)) {
+					loop.region.emplace(succ);
+					worklist.emplace(succ);
+				}
+			}
+		}
+
+		if (!loop.latch || loop.latch->getTerminator()->op != OpCode::Br)
+			return false;
+
+		// keep function order so that clones keep definitions ahead of their uses
+		tea::vector<BasicBlock*> sorted;
+		for (const auto& block : func->blocks)
+			if (loop.inRegion(block.get()))
+				sorted.emplace(block.get());
+		loop.region = std::move(sorted);
+
+		// no side entries
+		for (BasicBlock* block : loop.region)
+			for (BasicBlock* pred : *preds.find(block))
+				if (!loop.inRegion(pred) && !(block == loop.body && pred == loop.header))
+					return false;
+
+		// innermost loops only
+		tea::map<const BasicBlock*, uint8_t> state;
+		return !hasCycle(loop, loop.body, state);
+	}
+
+	bool LoopAnalysis::isInvariant(const CountedLoop& loop, Value* v) const {
+		switch (v->kind) {
+		case ValueKind::Constant:
+		case ValueKind::Parameter:
+		case ValueKind::Global:
+		case ValueKind::Function:
+			return true;
+
+		case ValueKind::Instruction: {
+			BasicBlock* block = nullptr;
+			const Instruction* def = getDef(v, &block);
+			if (!def)
+				return false;
+			if (!loop.contains(block))
+				return true;
+
+			// a load in the header of a local that is never written in the loop
+			if (block != loop.header || def->op != OpCode::Load || def->operands[0] == loop.counter || isEscaping(def->operands[0]))
+				return false;
+
+			for (BasicBlock* b : loop.region)
+				for (const auto& insn : b->body)
+					if (insn.op == OpCode::Store && insn.operands[0] == def->operands[0])
+						return false;
+			return true;
+		}
+
+		default:
+			return false;
+		}
+	}
+
+	bool LoopAnalysis::findCounter(CountedLoop& loop) const {
+		const Instruction* term = loop.header->getTerminator();
+
+		BasicBlock* condBlock = nullptr;
+		loop.cond = getDef(term->operands[0], &condBlock);
+		if (!loop.cond || condBlock != loop.header || loop.cond->op != OpCode::ICmp)
+			return false;
+
+		for (uint32_t side = 0; side < 2; side++) {
+			BasicBlock* loadBlock = nullptr;
+			const Instruction* load = getDef(loop.cond->operands[side], &loadBlock);
+			if (!load || load->op != OpCode::Load || loadBlock != loop.header)
+				continue;
+
+			Type* type = load->result->type;
+			if (!type->isNumeric() || type->isFloat() || type->kind == TypeKind::Bool || isEscaping(load->operands[0]))
+				continue;
+
+			loop.counter = load->operands[0];
+			loop.counterLoad = loop.cond->operands[side];
+			loop.bound = loop.cond->operands[side ^ 1];
+			loop.bits = (uint8_t)(func->parent->getSize(type) * 8);
+
+			loop.pred = (ICmpPredicate)loop.cond->extra;
+			if (side == 1) {
+				switch (loop.pred) {
+				case ICmpPredicate::SGT: loop.pred = ICmpPredicate::SLT; break;
+				case ICmpPredicate::UGT: loop.pred = ICmpPredicate::ULT; break;
+				case ICmpPredicate::SGE: loop.pred = ICmpPredicate::SLE; break;
+				case ICmpPredicate::UGE: loop.pred = ICmpPredicate::ULE; break;
+				case ICmpPredicate::SLT: loop.pred = ICmpPredicate::SGT; break;
+				case ICmpPredicate::ULT: loop.pred = ICmpPredicate::UGT; break;
+				case ICmpPredicate::SLE: loop.pred = ICmpPredicate::SGE; break;
+				case ICmpPredicate::ULE: loop.pred = ICmpPredicate::UGE; break;
+				default: break;
+				}
+			}
+
+			loop.boundInvariant = isInvariant(loop, loop.bound);
+			return true;
+		}
+
+		return false;
+	}
+
+	bool LoopAnalysis::findStep(CountedLoop& loop) const {
+		for (const auto& insn : loop.header->body)
+			if (insn.op == OpCode::Store && insn.operands[0] == loop.counter)
+				return false;
+
+		const Instruction* store = nullptr;
+		for (BasicBlock* block : loop.region) {
+			for (const auto& insn : block->body) {
+				if (insn.op != OpCode::Store || insn.operands[0] != loop.counter)
+					continue;
+				if (store || block != loop.latch)
+					return false;
+				store = &insn;
+			}
+		}
+
+		if (!store)
+			return false;
+
+		const Instruction* inc = getDef(store->operands[1]);
+		if (!inc || (inc->op != OpCode::Add && inc->op != OpCode::Sub))
+			return false;
+
+		for (uint32_t side = 0; side < 2; side++) {
+			const Instruction* load = getDef(inc->operands[side]);
+			Value* step = inc->operands[side ^ 1];
+			if (!load || load->op != OpCode::Load || load->operands[0] != loop.counter)
+				continue;
+			if (step->kind != ValueKind::Constant || (ConstantKind)step->subclassData != ConstantKind::Number)
+				continue;
+			if (inc->op == OpCode::Sub && side == 1)
+				return false;
+
+			int64_t value = ((ConstantNumber*)step)->getSInteger();
+			loop.step = inc->op == OpCode::Add ? value : -value;
+			return loop.step != 0;
+		}
+
+		return false;
+	}
+
+	bool LoopAnalysis::analyze(BasicBlock* header, CountedLoop& loop) const {
+		const Instruction* term = header->getTerminator();
+		if (!term || term->op != OpCode::CondBr)
+			return false;
+
+		loop.header = header;
+		loop.body = (BasicBlock*)term->operands[1];
+		loop.exit = (BasicBlock*)term->operands[2];
+		if (loop.body == loop.exit || loop.body == header || loop.exit == header || loop.body == func->blocks[0].get())
+			return false;
+
+		if (!collectRegion(loop))
+			return false;
+
+		for (BasicBlock* pred : *preds.find(header)) {
+			if (loop.inRegion(pred))
+				continue;
+			if (loop.preheader)
+				return false;
+			loop.preheader = pred;
+		}
+
+		if (!loop.preheader || loop.preheader->getTerminator()->op != OpCode::Br)
+			return false;
+
+		return findCounter(loop) && findStep(loop);
+	}
+
+	Value* LoopAnalysis::findInitialValue(const CountedLoop& loop) const {
+		BasicBlock* block = loop.preheader;
+		for (uint32_t depth = 0; depth < maxInitSearchDepth; depth++) {
+			for (uint32_t i = block->body.size; i > 0; i--) {
+				const Instruction& insn = block->body[i - 1];
+				if (insn.op == OpCode::Store && insn.operands[0] == loop.counter)
+					return insn.operands[1];
+			}
+
+			const tea::vector<BasicBlock*>& p = *preds.find(block);
+			if (p.size != 1)
+				return nullptr;
+			block = p[0];
+		}
+		return nullptr;
+	}
+
+} // namespace tea::mir
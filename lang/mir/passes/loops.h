@@ -0,0 +1,108 @@
+#pragma once
+
+#include "mir/mir.h"
+#include "mir/passes/utils.h"
+
+namespace tea::mir {
+	// A loop in the shape CodeGen emits for `for`/`while` loops:
+	//
+	//   preheader: ...; br header
+	//   header:    %i = load %i.addr; %c = icmp %i, %bound; condbr %c, body, exit
+	//   body...:   acyclic region, exactly one latch ending in `br header`
+	//   latch:     ...; %n = add %i', step; store %i.addr, %n; br header
+	//
+	// where %i.addr is an alloca that never escapes and is only stored to once inside the loop
+	struct CountedLoop {
+		BasicBlock* header = nullptr;
+		BasicBlock* preheader = nullptr;
+		BasicBlock* body = nullptr;
+		BasicBlock* exit = nullptr;
+		BasicBlock* latch = nullptr;
+
+		// loop blocks excluding the header, in function order
+		tea::vector<BasicBlock*> region;
+		bool hasBreak = false;
+
+		const Instruction* cond = nullptr;
+
+		// predicate normalized so that the counter is on the left hand side
+		ICmpPredicate pred = ICmpPredicate::EQ;
+		Value* counterLoad = nullptr;
+		Value* counter = nullptr;
+		Value* bound = nullptr;
+		bool boundInvariant = false;
+
+		int64_t step = 0;
+		uint8_t bits = 0;
+
+		bool inRegion(const BasicBlock* block) const {
+			for (BasicBlock* b : region)
+				if (b == block)
+					return true;
+			return false;
+		}
+
+		bool contains(const BasicBlock* block) const {
+			return block == header || inRegion(block);
+		}
+	};
+
+	class LoopAnalysis {
+		struct Definition {
+			BasicBlock* block = nullptr;
+			const Instruction* insn = nullptr;
+		};
+
+		Function* func;
+		tea::map<const Value*, Definition> defs;
+
+	public:
+		PredecessorMap preds;
+
+		LoopAnalysis(Function* func) : func(func) {
+		}
+
+		/// <summary>
+		/// Rebuild the predecessor and definition tables, must be called after the function was modified
+		/// </summary>
+		void recompute();
+
+		/// <summary>
+		/// Try to recognize the counted loop headed by `header`
+		/// </summary>
+		/// <param name="header">A block ending in a conditional branch</param>
+		/// <param name="loop">The loop description to fill</param>
+		/// <returns>Whether `header` heads a counted innermost loop</returns>
+		bool analyze(BasicBlock* header, CountedLoop& loop) const;
+
+		/// <summary>
+		/// Find the instruction defining `v`
+		/// </summary>
+		/// <param name="v">The value to look up</param>
+		/// <param name="block">If not null, receives the block containing the definition</param>
+		/// <returns>The defining instruction or null if `v` isn't an instruction result</returns>
+		const Instruction* getDef(const Value* v, BasicBlock** block = nullptr) const;
+
+		/// <summary>
+		/// Check whether `ptr` is anything but an alloca used only as the address of loads and stores
+		/// </summary>
+		bool isEscaping(const Value* ptr) const;
+
+		/// <summary>
+		/// Check whether `v` has the same value in every iteration of `loop`
+		/// </summary>
+		bool isInvariant(const CountedLoop& loop, Value* v) const;
+
+		/// <summary>
+		/// Find the last value stored to the loop counter before the loop is entered
+		/// </summary>
+		/// <returns>The stored value or null if it can't be determined</returns>
+		Value* findInitialValue(const CountedLoop& loop) const;
+
+	private:
+		bool collectRegion(CountedLoop& loop) const;
+		bool findCounter(CountedLoop& loop) const;
+		bool findStep(CountedLoop& loop) const;
+		bool hasCycle(const CountedLoop& loop, BasicBlock* block, tea::map<const BasicBlock*, uint8_t>& state) const;
+	};
+}
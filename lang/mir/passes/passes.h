@@ -0,0 +1,127 @@
+#pragma once
+
+#include "mir/mir.h"
+
+namespace tea::mir {
+	struct PassOptions {
+		uint8_t optLevel = 0;
+		// 1 for -Os, 2 for -Oz
+		uint8_t sizeLevel = 0;
+		bool verbose = false;
+		// report the time and instruction counts of every pass
+		bool timePasses = false;
+	};
+
+	/// <summary>
+	/// How often each peephole rule of `combineInstructions` fired, keyed by rule name
+	/// </summary>
+	typedef tea::map<const char*, uint32_t> RuleHits;
+
+	/// <summary>
+	/// Run the MIR optimization pipeline matching `options.optLevel` over every function in the module
+	/// </summary>
+	/// <param name="module">The module to optimize</param>
+	/// <param name="options">Pipeline options</param>
+	void optimize(Module* module, const PassOptions& options);
+
+	/// <summary>
+	/// Remove the private functions and globals that can't be reached from the public definitions of the
+	/// module and `main`, along with unused function declarations
+	/// </summary>
+	/// <param name="module">The module to transform</param>
+	/// <param name="options">Pipeline options</param>
+	/// <returns>The number of removed functions and globals</returns>
+	uint32_t eliminateDeadGlobals(Module* module, const PassOptions& options);
+
+	/// <summary>
+	/// Replace the parameters of private functions that receive the same constant from every call site with
+	/// that constant, and call specialized clones of hot functions from sites that pass constants
+	/// </summary>
+	/// <param name="module">The module to transform</param>
+	/// <param name="options">Pipeline options</param>
+	/// <returns>The number of propagated arguments and specialized functions</returns>
+	uint32_t propagateArguments(Module* module, const PassOptions& options);
+
+	/// <summary>
+	/// Give private functions that are only ever called directly the fast calling convention, unless they
+	/// have one of their own
+	/// </summary>
+	/// <param name="module">The module to transform</param>
+	/// <param name="options">Pipeline options</param>
+	/// <returns>The number of functions switched to the fast calling convention</returns>
+	uint32_t internalizeFunctions(Module* module, const PassOptions& options);
+
+	/// <summary>
+	/// Work out which memory every function may touch, whether it can throw or loop forever, which parameters
+	/// are never null and which functions return fresh allocations, for the backend to pass on
+	/// </summary>
+	/// <param name="module">The module to analyze</param>
+	/// <param name="options">Pipeline options</param>
+	/// <returns>The number of attributes given to functions and parameters</returns>
+	uint32_t inferAttributes(Module* module, const PassOptions& options);
+
+	/// <summary>
+	/// Apply the peephole rules (algebraic identities, constant folding, cast chains) to every instruction of
+	/// `func` and remove unused side effect free instructions, repeating until nothing changes
+	/// </summary>
+	/// <param name="func">The function to transform</param>
+	/// <param name="options">Pipeline options</param>
+	/// <param name="hits">Receives the number of times each rule fired</param>
+	/// <returns>The number of rewrites performed</returns>
+	uint32_t combineInstructions(Function* func, const PassOptions& options, RuleHits& hits);
+
+	/// <summary>
+	/// Split struct and array allocas whose address doesn't escape the function and whose fields are only
+	/// accessed through constant indices into one alloca per field
+	/// </summary>
+	/// <param name="func">The function to transform</param>
+	/// <param name="options">Pipeline options</param>
+	/// <returns>The number of split aggregates</returns>
+	uint32_t splitAggregates(Function* func, const PassOptions& options);
+
+	/// <summary>
+	/// Turn calls of `func` to itself whose result is returned right away into parameter reassignment and a
+	/// jump back to the start of the function
+	/// </summary>
+	/// <param name="func">The function to transform</param>
+	/// <param name="options">Pipeline options</param>
+	/// <returns>The number of eliminated calls</returns>
+	uint32_t eliminateTailRecursion(Function* func, const PassOptions& options);
+
+	/// <summary>
+	/// Simplify the induction variables of counted loops: fold reloads of the counter and give values derived
+	/// from it (`i * C`, `base[i]`) their own additively updated slot
+	/// </summary>
+	/// <param name="func">The function to transform</param>
+	/// <param name="options">Pipeline options</param>
+	/// <returns>The number of rewrites performed</returns>
+	uint32_t simplifyInductionVariables(Function* func, const PassOptions& options);
+
+	/// <summary>
+	/// Unroll the counted innermost loops of `func`. Loops with a small constant trip count are unrolled
+	/// completely, other counted loops are unrolled by a fixed factor followed by the original loop as the remainder.
+	/// `@unroll(n)` hints on the loop header override the heuristics
+	/// </summary>
+	/// <param name="func">The function to transform</param>
+	/// <param name="options">Pipeline options</param>
+	/// <returns>The number of unrolled loops</returns>
+	uint32_t unrollLoops(Function* func, const PassOptions& options);
+
+	/// <summary>
+	/// Flatten diamonds and triangles in the control flow graph of `func` whose arms only compute a few values
+	/// and store to locals or globals, picking the results with `select` instead of branching
+	/// </summary>
+	/// <param name="func">The function to transform</param>
+	/// <param name="options">Pipeline options</param>
+	/// <returns>The number of converted branches</returns>
+	uint32_t convertBranches(Function* func, const PassOptions& options);
+
+	/// <summary>
+	/// Simplify the control flow graph of `func`: fold branches whose outcome is known, thread jumps through
+	/// blocks that only jump onward, merge blocks into their single predecessor and remove unreachable blocks
+	/// </summary>
+	/// <param name="func">The function to transform</param>
+	/// <param name="options">Pipeline options</param>
+	/// <returns>The number of removed blocks</returns>
+	uint32_t simplifyCFG(Function* func, const PassOptions& options);
+}
@@ -0,0 +1,149 @@
+#include "passes.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+
+namespace tea::mir {
+
+	// wall time and instruction counts of a pass, summed over every function it ran on
+	struct PassTiming {
+		const char* name;
+		uint32_t runs = 0;
+		double ms = 0;
+		uint64_t before = 0;
+		uint64_t after = 0;
+	};
+
+	static uint64_t countInstructions(const Function* func) {
+		uint64_t size = 0;
+		for (const auto& block : func->blocks)
+			size += block->body.size;
+		return size;
+	}
+
+	static uint64_t countInstructions(const Module* module) {
+		uint64_t size = 0;
+		for (const auto& value : module->body)
+			if (value->kind == ValueKind::Function)
+				size += countInstructions((const Function*)value.get());
+		return size;
+	}
+
+	// run `pass` over what `count` measures, recording it in `timings` if asked to
+	template<typename Count, typename Pass>
+	static uint32_t timePass(tea::vector<PassTiming>& timings, const PassOptions& options, const char* name, Count count, Pass pass) {
+		if (!options.timePasses)
+			return pass();
+
+		PassTiming* timing = nullptr;
+		for (auto& it : timings)
+			if (!strcmp(it.name, name))
+				timing = &it;
+		if (!timing)
+			timing = timings.emplace(PassTiming{ .name = name });
+
+		uint64_t before = count();
+		auto start = std::chrono::steady_clock::now();
+		uint32_t changes = pass();
+		auto end = std::chrono::steady_clock::now();
+
+		// `timings` doesn't grow while the pass runs, so `timing` is still valid
+		timing->runs++;
+		timing->ms += std::chrono::duration<double, std::milli>(end - start).count();
+		timing->before += before;
+		timing->after += count();
+		return changes;
+	}
+
+	void optimize(Module* module, const PassOptions& options) {
+		if (options.optLevel == 0)
+			return;
+
+		RuleHits hits;
+		uint32_t combined = 0;
+		uint32_t aggregates = 0;
+		uint32_t tailCalls = 0;
+		uint32_t simplified = 0;
+		uint32_t unrolled = 0;
+		uint32_t removedBlocks = 0;
+		uint32_t selects = 0;
+
+		tea::vector<PassTiming> timings;
+		auto runModule = [&](const char* name, auto pass) {
+			return timePass(timings, options, name, [module] { return countInstructions(module); }, pass);
+		};
+
+		// don't spend time optimizing what gets thrown away
+		uint32_t removedGlobals = runModule("globaldce", [&] { return eliminateDeadGlobals(module, options); });
+		uint32_t propagated = runModule("ipsccp", [&] { return propagateArguments(module, options); });
+
+		for (const auto& value : module->body) {
+			if (value->kind != ValueKind::Function)
+				continue;
+
+			Function* func = (Function*)value.get();
+			if (func->blocks.empty())
+				continue;
+
+			// passes edit blocks and instructions freely, so cached analyses are dropped after each of them
+			auto run = [&](const char* name, auto pass) {
+				uint32_t changes = timePass(timings, options, name, [func] { return countInstructions(func); }, pass);
+				func->invalidateAnalyses();
+				return changes;
+			};
+
+			combined += run("combine", [&] { return combineInstructions(func, options, hits); });
+			aggregates += run("sroa", [&] { return splitAggregates(func, options); });
+			tailCalls += run("tailcall", [&] { return eliminateTailRecursion(func, options); });
+			simplified += run("indvars", [&] { return simplifyInductionVariables(func, options); });
+			unrolled += run("unroll", [&] { return unrollLoops(func, options); });
+			combined += run("combine", [&] { return combineInstructions(func, options, hits); });
+			removedBlocks += run("simplifycfg", [&] { return simplifyCFG(func, options); });
+
+			// arms are easiest to recognize once empty blocks are threaded, and leave blocks to merge behind
+			uint32_t converted = run("ifconvert", [&] { return convertBranches(func, options); });
+			if (converted)
+				removedBlocks += run("simplifycfg", [&] { return simplifyCFG(func, options); });
+			selects += converted;
+		}
+
+		// calls in blocks removed above may have been the last uses
+		removedGlobals += runModule("globaldce", [&] { return eliminateDeadGlobals(module, options); });
+
+		uint32_t fastcc = runModule("fastcc", [&] { return internalizeFunctions(module, options); });
+
+		// last, nothing may change the functions after this
+		uint32_t attributes = runModule("attrs", [&] { return inferAttributes(module, options); });
+
+		if (options.verbose) {
+			printf("MIR: %u interprocedural constant(s) and specialization(s)\n", propagated);
+			printf("MIR: split %u aggregate(s)\n", aggregates);
+			printf("MIR: eliminated %u tail call(s)\n", tailCalls);
+			printf("MIR: %u induction variable rewrite(s)\n", simplified);
+			printf("MIR: unrolled %u loop(s)\n", unrolled);
+			printf("MIR: %u peephole rewrite(s)\n", combined);
+			for (const auto& [rule, count] : hits)
+				printf("MIR:   %-12s %u\n", rule, count);
+			printf("MIR: removed %u block(s)\n", removedBlocks);
+			printf("MIR: converted %u branch(es) to selects\n", selects);
+			printf("MIR: removed %u function(s) and global(s)\n", removedGlobals);
+			printf("MIR: switched %u function(s) to fastcc\n", fastcc);
+			printf("MIR: inferred %u attribute(s)\n", attributes);
+		}
+
+		if (options.timePasses) {
+			double total = 0;
+			for (const auto& timing : timings)
+				total += timing.ms;
+
+			printf("MIR: pass timings\n");
+			printf("MIR:   %-12s %6s %10s %6s %12s %12s\n", "pass", "runs", "time (ms)", "%", "insns before", "insns after");
+			for (const auto& timing : timings)
+				printf("MIR:   %-12s %6u %10.3f %5.1f%% %12llu %12llu\n", timing.name, timing.runs, timing.ms,
+					total > 0 ? timing.ms * 100 / total : 0.0, (unsigned long long)timing.before, (unsigned long long)timing.after);
+			printf("MIR:   %-12s %6s %10.3f\n", "total", "", total);
+		}
+	}
+
+} // namespace tea::mir
@@ -0,0 +1,304 @@
+#include "passes.h"
+
+#include <algorithm>
+#include <cstdio>
+
+#include "core/tea.h"
+#include "mir/passes/utils.h"
+
+// Control flow graph simplification, repeated until nothing changes:
+//   - unreferenced `nop`s are dropped so that blocks end in their terminator again
+//   - `condbr` and `switch` with a constant condition or only one distinct target become `br`
+//   - jumps to a block that only jumps onward go to the final target directly
+//   - a block whose single predecessor unconditionally jumps to it is appended to that predecessor
+//   - blocks that can't be reached from the entry block are removed
+
+namespace tea::mir {
+
+	class CFGSimplifier {
+		Function* func;
+		PredecessorMap preds;
+
+	public:
+		CFGSimplifier(Function* func) : func(func) {
+		}
+
+		void run() {
+			removeNops();
+
+			bool changed = true;
+			while (changed) {
+				changed = foldBranches();
+				changed |= removeUnreachable();
+				changed |= threadJumps();
+				changed |= removeUnreachable();
+				changed |= mergeBlocks();
+			}
+		}
+
+		uint32_t countJumps() const {
+			uint32_t jumps = 0;
+			for (const auto& block : func->blocks) {
+				const Instruction* term = block->getTerminator();
+				if (term && (term->op == OpCode::Br || term->op == OpCode::CondBr))
+					jumps++;
+			}
+			return jumps;
+		}
+
+	private:
+		static bool hasPhis(const BasicBlock* block) {
+			for (const auto& insn : block->body)
+				if (insn.op == OpCode::Phi)
+					return true;
+			return false;
+		}
+
+		// drop the incoming values of every phi in `block` that flow in from `pred`
+		static void removeIncoming(BasicBlock* block, const BasicBlock* pred) {
+			for (auto& insn : block->body) {
+				if (insn.op != OpCode::Phi)
+					continue;
+
+				tea::vector<Value*> operands = insn.operands;
+				insn.operands.clear();
+				insn.operands.emplace(operands[0]);
+				for (uint32_t i = 1; i + 1 < operands.size; i += 2) {
+					if (operands[i + 1] == (Value*)pred)
+						continue;
+					insn.operands.emplace(operands[i]);
+					insn.operands.emplace(operands[i + 1]);
+				}
+			}
+		}
+
+		void removeNops() {
+			tea::map<const Value*, bool> used;
+			for (const auto& block : func->blocks)
+				for (const auto& insn : block->body)
+					for (Value* op : insn.operands)
+						used[op] = true;
+
+			for (const auto& block : func->blocks) {
+				auto& body = block->body;
+				Instruction* end = std::remove_if(body.begin(), body.end(), [&](const Instruction& insn) {
+					return insn.op == OpCode::Nop && !(insn.result && used.contains(insn.result.get()));
+				});
+
+				uint32_t count = (uint32_t)(end - body.begin());
+				while (body.size > count)
+					body.pop();
+			}
+		}
+
+		// the target of `switch` for a constant condition, or its only target, null if it can't be folded
+		static BasicBlock* getSwitchTarget(const Instruction* term) {
+			Value* cond = term->operands[0];
+			if (cond->kind == ValueKind::Constant && (ConstantKind)cond->subclassData == ConstantKind::Number) {
+				// constants aren't always truncated to their type, only the bits of the switch type count
+				uint8_t bits = ((ConstantNumber*)cond)->getBitwidth();
+				if (!bits)
+					return nullptr;
+				uint64_t mask = bits >= 64 ? ~0ull : (1ull << bits) - 1;
+
+				uint64_t value = ((ConstantNumber*)cond)->getInteger() & mask;
+				for (uint32_t i = 2; i + 1 < term->operands.size; i += 2)
+					if ((((ConstantNumber*)term->operands[i])->getInteger() & mask) == value)
+						return (BasicBlock*)term->operands[i + 1];
+				return (BasicBlock*)term->operands[1];
+			}
+
+			BasicBlock* target = (BasicBlock*)term->operands[1];
+			for (uint32_t i = 3; i < term->operands.size; i += 2)
+				if (term->operands[i] != (Value*)target)
+					return nullptr;
+			return hasPhis(target) ? nullptr : target;
+		}
+
+		bool foldSwitch(BasicBlock* block, Instruction* term) {
+			BasicBlock* target = getSwitchTarget(term);
+			if (!target)
+				return false;
+
+			tea::vector<BasicBlock*> succs;
+			getSuccessors(block, succs);
+			for (BasicBlock* succ : succs)
+				if (succ != target)
+					removeIncoming(succ, block);
+
+			term->op = OpCode::Br;
+			term->operands.clear();
+			term->operands.emplace((Value*)target);
+			return true;
+		}
+
+		bool foldBranches() {
+			bool changed = false;
+			for (const auto& block : func->blocks) {
+				Instruction* term = (Instruction*)block->getTerminator();
+				if (term && term->op == OpCode::Switch) {
+					changed |= foldSwitch(block.get(), term);
+					continue;
+				}
+				if (!term || term->op != OpCode::CondBr)
+					continue;
+
+				Value* cond = term->operands[0];
+				BasicBlock* target = nullptr;
+				BasicBlock* dropped = nullptr;
+				// a phi can't tell two edges from the same block apart once they are one, so leave those alone
+				if (term->operands[1] == term->operands[2]) {
+					if (hasPhis((BasicBlock*)term->operands[1]))
+						continue;
+					target = (BasicBlock*)term->operands[1];
+				} else if (cond->kind == ValueKind::Constant && (ConstantKind)cond->subclassData == ConstantKind::Number) {
+					bool taken = ((ConstantNumber*)cond)->getInteger() & 1;
+					target = (BasicBlock*)term->operands[taken ? 1 : 2];
+					dropped = (BasicBlock*)term->operands[taken ? 2 : 1];
+				} else
+					continue;
+
+				term->op = OpCode::Br;
+				term->operands.clear();
+				term->operands.emplace((Value*)target);
+				if (dropped && dropped != target)
+					removeIncoming(dropped, block.get());
+				changed = true;
+			}
+			return changed;
+		}
+
+		bool removeUnreachable() {
+			// the other steps edit the CFG in place, so the cached one is always stale here
+			func->invalidateAnalyses();
+			const ControlFlowGraph& cfg = func->getCFG();
+			if (cfg.rpo.size == cfg.blocks.size)
+				return false;
+
+			for (uint32_t i = 0; i < cfg.blocks.size; i++) {
+				if (cfg.isReachable(i))
+					continue;
+
+				for (uint32_t succ : cfg.succs[i])
+					if (cfg.isReachable(succ))
+						removeIncoming(cfg.blocks[succ], cfg.blocks[i]);
+			}
+
+			tea::vector<bool> reachable;
+			for (uint32_t i = 0; i < cfg.blocks.size; i++)
+				reachable.emplace(cfg.isReachable(i));
+
+			uint32_t count = 0;
+			for (uint32_t i = 0; i < func->blocks.size; i++)
+				if (reachable[i])
+					std::swap(func->blocks[count++], func->blocks[i]);
+			while (func->blocks.size > count)
+				func->blocks.pop();
+
+			func->invalidateAnalyses();
+			return true;
+		}
+
+		// the block a jump to `block` can go to instead, if `block` does nothing but jump
+		BasicBlock* getForwardTarget(const BasicBlock* block) const {
+			if (block == func->blocks[0].get() || block->body.size != 1 || block->body[0].op != OpCode::Br)
+				return nullptr;
+
+			BasicBlock* target = (BasicBlock*)block->body[0].operands[0];
+			if (target == block || hasPhis(target))
+				return nullptr;
+			return target;
+		}
+
+		bool threadJumps() {
+			bool changed = false;
+			for (const auto& block : func->blocks) {
+				Instruction* term = (Instruction*)block->getTerminator();
+				if (!term || (term->op != OpCode::Br && term->op != OpCode::CondBr && term->op != OpCode::Switch))
+					continue;
+
+				// `switch` operands alternate between case values and targets
+				uint32_t stride = term->op == OpCode::Switch ? 2 : 1;
+				for (uint32_t i = term->op == OpCode::Br ? 0 : 1; i < term->operands.size; i += stride) {
+					BasicBlock* target = (BasicBlock*)term->operands[i];
+
+					// a chain of empty blocks may loop back on itself
+					for (uint32_t hops = 0; hops < func->blocks.size; hops++) {
+						BasicBlock* next = getForwardTarget(target);
+						if (!next)
+							break;
+						target = next;
+					}
+
+					if (target != (BasicBlock*)term->operands[i]) {
+						term->operands[i] = (Value*)target;
+						changed = true;
+					}
+				}
+			}
+			return changed;
+		}
+
+		bool mergeBlocks() {
+			computePredecessors(func, preds);
+
+			// merging never moves blocks, so positions can be looked up once
+			tea::map<const BasicBlock*, uint32_t> indices;
+			for (uint32_t i = 0; i < func->blocks.size; i++)
+				indices[func->blocks[i].get()] = i;
+
+			bool changed = false;
+			for (uint32_t i = 1; i < func->blocks.size; i++) {
+				BasicBlock* block = func->blocks[i].get();
+				const auto& blockPreds = *preds.find(block);
+				if (blockPreds.size != 1)
+					continue;
+
+				// values must stay defined before their uses in block order, so only merge forward
+				BasicBlock* pred = blockPreds[0];
+				const Instruction* term = pred->getTerminator();
+				if (pred == block || !term || term->op != OpCode::Br || *indices.find(pred) > i || hasPhis(block))
+					continue;
+
+				pred->body.pop();
+				for (auto& insn : block->body) {
+					if (insn.result)
+						insn.result->name = pred->scope.add(insn.result->name ? insn.result->name : "");
+					pred->body.emplace(std::move(insn));
+				}
+				block->body.clear();
+
+				tea::vector<BasicBlock*> succs;
+				getSuccessors(pred, succs);
+				BlockMap bmap;
+				bmap[block] = pred;
+				for (BasicBlock* succ : succs) {
+					remapOperands(succ, {}, bmap);
+					for (BasicBlock*& p : *preds.find(succ))
+						if (p == block)
+							p = pred;
+				}
+
+				// the now empty block is unreachable and gets removed in the next round
+				preds.find(block)->clear();
+				changed = true;
+			}
+			return changed;
+		}
+	};
+
+	uint32_t simplifyCFG(Function* func, const PassOptions& options) {
+		CFGSimplifier simplifier(func);
+
+		uint32_t blocks = func->blocks.size;
+		uint32_t jumps = simplifier.countJumps();
+		simplifier.run();
+
+		uint32_t removed = blocks - func->blocks.size;
+		if (options.verbose && (removed || jumps != simplifier.countJumps()))
+			printf("MIR: '%s': %u -> %u block(s), %u -> %u jump(s)\n", func->name, blocks, func->blocks.size, jumps, simplifier.countJumps());
+
+		return removed;
+	}
+
+} // namespace tea::mir
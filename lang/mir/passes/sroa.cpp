@@ -0,0 +1,272 @@
+#include "passes.h"
+
+#include <cstdio>
+
+#include "core/tea.h"
+#include "mir/passes/escape.h"
+
+// Scalar replacement of aggregates
+//
+//   %v.addr = alloca Vec                   %v.addr.0 = alloca int
+//   %x = gep int* Vec* %v.addr, 0, 0  =>   %v.addr.1 = alloca int
+//   store int* %x, 3                       store int* %v.addr.0, 3
+//
+// Struct and array allocas whose address never escapes (see escape.h) and whose fields are only reached
+// through constant indices are split into one alloca per field, which the backend can then keep in registers.
+// Constant array initializers become one store per element. Fields that are aggregates themselves are split
+// again in the next round
+
+namespace tea::mir {
+
+	// aggregates with more fields than this are left alone, splitting them would only bloat the function
+	static constexpr uint32_t maxSplitFields = 32;
+
+	class AggregateSplitter {
+		struct Candidate {
+			Value* alloca = nullptr;
+			Type* type = nullptr;
+			uint32_t fields = 0;
+
+			// pointers to a whole field, they are replaced by the field's slot
+			ValueMap pointers;
+			tea::map<const Value*, uint32_t> fieldOf;
+			tea::vector<bool> used;
+		};
+
+		Function* func;
+		Module* module;
+		EscapeAnalysis escapes;
+
+	public:
+		uint32_t split = 0;
+		uint32_t scalars = 0;
+
+		AggregateSplitter(Function* func)
+			: func(func), module(func->parent), escapes(func) {
+		}
+
+		void run() {
+			bool changed = true;
+			while (changed) {
+				changed = false;
+				escapes.recompute();
+
+				tea::vector<Candidate> candidates;
+				for (const auto& block : func->blocks) {
+					for (const auto& insn : block->body) {
+						if (insn.op != OpCode::Alloca)
+							continue;
+
+						Candidate c;
+						if (analyze(insn.result.get(), c))
+							candidates.emplace(std::move(c));
+					}
+				}
+
+				// candidates only refer to values, so rewriting one doesn't invalidate the others
+				for (Candidate& c : candidates) {
+					transform(c);
+					changed = true;
+				}
+			}
+		}
+
+	private:
+		static bool isIntConstant(const Value* v) {
+			return v->kind == ValueKind::Constant && (ConstantKind)v->subclassData == ConstantKind::Number && !v->type->isFloat();
+		}
+
+		Type* getFieldType(const Candidate& c, uint32_t field) const {
+			if (c.type->kind == TypeKind::Array)
+				return ((ArrayType*)c.type)->elementType;
+			return ((StructType*)c.type)->body[field];
+		}
+
+		bool analyze(Value* alloca, Candidate& c) {
+			Type* type = ((PointerType*)alloca->type)->pointee;
+			if (type->kind == TypeKind::Array)
+				c.fields = ((ArrayType*)type)->extra;
+			else if (type->kind == TypeKind::Struct)
+				c.fields = ((StructType*)type)->body.size;
+			else
+				return false;
+
+			if (!c.fields || c.fields > maxSplitFields || escapes.isEscaping(alloca))
+				return false;
+
+			c.alloca = alloca;
+			c.type = type;
+			for (uint32_t i = 0; i < c.fields; i++)
+				c.used.emplace(false);
+
+			for (const auto& use : escapes.getUses(alloca)) {
+				const Instruction* insn = use.insn;
+
+				switch (insn->op) {
+				case OpCode::Store: {
+					// only constant initializers can be taken apart
+					const Value* val = insn->operands[1];
+					if (val->kind != ValueKind::Constant || (ConstantKind)val->subclassData != ConstantKind::Array || ((const ConstantArray*)val)->values.size != c.fields)
+						return false;
+				} break;
+
+				case OpCode::GetElementPtr: {
+					if (insn->operands.size < 3 || !isIntConstant(insn->operands[1]) || ((ConstantNumber*)insn->operands[1])->getInteger() != 0 || !isIntConstant(insn->operands[2]))
+						return false;
+
+					uint64_t field = ((ConstantNumber*)insn->operands[2])->getInteger();
+					if (field >= c.fields)
+						return false;
+
+					c.used[(uint32_t)field] = true;
+					if (insn->operands.size == 3 && !collectField(c, insn->result.get(), (uint32_t)field))
+						return false;
+				} break;
+
+				default:
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		bool collectField(Candidate& c, Value* ptr, uint32_t field) {
+			c.pointers[ptr] = nullptr;
+			c.fieldOf[ptr] = field;
+
+			for (const auto& use : escapes.getUses(ptr)) {
+				const Instruction* insn = use.insn;
+
+				switch (insn->op) {
+				case OpCode::Load:
+				case OpCode::Store:
+					break;
+
+				case OpCode::GetElementPtr: {
+					if (!isIntConstant(insn->operands[1]))
+						return false;
+
+					// indexing into the field itself stays inside of it
+					int64_t offset = ((ConstantNumber*)insn->operands[1])->getSInteger();
+					if (insn->operands.size > 2) {
+						if (offset != 0)
+							return false;
+						break;
+					}
+
+					// pointer arithmetic may only move between array elements
+					int64_t target = (int64_t)field + offset;
+					if (offset != 0 && c.type->kind != TypeKind::Array)
+						return false;
+					if (target < 0 || target >= (int64_t)c.fields)
+						return false;
+
+					c.used[(uint32_t)target] = true;
+					if (!collectField(c, insn->result.get(), (uint32_t)target))
+						return false;
+				} break;
+
+				default:
+					return false;
+				}
+			}
+
+			return true;
+		}
+
+		void transform(Candidate& c) {
+			// the slots take the aggregate's place so that they dominate the same code
+			BasicBlock* home = nullptr;
+			uint32_t at = 0;
+			for (const auto& block : func->blocks) {
+				for (uint32_t i = 0; i < block->body.size; i++) {
+					if (block->body[i].result.get() == c.alloca) {
+						home = block.get();
+						at = i;
+					}
+				}
+			}
+
+			Builder builder(module->ctx);
+			builder.block = home;
+
+			uint32_t end = home->body.size;
+			tea::vector<Value*> slots;
+			for (uint32_t i = 0; i < c.fields; i++) {
+				if (!c.used[i]) {
+					slots.emplace(nullptr);
+					continue;
+				}
+
+				tea::string name = tea::string(c.alloca->name ? c.alloca->name : "") + "." + std::to_string(i).c_str();
+				slots.emplace(builder.alloca_(getFieldType(c, i), name.data()));
+				scalars++;
+			}
+			moveTail(home, end, at + 1);
+
+			for (auto& [ptr, slot] : c.pointers)
+				slot = slots[*c.fieldOf.find(ptr)];
+
+			for (const auto& block : func->blocks) {
+				for (uint32_t i = 0; i < block->body.size; i++) {
+					Instruction& insn = block->body[i];
+
+					if (insn.result && c.pointers.contains(insn.result.get())) {
+						erase(&insn);
+						continue;
+					}
+
+					if (insn.operands.empty() || insn.operands[0] != c.alloca)
+						continue;
+
+					if (insn.op == OpCode::GetElementPtr) {
+						// a nested field, drop the index that selected the outer one
+						tea::vector<Value*> operands = insn.operands;
+						insn.operands.clear();
+						insn.operands.emplace(slots[(uint32_t)((ConstantNumber*)operands[2])->getInteger()]);
+						insn.operands.emplace(operands[1]);
+						for (uint32_t j = 3; j < operands.size; j++)
+							insn.operands.emplace(operands[j]);
+					} else if (insn.op == OpCode::Store) {
+						const ConstantArray* init = (const ConstantArray*)insn.operands[1];
+						erase(&insn);
+
+						end = block->body.size;
+						builder.block = block.get();
+						for (uint32_t j = 0; j < c.fields; j++)
+							if (slots[j])
+								builder.store(slots[j], init->values[j]);
+						moveTail(block.get(), end, i + 1);
+					}
+				}
+			}
+
+			for (const auto& block : func->blocks)
+				remapOperands(block.get(), c.pointers, {});
+
+			for (const auto& block : func->blocks)
+				for (auto& insn : block->body)
+					if (insn.result.get() == c.alloca)
+						erase(&insn);
+
+			split++;
+		}
+
+		static void erase(Instruction* insn) {
+			insn->op = OpCode::Nop;
+			insn->operands.clear();
+		}
+	};
+
+	uint32_t splitAggregates(Function* func, const PassOptions& options) {
+		AggregateSplitter splitter(func);
+		splitter.run();
+
+		if (options.verbose && splitter.split)
+			printf("MIR: '%s': split %u aggregate(s) into %u scalar(s)\n", func->name, splitter.split, splitter.scalars);
+
+		return splitter.split;
+	}
+
+} // namespace tea::mir
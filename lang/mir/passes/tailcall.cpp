@@ -0,0 +1,123 @@
+#include "passes.h"
+
+#include <cstdio>
+
+#include "core/tea.h"
+#include "mir/passes/utils.h"
+#include "mir/passes/escape.h"
+
+// Self-recursive tail call elimination
+//
+//   entry:  ...                          tail.entry: %n.slot = alloca; store %n.slot, %n; br entry
+//   ...                          =>      entry:      %n' = load %n.slot; ...
+//   %r = call @f(%a)                     ...
+//   ret %r                               store %n.slot, %a; br entry
+//
+// Every use of a parameter reads its slot instead, and all allocas move to the new entry block so that
+// looping doesn't grow the stack. Every iteration then shares one slot per local, so nothing is done when
+// the address of any local may leave the function, as a previous iteration could still be looking at it.
+
+namespace tea::mir {
+
+	// the call in `block` whose result is returned right away, if it calls `func` itself
+	static Instruction* findSelfTailCall(Function* func, BasicBlock* block) {
+		const Instruction* term = block->getTerminator();
+		if (!term || term->op != OpCode::Ret)
+			return nullptr;
+
+		for (uint32_t i = (uint32_t)(term - block->body.begin()); i > 0; i--) {
+			Instruction* insn = &block->body[i - 1];
+			if (insn->op == OpCode::Nop)
+				continue;
+
+			if (insn->op != OpCode::Call || insn->operands[0] != func)
+				return nullptr;
+
+			bool returnsResult = insn->result
+				? term->operands.size == 1 && term->operands[0] == insn->result.get()
+				: term->operands.size == 0;
+			return returnsResult ? insn : nullptr;
+		}
+
+		return nullptr;
+	}
+
+	uint32_t eliminateTailRecursion(Function* func, const PassOptions& options) {
+		FunctionType* ftype = (FunctionType*)func->type;
+		if (ftype->extra)
+			return 0;
+
+		tea::vector<BasicBlock*> sites;
+		for (const auto& block : func->blocks)
+			if (findSelfTailCall(func, block.get()))
+				sites.emplace(block.get());
+
+		if (sites.empty())
+			return 0;
+
+		EscapeAnalysis escape(func);
+		escape.recompute();
+		for (const auto& block : func->blocks)
+			for (const auto& insn : block->body)
+				if (insn.op == OpCode::Alloca && escape.isEscaping(insn.result.get()))
+					return 0;
+
+		BasicBlock* header = func->blocks[0].get();
+		BasicBlock* entry = func->insertBlock(0, "tail.entry");
+
+		for (const auto& block : func->blocks) {
+			if (block.get() == entry)
+				continue;
+
+			for (auto& insn : block->body) {
+				if (insn.op != OpCode::Alloca)
+					continue;
+
+				entry->body.emplace(std::move(insn));
+				insn.op = OpCode::Nop;
+				insn.operands.clear();
+			}
+		}
+
+		Builder builder(func->parent->ctx);
+		builder.block = entry;
+
+		tea::vector<Value*> slots;
+		for (const auto& param : func->params)
+			slots.emplace(builder.alloca_(param->type, "arg"));
+		for (uint32_t i = 0; i < slots.size; i++)
+			builder.store(slots[i], func->getParam(i));
+		builder.br(header, false);
+
+		ValueMap replacements;
+		builder.block = header;
+		uint32_t at = header->body.size;
+		for (uint32_t i = 0; i < slots.size; i++)
+			replacements[func->getParam(i)] = builder.load(slots[i], "");
+		moveTail(header, at, 0);
+
+		for (const auto& block : func->blocks)
+			if (block.get() != entry)
+				remapOperands(block.get(), replacements, {});
+
+		for (BasicBlock* block : sites) {
+			Instruction* call = findSelfTailCall(func, block);
+			tea::vector<Value*> args(call->operands.data + 1, call->operands.size - 1);
+
+			call->op = OpCode::Nop;
+			call->operands.clear();
+			block->body.pop();
+
+			builder.block = block;
+			for (uint32_t i = 0; i < slots.size; i++)
+				builder.store(slots[i], args[i]);
+			builder.br(header, false);
+		}
+
+		if (options.verbose)
+			printf("MIR: '%s': %u tail call(s) turned into jumps\n", func->name, sites.size);
+
+		return sites.size;
+	}
+
+} // namespace tea::mir
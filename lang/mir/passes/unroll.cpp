@@ -0,0 +1,389 @@
+#include "passes.h"
+
+#include <cstdio>
+
+#include "core/tea.h"
+#include "mir/passes/loops.h"
+
+namespace tea::mir {
+
+	// loops unrolled without an explicit @unroll hint must stay below these
+	static constexpr uint32_t maxFullUnrollTrips = 16;
+	static constexpr uint32_t maxUnrolledSize = 256;
+	static constexpr uint32_t defaultUnrollFactor = 4;
+
+	class LoopUnroller {
+		Function* func;
+		Module* module;
+		const PassOptions& options;
+
+		LoopAnalysis analysis;
+
+		// per-loop state
+		bool condUsedElsewhere = false;
+		uint32_t size = 0;
+
+	public:
+		uint32_t full = 0;
+		uint32_t partial = 0;
+
+		LoopUnroller(Function* func, const PassOptions& options)
+			: func(func), module(func->parent), options(options), analysis(func) {
+		}
+
+		void run() {
+			// collect candidate headers up front, unrolling inserts blocks
+			tea::vector<BasicBlock*> headers;
+			const ControlFlowGraph& cfg = func->getCFG();
+			for (const Loop& l : func->getLoopNest().loops) {
+				BasicBlock* block = cfg.blocks[l.header];
+				const Instruction* term = block->getTerminator();
+				if (term && term->op == OpCode::CondBr && block->unrollHint != 1)
+					headers.emplace(block);
+			}
+
+			for (BasicBlock* header : headers) {
+				analysis.recompute();
+
+				CountedLoop loop;
+				if (analysis.analyze(header, loop) && isUnrollable(loop))
+					transform(loop);
+			}
+		}
+
+	private:
+		bool isUnrollable(const CountedLoop& loop) {
+			BasicBlock* header = loop.header;
+			size = 0;
+
+			// the header is duplicated once per iteration, so it must be free of side effects
+			for (const auto& insn : header->body) {
+				switch (insn.op) {
+				case OpCode::Call:
+				case OpCode::Store:
+				case OpCode::Alloca:
+				case OpCode::Phi:
+					return false;
+				default:
+					break;
+				}
+				size++;
+			}
+
+			for (BasicBlock* block : loop.region) {
+				for (const auto& insn : block->body) {
+					if (insn.op == OpCode::Alloca)
+						return false;
+					if (insn.op == OpCode::Phi && block == loop.body)
+						return false;
+					if (insn.op != OpCode::Nop)
+						size++;
+				}
+			}
+
+			for (const auto& insn : loop.exit->body)
+				if (insn.op == OpCode::Phi)
+					return false;
+
+			// values computed in the loop must not leak out of it; header values are fine as long as
+			// the header is the only way out
+			for (const auto& block : func->blocks) {
+				if (loop.contains(block.get()))
+					continue;
+
+				for (const auto& insn : block->body) {
+					for (Value* op : insn.operands) {
+						BasicBlock* defBlock = nullptr;
+						if (!analysis.getDef(op, &defBlock) || !loop.contains(defBlock))
+							continue;
+						if (defBlock != header || loop.hasBreak)
+							return false;
+					}
+				}
+			}
+
+			condUsedElsewhere = false;
+			for (BasicBlock* block : loop.region)
+				for (const auto& insn : block->body)
+					for (Value* op : insn.operands)
+						if (op == loop.cond->result.get())
+							condUsedElsewhere = true;
+
+			return true;
+		}
+
+		static bool evalICmp(ICmpPredicate pred, uint64_t lhs, uint64_t rhs, uint8_t bits) {
+			uint64_t mask = bits >= 64 ? ~0ull : (1ull << bits) - 1;
+			lhs &= mask;
+			rhs &= mask;
+
+			int64_t slhs = (int64_t)lhs, srhs = (int64_t)rhs;
+			if (bits < 64) {
+				if (lhs & (1ull << (bits - 1))) slhs = (int64_t)(lhs | ~mask);
+				if (rhs & (1ull << (bits - 1))) srhs = (int64_t)(rhs | ~mask);
+			}
+
+			switch (pred) {
+			case ICmpPredicate::EQ: return lhs == rhs;
+			case ICmpPredicate::NEQ: return lhs != rhs;
+			case ICmpPredicate::SGT: return slhs > srhs;
+			case ICmpPredicate::UGT: return lhs > rhs;
+			case ICmpPredicate::SGE: return slhs >= srhs;
+			case ICmpPredicate::UGE: return lhs >= rhs;
+			case ICmpPredicate::SLT: return slhs < srhs;
+			case ICmpPredicate::ULT: return lhs < rhs;
+			case ICmpPredicate::SLE: return slhs <= srhs;
+			case ICmpPredicate::ULE: return lhs <= rhs;
+			default: return false;
+			}
+		}
+
+		// returns badid if the trip count is unknown or larger than `limit`
+		uint32_t computeTripCount(const CountedLoop& loop, uint32_t limit) {
+			if (loop.bound->kind != ValueKind::Constant || (ConstantKind)loop.bound->subclassData != ConstantKind::Number)
+				return tea::badid;
+
+			Value* init = analysis.findInitialValue(loop);
+			if (!init || init->kind != ValueKind::Constant || (ConstantKind)init->subclassData != ConstantKind::Number)
+				return tea::badid;
+
+			uint64_t i = ((ConstantNumber*)init)->getInteger();
+			uint64_t bound = ((ConstantNumber*)loop.bound)->getInteger();
+			for (uint32_t trips = 0; trips <= limit; trips++) {
+				if (!evalICmp(loop.pred, i, bound, loop.bits))
+					return trips;
+				i += (uint64_t)loop.step;
+			}
+
+			return tea::badid;
+		}
+
+		// the counter has to move towards the bound, the guard of the unrolled copies relies on it
+		bool canUnrollPartially(const CountedLoop& loop) const {
+			if (!loop.boundInvariant)
+				return false;
+
+			switch (loop.pred) {
+			case ICmpPredicate::SLT:
+			case ICmpPredicate::SLE:
+			case ICmpPredicate::ULT:
+			case ICmpPredicate::ULE:
+				return loop.step > 0;
+			case ICmpPredicate::SGT:
+			case ICmpPredicate::SGE:
+				return loop.step < 0;
+			default:
+				return false;
+			}
+		}
+
+		// clone the header's computations (not its terminator) into `dst`
+		void cloneHeader(const CountedLoop& loop, BasicBlock* dst, ValueMap& vmap) {
+			for (const auto& insn : loop.header->body) {
+				if (&insn == loop.header->getTerminator())
+					break;
+				if (&insn == loop.cond && !condUsedElsewhere)
+					continue;
+				cloneInstruction(insn, dst, vmap);
+			}
+			remapOperands(dst, vmap, {});
+		}
+
+		struct RegionCopy {
+			BasicBlock* body = nullptr;
+			BasicBlock* latch = nullptr;
+		};
+
+		// clone the loop region right before `at`, the copy's back edge goes to `next`. `vmap` must map the header's values
+		RegionCopy cloneRegion(const CountedLoop& loop, uint32_t& at, BasicBlock* entry, BasicBlock* next, ValueMap& vmap) {
+			BlockMap bmap;
+			bmap[loop.header] = entry;
+
+			for (BasicBlock* block : loop.region)
+				bmap[block] = func->insertBlock(at++, block->name);
+
+			for (BasicBlock* block : loop.region)
+				for (const auto& insn : block->body)
+					cloneInstruction(insn, *bmap.find(block), vmap);
+
+			for (BasicBlock* block : loop.region)
+				remapOperands(*bmap.find(block), vmap, bmap);
+
+			RegionCopy copy = { *bmap.find(loop.body), *bmap.find(loop.latch) };
+			setBackedge(copy.latch, next);
+			return copy;
+		}
+
+		static void setBackedge(BasicBlock* latch, BasicBlock* target) {
+			((Instruction*)latch->getTerminator())->operands[0] = (Value*)target;
+		}
+
+		static void retarget(BasicBlock* block, BasicBlock* from, BasicBlock* to) {
+			Instruction* term = (Instruction*)block->getTerminator();
+			for (uint32_t i = 0; i < term->operands.size; i++)
+				if (term->operands[i] == (Value*)from)
+					term->operands[i] = (Value*)to;
+		}
+
+		// every iteration gets its own copy of the header and the region, the original header becomes the
+		// final exit check and nothing branches back into the loop anymore
+		void unrollFully(CountedLoop& loop, uint32_t trips) {
+			BasicBlock* header = loop.header;
+			uint32_t at = getBlockIndex(func, header);
+
+			ValueMap firstMap;
+			BasicBlock* first = nullptr;
+			BasicBlock* prevLatch = nullptr;
+			for (uint32_t k = 0; k < trips; k++) {
+				BasicBlock* copy = func->insertBlock(at++, tea::string(header->name) + ".unroll");
+
+				ValueMap vmap;
+				cloneHeader(loop, copy, k == 0 ? firstMap : vmap);
+
+				Builder builder(module->ctx);
+				builder.block = copy;
+
+				BasicBlock* latch = nullptr;
+				if (k == 0) {
+					// the original region is the first iteration, it's rewired once all copies are made
+					builder.br(loop.body, false);
+					latch = loop.latch;
+					first = copy;
+				} else {
+					RegionCopy region = cloneRegion(loop, at, copy, header, vmap);
+					builder.br(region.body, false);
+					latch = region.latch;
+				}
+
+				if (prevLatch)
+					setBackedge(prevLatch, copy);
+				prevLatch = latch;
+			}
+
+			if (first) {
+				BlockMap bmap;
+				bmap[header] = first;
+				for (BasicBlock* block : loop.region)
+					remapOperands(block, firstMap, bmap);
+
+				setBackedge(prevLatch, header);
+				retarget(loop.preheader, header, first);
+			}
+
+			// the condition is known to fail by now
+			Instruction* term = (Instruction*)header->getTerminator();
+			term->operands.clear();
+			term->operands.emplace((Value*)loop.exit);
+			term->op = OpCode::Br;
+
+			if (!condUsedElsewhere) {
+				Instruction* cond = (Instruction*)loop.cond;
+				cond->op = OpCode::Nop;
+				cond->operands.clear();
+			}
+
+			header->unrollHint = 1;
+			full++;
+
+			if (options.verbose)
+				printf("MIR: fully unrolled loop '%s' in '%s' (%u iteration(s))\n", header->name, func->name, trips);
+		}
+
+		// `factor` copies of the region guarded by a single check, the original loop handles the remainder
+		void unrollPartially(CountedLoop& loop, uint32_t factor) {
+			// how far the counter moves over the extra iterations, the guard can never pass if that doesn't fit
+			uint64_t distance = (uint64_t)(loop.step > 0 ? loop.step : -loop.step) * (factor - 1);
+			if (loop.bits < 64 && distance >> loop.bits)
+				return;
+			// the distance is the difference of the two
+			if (!loop.counterLoad->type->equals(loop.bound->type))
+				return;
+
+			BasicBlock* header = loop.header;
+			uint32_t at = getBlockIndex(func, header);
+
+			BasicBlock* guard = func->insertBlock(at++, tea::string(header->name) + ".unroll");
+			ValueMap guardMap;
+			cloneHeader(loop, guard, guardMap);
+
+			// continue only if the last of the next `factor` iterations would still pass the original condition.
+			// `i + step * (factor - 1)` could wrap near the limits of the counter's type, so the distance left to
+			// the bound is compared instead. It is exact as an unsigned number as long as the counter hasn't
+			// passed the bound yet
+			Builder builder(module->ctx);
+			builder.block = guard;
+
+			Value* i = *guardMap.find(loop.counterLoad);
+			Value* bound = loop.bound;
+			if (Value** mapped = guardMap.find(bound))
+				bound = *mapped;
+
+			bool inclusive = loop.pred == ICmpPredicate::SLE || loop.pred == ICmpPredicate::ULE || loop.pred == ICmpPredicate::SGE;
+			Value* delta = ConstantNumber::get(module, distance, loop.bits, i->type->sign);
+			Value* inRange = builder.icmp(loop.pred, i, bound, "");
+			Value* room = loop.step > 0 ? builder.arithm(OpCode::Sub, bound, i, "") : builder.arithm(OpCode::Sub, i, bound, "");
+			Value* fits = builder.icmp(inclusive ? ICmpPredicate::UGE : ICmpPredicate::UGT, room, delta, "");
+			Value* cond = builder.binop(OpCode::And, inRange, fits, "");
+
+			BasicBlock* first = nullptr;
+			BasicBlock* prevLatch = nullptr;
+			for (uint32_t k = 0; k < factor; k++) {
+				if (k == 0) {
+					RegionCopy region = cloneRegion(loop, at, guard, guard, guardMap);
+					first = region.body;
+					prevLatch = region.latch;
+					continue;
+				}
+
+				BasicBlock* copy = func->insertBlock(at++, tea::string(header->name) + ".unroll");
+
+				ValueMap vmap;
+				cloneHeader(loop, copy, vmap);
+
+				RegionCopy region = cloneRegion(loop, at, copy, guard, vmap);
+				Builder b(module->ctx);
+				b.block = copy;
+				b.br(region.body, false);
+
+				setBackedge(prevLatch, copy);
+				prevLatch = region.latch;
+			}
+
+			builder.cbr(cond, first, header);
+			retarget(loop.preheader, header, guard);
+
+			header->unrollHint = 1;
+			guard->unrollHint = 1;
+			partial++;
+
+			if (options.verbose)
+				printf("MIR: unrolled loop '%s' in '%s' by %u\n", header->name, func->name, factor);
+		}
+
+		void transform(CountedLoop& loop) {
+			uint32_t hint = loop.header->unrollHint;
+			// optimizing for size only unrolls what asked for it
+			if (!hint && (options.optLevel < 2 || options.sizeLevel))
+				return;
+
+			uint32_t trips = computeTripCount(loop, hint ? hint : maxFullUnrollTrips);
+			if (trips != tea::badid && (hint || trips * size <= maxUnrolledSize)) {
+				unrollFully(loop, trips);
+				return;
+			}
+
+			uint32_t factor = hint ? hint : defaultUnrollFactor;
+			if (!canUnrollPartially(loop) || (!hint && size * factor > maxUnrolledSize))
+				return;
+
+			unrollPartially(loop, factor);
+		}
+	};
+
+	uint32_t unrollLoops(Function* func, const PassOptions& options) {
+		LoopUnroller unroller(func, options);
+		unroller.run();
+		return unroller.full + unroller.partial;
+	}
+
+} // namespace tea::mir
@@ -0,0 +1,101 @@
+#include "utils.h"
+
+#include <algorithm>
+
+#include "core/tea.h"
+
+namespace tea::mir {
+
+	void getSuccessors(const BasicBlock* block, tea::vector<BasicBlock*>& out) {
+		const Instruction* term = block->getTerminator();
+		if (!term)
+			return;
+
+		switch (term->op) {
+		case OpCode::Br:
+			out.emplace((BasicBlock*)term->operands[0]);
+			break;
+
+		case OpCode::CondBr:
+			out.emplace((BasicBlock*)term->operands[1]);
+			if (term->operands[2] != term->operands[1])
+				out.emplace((BasicBlock*)term->operands[2]);
+			break;
+
+		case OpCode::Switch: {
+			// several cases may share a target
+			uint32_t first = out.size;
+			for (uint32_t i = 1; i < term->operands.size; i += 2) {
+				BasicBlock* target = (BasicBlock*)term->operands[i];
+				if (std::find(out.begin() + first, out.end(), target) == out.end())
+					out.emplace(target);
+			}
+		} break;
+
+		default:
+			break;
+		}
+	}
+
+	void computePredecessors(const Function* func, PredecessorMap& preds) {
+		preds.clear();
+		for (const auto& block : func->blocks)
+			preds[block.get()];
+
+		tea::vector<BasicBlock*> succs;
+		for (const auto& block : func->blocks) {
+			succs.clear();
+			getSuccessors(block.get(), succs);
+			for (BasicBlock* succ : succs)
+				preds[succ].emplace(block.get());
+		}
+	}
+
+	uint32_t getBlockIndex(const Function* func, const BasicBlock* block) {
+		for (uint32_t i = 0; i < func->blocks.size; i++)
+			if (func->blocks[i].get() == block)
+				return i;
+		return tea::badid;
+	}
+
+	void cloneInstruction(const Instruction& insn, BasicBlock* dst, ValueMap& vmap) {
+		Instruction* cloned = dst->body.emplace();
+		cloned->op = insn.op;
+		cloned->extra = insn.extra;
+		cloned->operands = insn.operands;
+		cloned->line = insn.line;
+		cloned->column = insn.column;
+
+		if (insn.result) {
+			cloned->result = std::make_unique<Value>(insn.result->kind, insn.result->type);
+			cloned->result->subclassData = insn.result->subclassData;
+			cloned->result->name = dst->scope.add(insn.result->name ? insn.result->name : "");
+			vmap[insn.result.get()] = cloned->result.get();
+		}
+	}
+
+	void remapOperands(BasicBlock* block, const ValueMap& vmap, const BlockMap& bmap) {
+		for (auto& insn : block->body) {
+			for (uint32_t i = 0; i < insn.operands.size; i++) {
+				Value* op = insn.operands[i];
+
+				if (insn.op == OpCode::Br || (insn.op == OpCode::CondBr && i > 0) || (insn.op == OpCode::Switch && (i & 1)) || (insn.op == OpCode::Phi && i > 0 && !(i & 1))) {
+					if (auto* it = bmap.find((const BasicBlock*)op))
+						insn.operands[i] = (Value*)*it;
+				} else if (!(insn.op == OpCode::Phi && i == 0)) {
+					if (auto* it = vmap.find(op))
+						insn.operands[i] = *it;
+				}
+			}
+		}
+	}
+
+	void moveTail(BasicBlock* block, uint32_t from, uint32_t to) {
+		std::rotate(block->body.begin() + to, block->body.begin() + from, block->body.end());
+	}
+
+	bool isLuauTarget(const Module* module) {
+		return module->triple == "experimental-luau-0.730";
+	}
+
+} // namespace tea::mir
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "mir/mir.h"
+
+namespace tea::mir {
+	typedef tea::map<const Value*, Value*> ValueMap;
+	typedef tea::map<const BasicBlock*, BasicBlock*> BlockMap;
+	typedef tea::map<const BasicBlock*, tea::vector<BasicBlock*>> PredecessorMap;
+
+	/// <summary>
+	/// Append the successors of `block` (decoded from its terminator) to `out`
+	/// </summary>
+	/// <param name="block">The block to inspect</param>
+	/// <param name="out">The vector to append the successors to</param>
+	void getSuccessors(const BasicBlock* block, tea::vector<BasicBlock*>& out);
+
+	/// <summary>
+	/// Build the predecessor lists of every block in `func`
+	/// </summary>
+	/// <param name="func">The function to inspect</param>
+	/// <param name="preds">The map to fill</param>
+	void computePredecessors(const Function* func, PredecessorMap& preds);
+
+	/// <summary>
+	/// Get the position of `block` in its parent's block list
+	/// </summary>
+	/// <returns>The index of the block, or `tea::badid` if it doesn't belong to `func`</returns>
+	uint32_t getBlockIndex(const Function* func, const BasicBlock* block);
+
+	/// <summary>
+	/// Append a copy of `insn` to `dst`. The result (if any) is recreated and recorded in `vmap`,
+	/// operands are copied verbatim and must be fixed up with `remapOperands` afterwards
+	/// </summary>
+	/// <param name="insn">The instruction to clone</param>
+	/// <param name="dst">The block to append the copy to</param>
+	/// <param name="vmap">The value map to record the cloned result in</param>
+	void cloneInstruction(const Instruction& insn, BasicBlock* dst, ValueMap& vmap);
+
+	/// <summary>
+	/// Rewrite every operand of every instruction in `block` that has an entry in `vmap` or `bmap`
+	/// </summary>
+	/// <param name="block">The block to rewrite</param>
+	/// <param name="vmap">Replacement values</param>
+	/// <param name="bmap">Replacement blocks (branch targets and phi incoming blocks)</param>
+	void remapOperands(BasicBlock* block, const ValueMap& vmap, const BlockMap& bmap);
+
+	/// <summary>
+	/// Move the instructions from `from` up to the end of `block` in front of the instruction at `to`.
+	/// Lets passes append with a `Builder` and then place the result where it belongs
+	/// </summary>
+	/// <param name="block">The block to rearrange</param>
+	/// <param name="from">Index of the first instruction to move</param>
+	/// <param name="to">Index to move them to, must not be greater than `from`</param>
+	void moveTail(BasicBlock* block, uint32_t from, uint32_t to);
+
+	/// <summary>
+	/// Check whether the module is lowered to Luau bytecode, where shifts and pointer arithmetic are library calls
+	/// </summary>
+	bool isLuauTarget(const Module* module);
+}